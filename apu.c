@@ -0,0 +1,503 @@
+#include "apu.h"
+#include "audio.h"
+#include "cpu.h"
+#include "memory.h"
+#include "timer.h"
+#include <math.h>
+#include <SDL2/SDL.h> //performance counter for the APU's own cost
+
+APUState apu;
+
+#define BLIP_TAPS 16 //length of the band limited step
+#define BLIP_PHASES 32 //sub sample positions a step can land on
+#define BLIP_BUFFER 2048 //samples between flushes, a frame sequencer tick is under 100 at 48kHz
+#define AUDIO_SCALE 64.0f //4 channels * 15 * volume 8 = 480 at most, about 30000 after this
+#define AUDIO_HIGHPASS 0.0005f //how fast the DC level follows, the DACs aren't centred on 0
+
+//What was written OR'd with this is what the CPU reads back, unused and write only bits read as 1
+static const uint8_t readMask[0x30] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, // FF15, NR21-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, // FF1F, NR41-NR44
+    0x00, 0x00, 0x70, // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // FF27-FF2F
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 // wave RAM
+};
+
+static const uint8_t dutyTable[4] = {0x01, 0x81, 0x87, 0x7E}; //12.5%, 25%, 50%, 75%, leftmost bit plays first
+static const uint8_t waveShift[4] = {4, 0, 1, 2}; //NR32 volume code, 4 = muted
+
+//Host side of the sound, none of this is machine state
+static struct {
+    int sampleRate; //0 = nobody is listening, channels skip straight to the end of each batch
+    uint64_t factor; //output samples per T-cycle, 32.32 fixed point
+    uint64_t offset; //fraction of a sample carried over from the last flush, 32.32
+    uint64_t frameStart; //cycle that buffer[...][0] starts at
+    float buffer[2][BLIP_BUFFER + BLIP_TAPS]; //left/right, band limited steps still to be summed up
+    float integrator[2];
+    float dc[2];
+    int lastLeft[4]; //what each channel already put into the buffers
+    int lastRight[4];
+
+    //stats
+    uint64_t ticks; //performance counter spent running channels and making samples
+    uint64_t startCycle; //systemCycles the stats started at
+} out;
+
+static float blipKernel[BLIP_PHASES][BLIP_TAPS];
+
+//Windowed sinc steps, each phase is a step landing that far between two samples
+static void buildBlipKernel() {
+    for (int p = 0; p < BLIP_PHASES; p++) {
+        float sum = 0;
+        for (int i = 0; i < BLIP_TAPS; i++) {
+            double x = i - (BLIP_TAPS / 2 - 1) - (double)p / BLIP_PHASES;
+            double sinc = x == 0 ? 1.0 : sin(M_PI * x * 0.9) / (M_PI * x * 0.9);
+            double window = 0.42 + 0.5 * cos(M_PI * x / (BLIP_TAPS / 2)) + 0.08 * cos(2 * M_PI * x / (BLIP_TAPS / 2));
+            blipKernel[p][i] = (float)(sinc * window);
+            sum += blipKernel[p][i];
+        }
+        for (int i = 0; i < BLIP_TAPS; i++) blipKernel[p][i] /= sum; //whole step adds up to exactly delta
+    }
+}
+
+static void addDelta(int side, uint64_t cycle, int delta) {
+    uint64_t pos = (cycle - out.frameStart) * out.factor + out.offset;
+    uint64_t index = pos >> 32;
+    if (index >= BLIP_BUFFER) return; //only after a huge jump in time, nothing to hear anyway
+    const float *kernel = blipKernel[(pos >> 27) & (BLIP_PHASES - 1)];
+    float *buffer = &out.buffer[side][index];
+    for (int i = 0; i < BLIP_TAPS; i++) buffer[i] += delta * kernel[i];
+}
+
+//Sums the steps up to `cycle` into samples and hands them to the audio ring
+static void flushSamples(uint64_t cycle) {
+    uint64_t pos = (cycle - out.frameStart) * out.factor + out.offset;
+    int count = (int)(pos >> 32);
+    if (count > BLIP_BUFFER) count = BLIP_BUFFER;
+
+    int16_t frames[BLIP_BUFFER][2];
+    for (int side = 0; side < 2; side++) {
+        float *buffer = out.buffer[side];
+        for (int i = 0; i < count; i++) {
+            out.integrator[side] += buffer[i];
+            out.dc[side] += (out.integrator[side] - out.dc[side]) * AUDIO_HIGHPASS;
+            float sample = (out.integrator[side] - out.dc[side]) * AUDIO_SCALE;
+            if (sample > 32767) sample = 32767;
+            if (sample < -32768) sample = -32768;
+            frames[i][side] = (int16_t)sample;
+        }
+        memmove(buffer, buffer + count, BLIP_TAPS * sizeof(float)); //tails of steps near the end
+        memset(buffer + BLIP_TAPS, 0, count * sizeof(float));
+    }
+    out.frameStart = cycle;
+    out.offset = pos & 0xFFFFFFFF;
+    pushAudio((const int16_t (*)[2])frames, count);
+}
+
+//Channel output
+
+static int channelDigital(int c) {
+    APUChannel *ch = &apu.ch[c];
+    if (!ch->enabled || !ch->dacOn) return 0;
+    switch (c) {
+        case 0:
+        case 1:
+            return (dutyTable[apu.regs[c * 5 + 1] >> 6] >> (7 - ch->position)) & 1 ? ch->volume : 0;
+        case 2: {
+            uint8_t sample = apu.regs[0x20 + ch->position / 2];
+            uint8_t nibble = ch->position & 1 ? sample & 0x0F : sample >> 4; //high nibble plays first
+            return nibble >> waveShift[(apu.regs[0x0C] >> 5) & 0x03];
+        }
+        default:
+            return ch->lfsr & 1 ? 0 : ch->volume;
+    }
+}
+
+//NR50 master volume and NR51 panning applied to one channel, steps go in wherever the level moved
+static void mixChannel(int c, uint64_t cycle) {
+    if (!out.sampleRate) return;
+    uint8_t nr50 = apu.regs[0x14];
+    uint8_t nr51 = apu.regs[0x15];
+    int output = apu.ch[c].output;
+    int left = (nr51 & (0x10 << c)) ? output * (((nr50 >> 4) & 0x07) + 1) : 0;
+    int right = (nr51 & (0x01 << c)) ? output * ((nr50 & 0x07) + 1) : 0;
+    if (left != out.lastLeft[c]) {
+        addDelta(0, cycle, left - out.lastLeft[c]);
+        out.lastLeft[c] = left;
+    }
+    if (right != out.lastRight[c]) {
+        addDelta(1, cycle, right - out.lastRight[c]);
+        out.lastRight[c] = right;
+    }
+}
+
+static void updateOutput(int c, uint64_t cycle) {
+    int output = channelDigital(c);
+    if (output == apu.ch[c].output) return;
+    apu.ch[c].output = output;
+    mixChannel(c, cycle);
+}
+
+static void storeIO(int r) {
+    *memory.memoryMap[0xFF10 + r] = apu.regs[r] | readMask[r];
+}
+
+static void updateStatus() {
+    uint8_t status = apu.power ? 0xF0 : 0x70;
+    for (int c = 0; c < 4; c++) {
+        if (apu.ch[c].enabled) status |= 1 << c;
+    }
+    *memory.memoryMap[0xFF26] = status;
+}
+
+static void disableChannel(int c, uint64_t cycle) {
+    apu.ch[c].enabled = 0;
+    updateOutput(c, cycle);
+    updateStatus();
+}
+
+//Cycles between waveform steps, 0 = the channel's clock is stopped
+static uint64_t channelPeriod(int c) {
+    switch (c) {
+        case 0:
+        case 1: return (uint64_t)(2048 - apu.ch[c].frequency) * 4;
+        case 2: return (uint64_t)(2048 - apu.ch[c].frequency) * 2;
+        default: {
+            uint8_t nr43 = apu.regs[0x12];
+            int shift = nr43 >> 4;
+            if (shift >= 14) return 0; //no clocks at all
+            uint64_t divisor = (nr43 & 0x07) ? (nr43 & 0x07) * 16 : 8;
+            return divisor << shift;
+        }
+    }
+}
+
+//Nothing would change what comes out of it, stepping every position is wasted work
+static int channelSilent(int c) {
+    if (!out.sampleRate) return 1;
+    if (c == 2) return ((apu.regs[0x0C] >> 5) & 0x03) == 0;
+    return apu.ch[c].volume == 0;
+}
+
+//Moves a channel's waveform through every step that falls on or before `end`
+static void runChannel(int c, uint64_t end) {
+    APUChannel *ch = &apu.ch[c];
+    if (!ch->enabled || ch->nextStep > end) return;
+    uint64_t period = channelPeriod(c);
+    if (period == 0) return;
+
+    if (channelSilent(c)) { //jump straight to the end, the noise LFSR just holds still
+        uint64_t steps = (end - ch->nextStep) / period + 1;
+        if (c != 3) ch->position = (int)((ch->position + steps) & (c == 2 ? 31 : 7));
+        ch->nextStep += steps * period;
+        ch->output = channelDigital(c);
+        return;
+    }
+
+    while (ch->nextStep <= end) {
+        if (c == 3) {
+            uint16_t bit = (ch->lfsr ^ (ch->lfsr >> 1)) & 1;
+            ch->lfsr = (ch->lfsr >> 1) | (bit << 14);
+            if (apu.regs[0x12] & 0x08) ch->lfsr = (ch->lfsr & ~0x40) | (bit << 6); //7 bit mode
+        }
+        else {
+            ch->position = (ch->position + 1) & (c == 2 ? 31 : 7);
+        }
+        updateOutput(c, ch->nextStep);
+        ch->nextStep += period;
+    }
+}
+
+//Frame sequencer
+
+static int sweepCalculation(uint64_t cycle) {
+    APUChannel *ch = &apu.ch[0];
+    int delta = ch->shadowFrequency >> (apu.regs[0x00] & 0x07);
+    int frequency;
+    if (apu.regs[0x00] & 0x08) {
+        frequency = ch->shadowFrequency - delta;
+        ch->sweepNegated = 1;
+    }
+    else {
+        frequency = ch->shadowFrequency + delta;
+    }
+    if (frequency > 2047) disableChannel(0, cycle);
+    return frequency;
+}
+
+static void clockSweep(uint64_t cycle) {
+    APUChannel *ch = &apu.ch[0];
+    if (--ch->sweepTimer > 0) return;
+    int period = (apu.regs[0x00] >> 4) & 0x07;
+    ch->sweepTimer = period ? period : 8;
+    if (!ch->sweepEnabled || !period || !ch->enabled) return;
+
+    int frequency = sweepCalculation(cycle);
+    if (frequency <= 2047 && (apu.regs[0x00] & 0x07)) {
+        ch->shadowFrequency = frequency;
+        ch->frequency = frequency;
+        apu.regs[0x03] = frequency & 0xFF;
+        apu.regs[0x04] = (apu.regs[0x04] & ~0x07) | (frequency >> 8);
+        sweepCalculation(cycle); //only checked for overflow, not written back
+    }
+}
+
+static void clockLength(int c, uint64_t cycle) {
+    APUChannel *ch = &apu.ch[c];
+    if (ch->lengthEnabled && ch->length > 0 && --ch->length == 0) disableChannel(c, cycle);
+}
+
+static void clockEnvelope(int c, uint64_t cycle) {
+    APUChannel *ch = &apu.ch[c];
+    uint8_t nrx2 = apu.regs[c * 5 + 2];
+    int period = nrx2 & 0x07;
+    if (!period || !ch->enabled) return;
+    if (--ch->envelopeTimer > 0) return;
+    ch->envelopeTimer = period;
+    if ((nrx2 & 0x08) && ch->volume < 15) ch->volume++;
+    else if (!(nrx2 & 0x08) && ch->volume > 0) ch->volume--;
+    updateOutput(c, cycle);
+}
+
+static void clockFrameSequencer(uint64_t cycle) {
+    if (!apu.power) return;
+    int step = apu.frameStep;
+    apu.frameStep = (step + 1) & 7;
+    if (!(step & 1)) { // 0, 2, 4, 6: length counters at 256Hz
+        for (int c = 0; c < 4; c++) clockLength(c, cycle);
+    }
+    if (step == 2 || step == 6) clockSweep(cycle); // 128Hz
+    if (step == 7) { // 64Hz
+        clockEnvelope(0, cycle);
+        clockEnvelope(1, cycle);
+        clockEnvelope(3, cycle);
+    }
+}
+
+//Ticks happen where the DIV counter's bit 12 falls, so a DIV reset moves them
+static uint64_t nextTickAfter(uint64_t cycle) {
+    if (cycle < timer.divBase) return timer.divBase + APU_FRAME_SEQ_CYCLES;
+    return timer.divBase + ((cycle - timer.divBase) / APU_FRAME_SEQ_CYCLES + 1) * APU_FRAME_SEQ_CYCLES;
+}
+
+//Runs the channels and the frame sequencer up to the end of cycle `to`
+static void catchUpAPU(uint64_t to) {
+    while (apu.lastCycle < to) {
+        uint64_t tick = nextTickAfter(apu.lastCycle);
+        uint64_t end = tick <= to ? tick : to;
+        for (int c = 0; c < 4; c++) runChannel(c, end);
+        apu.lastCycle = end;
+        if (end == tick) clockFrameSequencer(tick);
+    }
+}
+
+void initAPU() {
+    memset(&apu, 0, sizeof(apu));
+    for (int r = 0; r < 0x30; r++) apu.regs[r] = *memory.memoryMap[0xFF10 + r]; //post boot values from initMemory
+    apu.power = apu.regs[0x16] >> 7;
+    for (int c = 0; c < 4; c++) {
+        APUChannel *ch = &apu.ch[c];
+        ch->dacOn = c == 2 ? apu.regs[0x0A] >> 7 : (apu.regs[c * 5 + 2] & 0xF8) != 0;
+        ch->lengthEnabled = (apu.regs[c * 5 + 4] >> 6) & 1;
+        if (c < 3) ch->frequency = apu.regs[c * 5 + 3] | ((apu.regs[c * 5 + 4] & 0x07) << 8);
+        ch->lfsr = 0x7FFF;
+        ch->nextStep = systemCycles + channelPeriod(c);
+    }
+    apu.ch[0].enabled = apu.regs[0x16] & 0x01; //boot sound's channel is still on, its envelope has run down to 0
+    apu.lastCycle = systemCycles;
+    apu.nextEventCycle = 0;
+    for (int r = 0; r < 0x16; r++) storeIO(r);
+    updateStatus();
+}
+
+void stepAPU() {
+    if (systemCycles < apu.nextEventCycle) return;
+    uint64_t start = SDL_GetPerformanceCounter();
+    catchUpAPU(systemCycles);
+    if (out.sampleRate) flushSamples(apu.lastCycle);
+    apu.nextEventCycle = nextTickAfter(apu.lastCycle);
+    out.ticks += SDL_GetPerformanceCounter() - start;
+}
+
+//Call before a sound register changes
+void syncAPU() {
+    uint64_t start = SDL_GetPerformanceCounter();
+    catchUpAPU(systemCycles);
+    out.ticks += SDL_GetPerformanceCounter() - start;
+}
+
+static void trigger(int c, uint64_t cycle) {
+    APUChannel *ch = &apu.ch[c];
+    uint8_t nrx2 = apu.regs[c * 5 + 2];
+    ch->enabled = ch->dacOn;
+    if (ch->length == 0) {
+        ch->length = c == 2 ? 256 : 64;
+        if (ch->lengthEnabled && (apu.frameStep & 1)) ch->length--; //next step doesn't clock length, so it loses one now
+    }
+    uint64_t period = channelPeriod(c);
+    ch->nextStep = cycle + (period ? period : 1);
+    if (c == 2) ch->position = 0;
+    else {
+        ch->volume = nrx2 >> 4;
+        ch->envelopeTimer = nrx2 & 0x07;
+    }
+    if (c == 3) ch->lfsr = 0x7FFF;
+    if (c == 0) {
+        int sweepPeriod = (apu.regs[0x00] >> 4) & 0x07;
+        ch->shadowFrequency = ch->frequency;
+        ch->sweepTimer = sweepPeriod ? sweepPeriod : 8;
+        ch->sweepNegated = 0;
+        ch->sweepEnabled = sweepPeriod || (apu.regs[0x00] & 0x07);
+        if (apu.regs[0x00] & 0x07) sweepCalculation(cycle); //overflow check straight away
+    }
+    updateOutput(c, cycle);
+    updateStatus();
+}
+
+static void writePower(uint8_t value, uint64_t cycle) {
+    int on = value >> 7;
+    if (!on && apu.power) { //off clears every register, DMG length counters survive it
+        for (int r = 0; r < 0x16; r++) apu.regs[r] = 0;
+        for (int c = 0; c < 4; c++) {
+            APUChannel *ch = &apu.ch[c];
+            ch->enabled = 0;
+            ch->dacOn = 0;
+            ch->lengthEnabled = 0;
+            ch->volume = 0;
+            ch->frequency = 0;
+            updateOutput(c, cycle);
+            mixChannel(c, cycle);
+        }
+    }
+    else if (on && !apu.power) {
+        apu.frameStep = 0;
+        apu.ch[0].position = 0;
+        apu.ch[1].position = 0;
+    }
+    apu.power = on;
+    for (int r = 0; r < 0x16; r++) storeIO(r);
+    updateStatus();
+}
+
+void writeAPU(uint16_t addr, uint8_t value) {
+    syncAPU();
+    uint64_t cycle = apu.lastCycle;
+    int r = addr - 0xFF10;
+
+    if (r >= 0x20) { //wave RAM, always writable
+        apu.regs[r] = value;
+        storeIO(r);
+        return;
+    }
+    if (r == 0x16) {
+        writePower(value, cycle);
+        return;
+    }
+    if (!apu.power) { //only the length counters take writes while off
+        if (r == 0x01 || r == 0x06 || r == 0x10) apu.ch[r / 5].length = 64 - (value & 0x3F);
+        else if (r == 0x0B) apu.ch[2].length = 256 - value;
+        return;
+    }
+
+    apu.regs[r] = value;
+    storeIO(r);
+    if (r == 0x14 || r == 0x15) { //NR50/NR51, every channel lands somewhere else now
+        for (int c = 0; c < 4; c++) mixChannel(c, cycle);
+        return;
+    }
+    if (r > 0x15) return; //unused
+
+    int c = r / 5;
+    APUChannel *ch = &apu.ch[c];
+    switch (r % 5) {
+        case 0:
+            if (c == 0 && !(value & 0x08) && ch->sweepNegated) disableChannel(0, cycle); //leaving negate mode after using it kills the channel
+            if (c == 2) {
+                ch->dacOn = value >> 7;
+                if (!ch->dacOn) disableChannel(2, cycle);
+            }
+            break;
+        case 1: //length, and duty on the square channels
+            ch->length = c == 2 ? 256 - value : 64 - (value & 0x3F);
+            if (c < 2) updateOutput(c, cycle);
+            break;
+        case 2:
+            if (c == 2) { //NR32 output level
+                updateOutput(2, cycle);
+                break;
+            }
+            ch->dacOn = (value & 0xF8) != 0; //volume 0 and decreasing turns the DAC off
+            if (!ch->dacOn) disableChannel(c, cycle);
+            break;
+        case 3:
+            if (c < 3) ch->frequency = (ch->frequency & 0x700) | value;
+            break;
+        case 4: {
+            if (c < 3) ch->frequency = (ch->frequency & 0xFF) | ((value & 0x07) << 8);
+            int wasEnabled = ch->lengthEnabled;
+            ch->lengthEnabled = (value >> 6) & 1;
+            if (!wasEnabled && ch->lengthEnabled && (apu.frameStep & 1) && ch->length > 0) {
+                //enabling length on a step that won't clock it still takes one off
+                if (--ch->length == 0 && !(value & 0x80)) disableChannel(c, cycle);
+            }
+            if (value & 0x80) trigger(c, cycle);
+            break;
+        }
+    }
+}
+
+void resetDivAPU(uint16_t counter) {
+    syncAPU();
+    if (counter & 0x1000) clockFrameSequencer(apu.lastCycle); //bit 12 drops to 0 with the reset, that's a tick
+    apu.nextEventCycle = 0; //ticks move with DIV, reschedule next cycle
+}
+
+static void clearOutput() {
+    memset(out.buffer, 0, sizeof(out.buffer));
+    out.frameStart = apu.lastCycle;
+    out.offset = 0;
+}
+
+void setAudioOutput(int sampleRate) {
+    syncAPU();
+    if (out.sampleRate) flushSamples(apu.lastCycle);
+    if (sampleRate && !out.sampleRate) {
+        buildBlipKernel();
+        out.integrator[0] = out.integrator[1] = 0;
+        out.dc[0] = out.dc[1] = 0;
+        memset(out.lastLeft, 0, sizeof(out.lastLeft));
+        memset(out.lastRight, 0, sizeof(out.lastRight));
+    }
+    out.sampleRate = sampleRate;
+    out.startCycle = systemCycles;
+    out.ticks = 0;
+    if (!sampleRate) return;
+    out.factor = (uint64_t)(((double)sampleRate / APU_CLOCK) * 4294967296.0);
+    clearOutput();
+    for (int c = 0; c < 4; c++) {
+        apu.ch[c].output = channelDigital(c);
+        mixChannel(c, apu.lastCycle);
+    }
+}
+
+void setAudioRateRatio(double ratio) {
+    if (!out.sampleRate) return;
+    syncAPU();
+    flushSamples(apu.lastCycle); //everything so far at the old rate
+    out.factor = (uint64_t)(((double)out.sampleRate / (APU_CLOCK * ratio)) * 4294967296.0);
+}
+
+void resyncAudio() {
+    if (!out.sampleRate) return;
+    clearOutput();
+    for (int c = 0; c < 4; c++) mixChannel(c, apu.lastCycle);
+}
+
+void printAPUStats() {
+    double seconds = (double)(systemCycles - out.startCycle) / APU_CLOCK;
+    if (seconds <= 0) return;
+    double ms = out.ticks * 1000.0 / SDL_GetPerformanceFrequency();
+    printf("APU: %.2f ms of host time per emulated second%s\n", ms / seconds, out.sampleRate ? "" : " (no audio output)");
+}
@@ -0,0 +1,57 @@
+#ifndef APU_H
+#define APU_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+#define APU_CLOCK 4194304 //T-cycles per second
+#define APU_FRAME_SEQ_CYCLES 8192 //frame sequencer runs at 512Hz, off the falling edge of DIV bit 4
+
+typedef struct {
+    int enabled; //status bit in NR52
+    int dacOn;
+    int length; //counts down while length is enabled, channel stops at 0
+    int lengthEnabled;
+    int volume; //0-15
+    int envelopeTimer;
+    int frequency; //11 bit value from NRx3/NRx4
+    uint64_t nextStep; //cycle the waveform moves on next
+    int position; //duty step 0-7 or wave sample 0-31
+    int output; //digital level 0-15 the channel puts out right now
+
+    //channel 1 sweep
+    int sweepTimer;
+    int sweepEnabled;
+    int shadowFrequency;
+    int sweepNegated; //a negate calculation happened since the trigger
+
+    //channel 4
+    uint16_t lfsr;
+} APUChannel;
+
+//Sound registers and channel state. Channels only get run when something needs them:
+//a register write, a frame sequencer tick or the samples being collected.
+typedef struct {
+    uint8_t regs[0x30]; //FF10-FF3F as written, memory.io holds what reads give back
+    APUChannel ch[4];
+    int power; //NR52 bit 7
+    int frameStep; //frame sequencer step 0-7 that runs on the next tick
+    uint64_t lastCycle; //channels are run up to the end of this cycle
+    uint64_t nextEventCycle; //next frame sequencer tick, stepAPU sleeps until then
+} APUState;
+
+extern APUState apu;
+
+void initAPU();
+void stepAPU();
+void syncAPU();
+void writeAPU(uint16_t addr, uint8_t value);
+void resetDivAPU(uint16_t counter); //DIV write, call with the counter value from before the reset
+void setAudioOutput(int sampleRate); //0 = registers only, no samples made
+void setAudioRateRatio(double ratio); //>1 makes fewer samples per emulated second, for holding the host audio buffer level
+void resyncAudio(); //after a savestate moved the cycle counter
+void printAPUStats();
+
+#endif
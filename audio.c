@@ -0,0 +1,88 @@
+#include "audio.h"
+
+AudioState audio;
+
+//Runs on SDL's audio thread, takes whatever the APU has made so far
+static void audioCallback(void *data, Uint8 *stream, int len) {
+    (void)data;
+    int16_t (*out)[2] = (int16_t (*)[2])stream;
+    int wanted = len / (int)sizeof(out[0]);
+
+    unsigned tail = (unsigned)SDL_AtomicGet(&audio.tail);
+    unsigned head = (unsigned)SDL_AtomicGet(&audio.head);
+    int available = (int)(head - tail);
+    int count = available < wanted ? available : wanted;
+
+    for (int i = 0; i < count; i++) {
+        out[i][0] = audio.frames[(tail + i) & (AUDIO_RING_SIZE - 1)][0];
+        out[i][1] = audio.frames[(tail + i) & (AUDIO_RING_SIZE - 1)][1];
+    }
+    if (count > 0) {
+        audio.last[0] = out[count - 1][0];
+        audio.last[1] = out[count - 1][1];
+        SDL_AtomicSet(&audio.tail, (int)(tail + count));
+    }
+    if (count < wanted) {
+        for (int i = count; i < wanted; i++) {
+            out[i][0] = audio.last[0];
+            out[i][1] = audio.last[1];
+        }
+        SDL_AtomicAdd(&audio.underruns, 1);
+    }
+}
+
+int startAudio(int sampleRate) {
+    SDL_AtomicSet(&audio.head, 0);
+    SDL_AtomicSet(&audio.tail, 0);
+    SDL_AtomicSet(&audio.underruns, 0);
+
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = sampleRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = AUDIO_DEVICE_SAMPLES;
+    want.callback = audioCallback;
+
+    audio.device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (audio.device == 0) {
+        printf("No audio: %s\n", SDL_GetError());
+        audio.sampleRate = 0;
+        return 0;
+    }
+    audio.sampleRate = have.freq;
+    SDL_PauseAudioDevice(audio.device, 0);
+    return audio.sampleRate;
+}
+
+void stopAudio() {
+    if (audio.device == 0) return;
+    SDL_CloseAudioDevice(audio.device); //waits for the callback to finish
+    audio.device = 0;
+}
+
+//Emulation side, whatever doesn't fit is dropped rather than waiting on the device
+void pushAudio(const int16_t (*frames)[2], int count) {
+    unsigned head = (unsigned)SDL_AtomicGet(&audio.head);
+    int space = AUDIO_RING_SIZE - (int)(head - (unsigned)SDL_AtomicGet(&audio.tail));
+    if (count > space) {
+        audio.overruns += count - space;
+        count = space;
+    }
+    for (int i = 0; i < count; i++) {
+        audio.frames[(head + i) & (AUDIO_RING_SIZE - 1)][0] = frames[i][0];
+        audio.frames[(head + i) & (AUDIO_RING_SIZE - 1)][1] = frames[i][1];
+    }
+    SDL_AtomicSet(&audio.head, (int)(head + count)); //publish only once the frames are written
+    audio.pushedFrames += count;
+}
+
+int audioQueued() {
+    return (int)((unsigned)SDL_AtomicGet(&audio.head) - (unsigned)SDL_AtomicGet(&audio.tail));
+}
+
+void printAudioStats() {
+    if (audio.sampleRate == 0) return;
+    printf("Audio: %llu frames at %d Hz, %llu dropped (ring full), %d underruns\n", (unsigned long long)audio.pushedFrames,
+        audio.sampleRate, (unsigned long long)audio.overruns, SDL_AtomicGet(&audio.underruns));
+}
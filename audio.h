@@ -0,0 +1,36 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //audio device, and atomics shared with its callback
+
+#define AUDIO_RING_SIZE 8192 //stereo frames between the APU and the audio callback, power of 2
+#define AUDIO_DEVICE_SAMPLES 512 //frames the device asks for at a time
+
+typedef struct {
+    SDL_atomic_t head; //written by the emulation only
+    SDL_atomic_t tail; //written by the audio callback only
+    int16_t frames[AUDIO_RING_SIZE][2];
+    int16_t last[2]; //repeated when the ring runs dry so it doesn't click
+
+    SDL_AudioDeviceID device;
+    int sampleRate; //what the device actually runs at
+
+    //stats
+    uint64_t pushedFrames;
+    uint64_t overruns; //frames thrown away because the ring was full, emulation side
+    SDL_atomic_t underruns; //callbacks that ran out of frames
+} AudioState;
+
+extern AudioState audio;
+
+int startAudio(int sampleRate); //opens the default device, returns its sample rate or 0
+void stopAudio();
+void pushAudio(const int16_t (*frames)[2], int count);
+int audioQueued(); //frames waiting for the device
+void printAudioStats();
+
+#endif
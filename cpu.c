@@ -2,8 +2,22 @@
 #include "memory.h"
 #include "input.h"
 #include "ppu.h"
+#include "timer.h"
+#include "serial.h"
+#include "testrom.h"
+#include "apu.h"
+#include "rtc.h"
+#include "sram.h"
+#include "debugger.h"
+#include "trace.h"
+#include "movie.h"
+#include "hud.h"
+#include "heatmap.h"
 
 CPUState CPUreg;
+uint64_t systemCycles = 0;
+uint64_t instructionsExecuted = 0;
+uint64_t haltSkippedCycles = 0;
 
 void initCPU(){
     CPUreg.af.F = 0xB0; // set flags to default (Z=1, N=0, H=1, C=1)
@@ -113,31 +127,56 @@ void handleMBCWrite(uint16_t addr, uint8_t value) {
         }
         else if (addr <= 0x7FFF) {
             if (memory.mbc3_rtc_latch == 0 && value == 1) { //only triggers when going from 0 to 1
-                // Latch RTC registers from system clock
-                time_t t = time(NULL);
-                struct tm *tm = localtime(&t);
-
-                memory.mbc3_rtc_regs[0] = tm->tm_sec;        // seconds
-                memory.mbc3_rtc_regs[1] = tm->tm_min;        // minutes
-                memory.mbc3_rtc_regs[2] = tm->tm_hour;       // hours
-                memory.mbc3_rtc_regs[3] = tm->tm_mday & 0xFF; // lower 8 bits of day
-                memory.mbc3_rtc_regs[4] = ((tm->tm_yday & 0x01) << 0) | 0; // upper day bit, control flags = 0
-                }
+                latchRTC(); //clock runs on emulated time, reads see this copy until the next latch
+            }
             memory.mbc3_rtc_latch = value;
             }
         }
     if (addr >= 0xA000 && addr <= 0xBFFF) {
+        if (memory.mbcType == 3 && memory.mbc_ram_bank >= 0x08 && memory.mbc_ram_bank <= 0x0C) {
+            if (memory.mbc_ram_enable) writeRTC(memory.mbc_ram_bank - 0x08, value); //sets the live counters
+            return;
+        }
         if (memory.mbc_ram_enable) {
             *memory.memoryMap[addr] = value;  // write to ERAM
+            markSRAMDirty(memory.memoryMap[addr], 1); //goes out to the .sav once the game stops writing
         }
         return;
     }
     }
 
+//Bookkeeping for memory writes other subsystems cache against, called right before every CPU or DMA store lands
+void trackWrite(uint16_t addr) {
+    if (addr >= 0x8000 && addr <= 0x9FFF) {
+        syncDeferredLines(); //recorded lines still need the old tiles
+        ppu.vramGeneration++;
+    }
+    else if (addr >= 0xFE00 && addr <= 0xFE9F) {
+        syncDeferredLines();
+        ppu.oamGeneration++; //sprite line index has to be rebuilt
+    }
+    else if (addr >= 0xFF40 && addr <= 0xFF4B) {
+        syncPPU(); //INC/DEC (HL) on a PPU register skips LDVal8
+    }
+    else if (addr >= 0xFF04 && addr <= 0xFF07) {
+        syncTimer();
+    }
+    else if (addr >= 0xA000 && addr <= 0xBFFF) {
+        markSRAMDirty(memory.memoryMap[addr], 1); //INC/DEC (HL) on battery RAM, the flush can't run before the store lands
+    }
+    else if (addr >= 0xFF10 && addr <= 0xFF3F) {
+        syncAPU(); //INC/DEC (HL) on a sound register, the store lands without the channel side effects
+    }
+}
+
 void LDVal8(uint8_t value, uint8_t *dest, uint16_t addr, bool isMemory, uint16_t src) {
 
     uint8_t mode = *memory.memoryMap[0xFF41] & 0x03; //PPU mode (0 = HBlank, 1 = VBlank, 2 = OAM, 3 = Transfer)
 
+    if (addr >= 0xFF40 && addr <= 0xFF4B) {
+        syncPPU(); //PPU may be asleep, catch it up before its registers change under it
+    }
+
     if(addr == 0xFF40 && (value >> 7) == 0) { // If LCDC is disabled, reset LY to 0
         LCDUpdate(0);
         //fprintf(logFile, "LCDC disabled, cycle: %ld\n", realCyclesAccumulated);
@@ -184,9 +223,19 @@ void LDVal8(uint8_t value, uint8_t *dest, uint16_t addr, bool isMemory, uint16_t
     }
 
 
+    if (src >= 0xFF04 && src <= 0xFF05) {
+        value = readTimer(src); //DIV and TIMA are only worked out when read
+    }
+
+    if (src == 0xFF26) {
+        syncAPU(); //channel status bits may have run out since the last write
+        value = *memory.memoryMap[0xFF26];
+    }
+
     if (src == 0xFF00){
         // Special case for Joypad register
         value = readJoypad(*memory.memoryMap[0xFF00]);
+        input.polled = 1; //frame isn't a lag frame
     }
         
     if (isMemory) {
@@ -200,6 +249,11 @@ void LDVal8(uint8_t value, uint8_t *dest, uint16_t addr, bool isMemory, uint16_t
         // Block unusable area
         if (addr >= 0xFEA0 && addr <= 0xFEFF) return;
 
+        if (addr >= 0xFF10 && addr <= 0xFF3F) {
+            writeAPU(addr, value); //sound registers and wave RAM, handles read masks and triggers
+            return;
+        }
+
         // I/O special cases
         switch (addr) {
             case 0xFF0F:  // IF
@@ -215,8 +269,15 @@ void LDVal8(uint8_t value, uint8_t *dest, uint16_t addr, bool isMemory, uint16_t
                 *dest = (*dest & 0xCF) | (value & 0x30);  // Keep only bits 4 and 5
                 *memory.memoryMap[0xFF00] = readJoypad(*memory.memoryMap[0xFF00]);
                 return;
+            case 0xFF01:  // SB
+            case 0xFF02:  // SC, may start a transfer
+                writeSerial(addr, value);
+                return;
             case 0xFF04:  // DIV (Divider)
-                *dest = 0;  // Writing resets to 0
+            case 0xFF05:  // TIMA
+            case 0xFF06:  // TMA
+            case 0xFF07:  // TAC
+                writeTimer(addr, value); // handles the DIV reset and TAC glitches
                 return;
 
             case 0xFF41:  // STAT
@@ -237,6 +298,7 @@ void LDVal8(uint8_t value, uint8_t *dest, uint16_t addr, bool isMemory, uint16_t
                 uint8_t dmaSource = *memory.memoryMap[0xFF46]; // Get DMA source address
                 uint16_t sourceAddr = dmaSource << 8; // Convert to 16-bit address
                 uint16_t destAddr = 0xFE00; // OAM starts at 0xFE00
+                trackWrite(destAddr); //whole OAM replaced
                 for (int i = 0; i < 0xA0; i++) { // Transfer 160 bytes (40 sprites * 4 bytes each)
                     *memory.memoryMap[destAddr + i] = *memory.memoryMap[sourceAddr + i];
                 }
@@ -247,6 +309,7 @@ void LDVal8(uint8_t value, uint8_t *dest, uint16_t addr, bool isMemory, uint16_t
         }
 
         // Normal memory write
+        trackWrite(addr);
         if (dest) *dest = value;
     } else {
         // Register write
@@ -398,7 +461,9 @@ void op_0xE9() { // JP (HL)
 void conditionalCall(int condition) {
     if (condition) {
         *memory.memoryMap[--CPUreg.SP] = (CPUreg.PC + 3) >> 8;
+        HEAT_WRITE(CPUreg.SP);
         *memory.memoryMap[--CPUreg.SP] = (CPUreg.PC + 3) & 0xFF;
+        HEAT_WRITE(CPUreg.SP);
         CPUreg.PC = (*memory.memoryMap[CPUreg.PC + 2] << 8) | *memory.memoryMap[CPUreg.PC + 1];
         CPUreg.cyclesAccumulated += 24;
     } else {
@@ -427,6 +492,8 @@ void op_0xCD() { // CALL a16 (unconditional)
 
 void conditionalReturn(int condition) {
     if (condition) {
+        HEAT_READ(CPUreg.SP);
+        HEAT_READ(CPUreg.SP + 1);
         CPUreg.PC = (*memory.memoryMap[CPUreg.SP + 1] << 8) | *memory.memoryMap[CPUreg.SP];
         CPUreg.SP += 2;
         CPUreg.cyclesAccumulated += 20;
@@ -437,6 +504,8 @@ void conditionalReturn(int condition) {
 }
 
 void unconditionalReturn() {
+    HEAT_READ(CPUreg.SP);
+    HEAT_READ(CPUreg.SP + 1);
     CPUreg.PC = (*memory.memoryMap[CPUreg.SP + 1] << 8) | *memory.memoryMap[CPUreg.SP]; //set PC to value on stack
     CPUreg.SP += 2; //increment stack pointer by 2
     CPUreg.cyclesAccumulated += 16;
@@ -470,7 +539,9 @@ void op_0xD9(){ //return from interrupt 16T 1PC
 void restartTo(uint8_t addr) {
     CPUreg.PC += 1;
     *memory.memoryMap[--CPUreg.SP] = (CPUreg.PC) >> 8; //push high byte of PC onto stack
+    HEAT_WRITE(CPUreg.SP);
     *memory.memoryMap[--CPUreg.SP] = (CPUreg.PC) & 0xFF; //push low byte of PC onto stack
+    HEAT_WRITE(CPUreg.SP);
     CPUreg.PC = addr; //set PC to restart address
     CPUreg.cyclesAccumulated += 16;
 }
@@ -533,7 +604,9 @@ void op_0x31() { // LD SP, imm16
 
 void pushReg(uint8_t high, uint8_t low) {
     *memory.memoryMap[--CPUreg.SP] = high;
+    HEAT_WRITE(CPUreg.SP);
     *memory.memoryMap[--CPUreg.SP] = low;
+    HEAT_WRITE(CPUreg.SP);
     CPUreg.PC += 1;
     CPUreg.cyclesAccumulated += 16;
 }
@@ -567,6 +640,8 @@ void op_0xF9(){ //load HL into SP 8T 1PC
 
 
 void popReg(uint8_t *high, uint8_t *low, int isAF) {
+    HEAT_READ(CPUreg.SP);
+    HEAT_READ(CPUreg.SP + 1);
     *low = *memory.memoryMap[CPUreg.SP];
     *high = *memory.memoryMap[CPUreg.SP + 1];
     if (isAF) *low &= 0xF0;
@@ -582,6 +657,8 @@ void op_0xF1() { popReg(&CPUreg.af.A, &CPUreg.af.F, 1); }
 
 void op_0x08() {
     uint16_t addr = (*memory.memoryMap[CPUreg.PC + 2] << 8) | *memory.memoryMap[CPUreg.PC + 1];
+    HEAT_WRITE(addr);
+    HEAT_WRITE(addr + 1);
     LDVal8(CPUreg.SP & 0xFF, memory.memoryMap[addr],addr, 1,0xFFFF);
     LDVal8((CPUreg.SP >> 8) & 0xFF, memory.memoryMap[addr + 1],addr, 1,0xFFFF);
     CPUreg.PC += 3;
@@ -590,6 +667,7 @@ void op_0x08() {
 
 //Blue LD instructions (8 bit register into memory address in 16 bit register) without register increment
 void storeToAddr(uint16_t addr, uint8_t value) {
+    HEAT_WRITE(addr);
     LDVal8(value, memory.memoryMap[addr],addr, 1,0xFFFF);
     if(addr == 0xFF40){
         printf("A: 0x%02X, address: 0x%04X\n", CPUreg.af.A, addr);
@@ -612,6 +690,7 @@ void op_0x12() { storeToAddr(CPUreg.de.DE, CPUreg.af.A); }
 
 //Blue LD instructions (memory address in 16 bit register into 8 bit register) without register increment
 void loadFromAddr(uint16_t addr, uint8_t *dest) {
+    HEAT_READ(addr);
     LDVal8(*memory.memoryMap[addr], dest,0xFFFF, 0,addr);
     CPUreg.PC += 1;
     CPUreg.cyclesAccumulated += 8;
@@ -631,6 +710,7 @@ void op_0x1A() { loadFromAddr(CPUreg.de.DE, &CPUreg.af.A); }
 //Blue LD instructions (8 bit register into HL register with increment or decrement)
 
 void storeAtoHLAndStep(int step) {
+    HEAT_WRITE(CPUreg.hl.HL);
     LDVal8(CPUreg.af.A, memory.memoryMap[CPUreg.hl.HL],CPUreg.hl.HL,1,0xFFFF);
     CPUreg.hl.HL += step;
     CPUreg.PC += 1;
@@ -656,6 +736,7 @@ void op_0x2E() { loadImmToReg(&CPUreg.hl.L); }
 void op_0x3E() { loadImmToReg(&CPUreg.af.A); }
 
 void op_0x36(){
+    HEAT_WRITE(CPUreg.hl.HL);
     LDVal8(*memory.memoryMap[CPUreg.PC + 1], memory.memoryMap[CPUreg.hl.HL],CPUreg.hl.HL,1,CPUreg.PC + 1);
     CPUreg.PC += 2;
     CPUreg.cyclesAccumulated += 12;
@@ -663,6 +744,7 @@ void op_0x36(){
 
 //Blue LD instructions (HL register address increment or decrement into 8 bit register)
 void loadAFromHLAndStep(int step) {
+    HEAT_READ(CPUreg.hl.HL);
     LDVal8(*memory.memoryMap[CPUreg.hl.HL], &CPUreg.af.A,0xFFFF,1,CPUreg.hl.HL);
     CPUreg.hl.HL += step;
     CPUreg.PC += 1;
@@ -680,7 +762,10 @@ void loadRegToReg(uint8_t src, uint8_t *dest) {
     CPUreg.cyclesAccumulated += 4;
 }
 
-void op_0x40() { loadRegToReg(CPUreg.bc.B, &CPUreg.bc.B); }
+void op_0x40() { //LD B,B doubles as the mooneye test ROM breakpoint
+    checkMooneyeBreakpoint();
+    loadRegToReg(CPUreg.bc.B, &CPUreg.bc.B);
+}
 void op_0x41() { loadRegToReg(CPUreg.bc.C, &CPUreg.bc.B); }
 void op_0x42() { loadRegToReg(CPUreg.de.D, &CPUreg.bc.B); }
 void op_0x43() { loadRegToReg(CPUreg.de.E, &CPUreg.bc.B); }
@@ -740,6 +825,7 @@ void op_0x7F() { loadRegToReg(CPUreg.af.A, &CPUreg.af.A); }
 
 void op_0xE0(){ //load A into address 0xFF00 + immediate 12T 2PC
     uint8_t immediate = *memory.memoryMap[CPUreg.PC + 1]; //get immediate value from memory
+    HEAT_WRITE(0xFF00 + immediate);
     LDVal8(CPUreg.af.A, memory.memoryMap[0xFF00 + immediate],0xFF00+immediate,1,0xFFFF); //load value from A into address 0xFF00 + immediate
     CPUreg.PC += 2; 
     CPUreg.cyclesAccumulated += 12;
@@ -753,6 +839,7 @@ void op_0xF0() { // LD A, (FF00 + n)
     uint8_t immediate = *memory.memoryMap[CPUreg.PC + 1];
     uint16_t addr = 0xFF00 + immediate;
 
+    HEAT_READ(addr);
     LDVal8(*memory.memoryMap[addr], &CPUreg.af.A,0xFFFF,1,addr);
 
     CPUreg.PC += 2;
@@ -766,6 +853,7 @@ void op_0xF2() { loadFromAddr(0xFF00 + CPUreg.bc.C, &CPUreg.af.A); }
 
 void op_0xEA(){ // load A into address a16 16T 3PC
     uint16_t address = (*memory.memoryMap[CPUreg.PC + 2] << 8) | *memory.memoryMap[CPUreg.PC + 1];
+    HEAT_WRITE(address);
     LDVal8(CPUreg.af.A, memory.memoryMap[address],address,1,0xFFFF);
     if(address == 0xFF40){
     printf("A: 0x%02X, address: 0x%04X\n", CPUreg.af.A, address);
@@ -776,6 +864,7 @@ void op_0xEA(){ // load A into address a16 16T 3PC
 
 void op_0xFA(){ // load value from address a16 into A 16T 3PC
     uint16_t address = (*memory.memoryMap[CPUreg.PC + 2] << 8 | *memory.memoryMap[CPUreg.PC + 1]); //combine low and high byte to get address
+    HEAT_READ(address);
     LDVal8(*memory.memoryMap[address], &CPUreg.af.A,0xFFFF,1,address);
     CPUreg.PC += 3; 
     CPUreg.cyclesAccumulated += 16;
@@ -855,10 +944,21 @@ void op_0x1C() { inc8(&CPUreg.de.E); }
 void op_0x2C() { inc8(&CPUreg.hl.L); }
 void op_0x3C() { inc8(&CPUreg.af.A); }
 
+//Operand of the ALU, INC/DEC and CB (HL) ops, which work on the map directly instead of through LDVal8.
+//DIV and TIMA are only worked out when read, so they get brought up to date in the map right here
+static uint8_t *hlOperand() {
+    uint16_t addr = CPUreg.hl.HL;
+    if (addr == 0xFF04 || addr == 0xFF05) *memory.memoryMap[addr] = readTimer(addr);
+    return memory.memoryMap[addr];
+}
+
 void op_0x34() {
-    uint8_t value = *memory.memoryMap[CPUreg.hl.HL];
+    HEAT_READ(CPUreg.hl.HL);
+    HEAT_WRITE(CPUreg.hl.HL);
+    uint8_t value = *hlOperand();
     setHalfCarryFlag((value & 0x0F) == 0x0F);
     value++;
+    trackWrite(CPUreg.hl.HL);
     *memory.memoryMap[CPUreg.hl.HL] = value;
     setZeroFlag(value == 0);
     setSubtractFlag(0);
@@ -884,9 +984,12 @@ void op_0x2D() { dec8(&CPUreg.hl.L); }
 void op_0x3D() { dec8(&CPUreg.af.A); }
 
 void op_0x35() {
-    uint8_t value = *memory.memoryMap[CPUreg.hl.HL];
+    HEAT_READ(CPUreg.hl.HL);
+    HEAT_WRITE(CPUreg.hl.HL);
+    uint8_t value = *hlOperand();
     setHalfCarryFlag((value & 0x0F) == 0x00);
     value--;
+    trackWrite(CPUreg.hl.HL);
     *memory.memoryMap[CPUreg.hl.HL] = value;
     setZeroFlag(value == 0);
     setSubtractFlag(1);
@@ -924,7 +1027,7 @@ void op_0x82() { addToA(CPUreg.de.D); CPUreg.PC += 1; CPUreg.cyclesAccumulated +
 void op_0x83() { addToA(CPUreg.de.E); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x84() { addToA(CPUreg.hl.H); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x85() { addToA(CPUreg.hl.L); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
-void op_0x86() { addToA(*memory.memoryMap[CPUreg.hl.HL]); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
+void op_0x86() { HEAT_READ(CPUreg.hl.HL); addToA(*hlOperand()); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
 void op_0x87() { addToA(CPUreg.af.A); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 
 void op_0x88() { adcToA(CPUreg.bc.B); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
@@ -933,7 +1036,7 @@ void op_0x8A() { adcToA(CPUreg.de.D); CPUreg.PC += 1; CPUreg.cyclesAccumulated +
 void op_0x8B() { adcToA(CPUreg.de.E); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x8C() { adcToA(CPUreg.hl.H); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x8D() { adcToA(CPUreg.hl.L); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
-void op_0x8E() { adcToA(*memory.memoryMap[CPUreg.hl.HL]); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
+void op_0x8E() { HEAT_READ(CPUreg.hl.HL); adcToA(*hlOperand()); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
 void op_0x8F() { adcToA(CPUreg.af.A); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 
 void op_0xC6() { addToA(*memory.memoryMap[CPUreg.PC + 1]); CPUreg.PC += 2; CPUreg.cyclesAccumulated += 8; }
@@ -971,7 +1074,7 @@ void op_0x92() { subFromA(CPUreg.de.D); CPUreg.PC += 1; CPUreg.cyclesAccumulated
 void op_0x93() { subFromA(CPUreg.de.E); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x94() { subFromA(CPUreg.hl.H); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x95() { subFromA(CPUreg.hl.L); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
-void op_0x96() { subFromA(*memory.memoryMap[CPUreg.hl.HL]); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
+void op_0x96() { HEAT_READ(CPUreg.hl.HL); subFromA(*hlOperand()); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
 void op_0x97() { subFromA(CPUreg.af.A); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x98() { sbcFromA(CPUreg.bc.B); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x99() { sbcFromA(CPUreg.bc.C); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
@@ -979,7 +1082,7 @@ void op_0x9A() { sbcFromA(CPUreg.de.D); CPUreg.PC += 1; CPUreg.cyclesAccumulated
 void op_0x9B() { sbcFromA(CPUreg.de.E); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x9C() { sbcFromA(CPUreg.hl.H); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0x9D() { sbcFromA(CPUreg.hl.L); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
-void op_0x9E() { sbcFromA(*memory.memoryMap[CPUreg.hl.HL]); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
+void op_0x9E() { HEAT_READ(CPUreg.hl.HL); sbcFromA(*hlOperand()); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 8; }
 void op_0x9F() { sbcFromA(CPUreg.af.A); CPUreg.PC += 1; CPUreg.cyclesAccumulated += 4; }
 void op_0xD6() { subFromA(*memory.memoryMap[CPUreg.PC + 1]); CPUreg.PC += 2; CPUreg.cyclesAccumulated += 8; }
 void op_0xDE() { sbcFromA(*memory.memoryMap[CPUreg.PC + 1]); CPUreg.PC += 2; CPUreg.cyclesAccumulated += 8; }
@@ -1031,7 +1134,8 @@ void op_0xA5(){ //AND L with A 4T 1PC
 }
 
 void op_0xA6(){ //AND value at address HL with A 8T 1PC
-    andWithA(*memory.memoryMap[CPUreg.hl.HL]); // perform AND operation with value at address HL
+    HEAT_READ(CPUreg.hl.HL);
+    andWithA(*hlOperand()); // perform AND operation with value at address HL
     CPUreg.PC += 1; 
     CPUreg.cyclesAccumulated += 8;
 }
@@ -1096,7 +1200,8 @@ void op_0xAD(){ //XOR L with A 4T 1PC
 }
 
 void op_0xAE(){ //XOR value at address HL with A 8T 1PC
-    xorWithA(*memory.memoryMap[CPUreg.hl.HL]); // perform XOR operation with value at address HL
+    HEAT_READ(CPUreg.hl.HL);
+    xorWithA(*hlOperand()); // perform XOR operation with value at address HL
     CPUreg.PC += 1; 
     CPUreg.cyclesAccumulated += 8;
 }
@@ -1160,7 +1265,8 @@ void op_0xB5(){ //OR L with A 4T 1PC
 }
 
 void op_0xB6(){ //OR value at address HL with A 8T 1PC
-    orWithA(*memory.memoryMap[CPUreg.hl.HL]); // perform OR operation with value at address HL
+    HEAT_READ(CPUreg.hl.HL);
+    orWithA(*hlOperand()); // perform OR operation with value at address HL
     CPUreg.PC += 1; 
     CPUreg.cyclesAccumulated += 8;
 }
@@ -1224,7 +1330,8 @@ void op_0xBD(){ //compare L with A 4T 1PC
 }
 
 void op_0xBE(){ //compare value at address HL with A 8T 1PC
-    compareWithA(*memory.memoryMap[CPUreg.hl.HL]); // perform comparison with value at address HL
+    HEAT_READ(CPUreg.hl.HL);
+    compareWithA(*hlOperand()); // perform comparison with value at address HL
     CPUreg.PC += 1; 
     CPUreg.cyclesAccumulated += 8;
 }
@@ -1408,6 +1515,8 @@ void rlc(uint8_t* reg, bool isMemory) {
     uint8_t msb = (value >> 7) & 0x01;
     value = (value << 1) | msb;
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1429,7 +1538,7 @@ void op_0xCB02() { rlc(&CPUreg.de.D, false); }
 void op_0xCB03() { rlc(&CPUreg.de.E, false); }
 void op_0xCB04() { rlc(&CPUreg.hl.H, false); }
 void op_0xCB05() { rlc(&CPUreg.hl.L, false); }
-void op_0xCB06() { rlc(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB06() { rlc(hlOperand(), true); }
 void op_0xCB07() { rlc(&CPUreg.af.A, false); }
 
 
@@ -1440,6 +1549,8 @@ void rrc(uint8_t* reg, bool isMemory) {
     uint8_t lsb = value & 0x01;
     value = (value >> 1) | (lsb << 7);
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1461,7 +1572,7 @@ void op_0xCB0A() { rrc(&CPUreg.de.D, false); }
 void op_0xCB0B() { rrc(&CPUreg.de.E, false); }
 void op_0xCB0C() { rrc(&CPUreg.hl.H, false); }
 void op_0xCB0D() { rrc(&CPUreg.hl.L, false); }
-void op_0xCB0E() { rrc(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB0E() { rrc(hlOperand(), true); }
 void op_0xCB0F() { rrc(&CPUreg.af.A, false); }
 
 // RL 
@@ -1471,6 +1582,8 @@ void rl(uint8_t* reg, bool isMemory) {
     uint8_t msb = (value >> 7) & 0x01;
     value = (value << 1) | getCarryFlag();
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1492,7 +1605,7 @@ void op_0xCB12() { rl(&CPUreg.de.D, false); }
 void op_0xCB13() { rl(&CPUreg.de.E, false); }
 void op_0xCB14() { rl(&CPUreg.hl.H, false); }
 void op_0xCB15() { rl(&CPUreg.hl.L, false); }
-void op_0xCB16() { rl(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB16() { rl(hlOperand(), true); }
 void op_0xCB17() { rl(&CPUreg.af.A, false); }
 // RR
 
@@ -1501,6 +1614,8 @@ void rr(uint8_t* reg, bool isMemory) {
     uint8_t lsb = value & 0x01;
     value = (value >> 1) | (getCarryFlag() << 7);
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1522,7 +1637,7 @@ void op_0xCB1A() { rr(&CPUreg.de.D, false); }
 void op_0xCB1B() { rr(&CPUreg.de.E, false); }
 void op_0xCB1C() { rr(&CPUreg.hl.H, false); }
 void op_0xCB1D() { rr(&CPUreg.hl.L, false); }
-void op_0xCB1E() { rr(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB1E() { rr(hlOperand(), true); }
 void op_0xCB1F() { rr(&CPUreg.af.A, false); }
 
 //SLA 
@@ -1532,6 +1647,8 @@ void sla(uint8_t* reg, bool isMemory) {
     uint8_t msb = (value >> 7) & 0x01;
     value <<= 1;
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1553,7 +1670,7 @@ void op_0xCB22() { sla(&CPUreg.de.D, false); }
 void op_0xCB23() { sla(&CPUreg.de.E, false); }
 void op_0xCB24() { sla(&CPUreg.hl.H, false); }
 void op_0xCB25() { sla(&CPUreg.hl.L, false); }
-void op_0xCB26() { sla(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB26() { sla(hlOperand(), true); }
 void op_0xCB27() { sla(&CPUreg.af.A, false); }
 
 
@@ -1564,6 +1681,8 @@ void sra(uint8_t* reg, bool isMemory) {
     uint8_t lsb = value & 0x01;
     value = (value >> 1) | (value & 0x80);
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1585,7 +1704,7 @@ void op_0xCB2A() { sra(&CPUreg.de.D, false); }
 void op_0xCB2B() { sra(&CPUreg.de.E, false); }
 void op_0xCB2C() { sra(&CPUreg.hl.H, false); }
 void op_0xCB2D() { sra(&CPUreg.hl.L, false); }
-void op_0xCB2E() { sra(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB2E() { sra(hlOperand(), true); }
 void op_0xCB2F() { sra(&CPUreg.af.A, false); }
 
 //SWAP
@@ -1594,6 +1713,8 @@ void swap(uint8_t* reg, bool isMemory) {
     uint8_t value = *reg;
     value = ((value & 0x0F) << 4) | ((value & 0xF0) >> 4);
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1615,7 +1736,7 @@ void op_0xCB32() { swap(&CPUreg.de.D, false); }
 void op_0xCB33() { swap(&CPUreg.de.E, false); }
 void op_0xCB34() { swap(&CPUreg.hl.H, false); }
 void op_0xCB35() { swap(&CPUreg.hl.L, false); }
-void op_0xCB36() { swap(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB36() { swap(hlOperand(), true); }
 void op_0xCB37() { swap(&CPUreg.af.A, false); }
 
 //SRL
@@ -1625,6 +1746,8 @@ void srl(uint8_t* reg, bool isMemory) {
     uint8_t lsb = value & 0x01;
     value >>= 1;
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1646,12 +1769,13 @@ void op_0xCB3A() { srl(&CPUreg.de.D, false); }
 void op_0xCB3B() { srl(&CPUreg.de.E, false); }
 void op_0xCB3C() { srl(&CPUreg.hl.H, false); }
 void op_0xCB3D() { srl(&CPUreg.hl.L, false); }
-void op_0xCB3E() { srl(memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB3E() { srl(hlOperand(), true); }
 void op_0xCB3F() { srl(&CPUreg.af.A, false); }
 
 //BIT
 
 void bitTest(uint8_t bit, uint8_t value, bool isMemory) {
+    if (isMemory) HEAT_READ(CPUreg.hl.HL);
     setZeroFlag(((value >> bit) & 0x01) == 0);
     setHalfCarryFlag(1);
     setSubtractFlag(0);
@@ -1667,7 +1791,7 @@ void op_0xCB42() { bitTest(0, CPUreg.de.D, false); }
 void op_0xCB43() { bitTest(0, CPUreg.de.E, false); }
 void op_0xCB44() { bitTest(0, CPUreg.hl.H, false); }
 void op_0xCB45() { bitTest(0, CPUreg.hl.L, false); }
-void op_0xCB46() { bitTest(0, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB46() { bitTest(0, *hlOperand(), true); }
 void op_0xCB47() { bitTest(0, CPUreg.af.A, false); }
 
 // BIT 1
@@ -1677,7 +1801,7 @@ void op_0xCB4A() { bitTest(1, CPUreg.de.D, false); }
 void op_0xCB4B() { bitTest(1, CPUreg.de.E, false); }
 void op_0xCB4C() { bitTest(1, CPUreg.hl.H, false); }
 void op_0xCB4D() { bitTest(1, CPUreg.hl.L, false); }
-void op_0xCB4E() { bitTest(1, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB4E() { bitTest(1, *hlOperand(), true); }
 void op_0xCB4F() { bitTest(1, CPUreg.af.A, false); }
 
 // BIT 2
@@ -1687,7 +1811,7 @@ void op_0xCB52() { bitTest(2, CPUreg.de.D, false); }
 void op_0xCB53() { bitTest(2, CPUreg.de.E, false); }
 void op_0xCB54() { bitTest(2, CPUreg.hl.H, false); }
 void op_0xCB55() { bitTest(2, CPUreg.hl.L, false); }
-void op_0xCB56() { bitTest(2, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB56() { bitTest(2, *hlOperand(), true); }
 void op_0xCB57() { bitTest(2, CPUreg.af.A, false); }
 
 // BIT 3
@@ -1697,7 +1821,7 @@ void op_0xCB5A() { bitTest(3, CPUreg.de.D, false); }
 void op_0xCB5B() { bitTest(3, CPUreg.de.E, false); }
 void op_0xCB5C() { bitTest(3, CPUreg.hl.H, false); }
 void op_0xCB5D() { bitTest(3, CPUreg.hl.L, false); }
-void op_0xCB5E() { bitTest(3, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB5E() { bitTest(3, *hlOperand(), true); }
 void op_0xCB5F() { bitTest(3, CPUreg.af.A, false); }
 
 // BIT 4
@@ -1707,7 +1831,7 @@ void op_0xCB62() { bitTest(4, CPUreg.de.D, false); }
 void op_0xCB63() { bitTest(4, CPUreg.de.E, false); }
 void op_0xCB64() { bitTest(4, CPUreg.hl.H, false); }
 void op_0xCB65() { bitTest(4, CPUreg.hl.L, false); }
-void op_0xCB66() { bitTest(4, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB66() { bitTest(4, *hlOperand(), true); }
 void op_0xCB67() { bitTest(4, CPUreg.af.A, false); }
 
 // BIT 5
@@ -1717,7 +1841,7 @@ void op_0xCB6A() { bitTest(5, CPUreg.de.D, false); }
 void op_0xCB6B() { bitTest(5, CPUreg.de.E, false); }
 void op_0xCB6C() { bitTest(5, CPUreg.hl.H, false); }
 void op_0xCB6D() { bitTest(5, CPUreg.hl.L, false); }
-void op_0xCB6E() { bitTest(5, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB6E() { bitTest(5, *hlOperand(), true); }
 void op_0xCB6F() { bitTest(5, CPUreg.af.A, false); }
 
 // BIT 6
@@ -1727,7 +1851,7 @@ void op_0xCB72() { bitTest(6, CPUreg.de.D, false); }
 void op_0xCB73() { bitTest(6, CPUreg.de.E, false); }
 void op_0xCB74() { bitTest(6, CPUreg.hl.H, false); }
 void op_0xCB75() { bitTest(6, CPUreg.hl.L, false); }
-void op_0xCB76() { bitTest(6, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB76() { bitTest(6, *hlOperand(), true); }
 void op_0xCB77() { bitTest(6, CPUreg.af.A, false); }
 
 // BIT 7
@@ -1737,7 +1861,7 @@ void op_0xCB7A() { bitTest(7, CPUreg.de.D, false); }
 void op_0xCB7B() { bitTest(7, CPUreg.de.E, false); }
 void op_0xCB7C() { bitTest(7, CPUreg.hl.H, false); }
 void op_0xCB7D() { bitTest(7, CPUreg.hl.L, false); }
-void op_0xCB7E() { bitTest(7, *memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB7E() { bitTest(7, *hlOperand(), true); }
 void op_0xCB7F() { bitTest(7, CPUreg.af.A, false); }
 
 
@@ -1749,6 +1873,8 @@ void resBit(uint8_t bit, uint8_t* reg, bool isMemory) {
     value &= ~(1 << bit); // clear the specified bit
     if (isMemory) {
 
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1765,7 +1891,7 @@ void op_0xCB82() { resBit(0, &CPUreg.de.D, false); }
 void op_0xCB83() { resBit(0, &CPUreg.de.E, false); }
 void op_0xCB84() { resBit(0, &CPUreg.hl.H, false); }
 void op_0xCB85() { resBit(0, &CPUreg.hl.L, false); }
-void op_0xCB86() { resBit(0, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB86() { resBit(0, hlOperand(), true); }
 void op_0xCB87() { resBit(0, &CPUreg.af.A, false); }
 
 // RES 1
@@ -1775,7 +1901,7 @@ void op_0xCB8A() { resBit(1, &CPUreg.de.D, false); }
 void op_0xCB8B() { resBit(1, &CPUreg.de.E, false); }
 void op_0xCB8C() { resBit(1, &CPUreg.hl.H, false); }
 void op_0xCB8D() { resBit(1, &CPUreg.hl.L, false); }
-void op_0xCB8E() { resBit(1, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB8E() { resBit(1, hlOperand(), true); }
 void op_0xCB8F() { resBit(1, &CPUreg.af.A, false); }
 
 // RES 2
@@ -1785,7 +1911,7 @@ void op_0xCB92() { resBit(2, &CPUreg.de.D, false); }
 void op_0xCB93() { resBit(2, &CPUreg.de.E, false); }
 void op_0xCB94() { resBit(2, &CPUreg.hl.H, false); }
 void op_0xCB95() { resBit(2, &CPUreg.hl.L, false); }
-void op_0xCB96() { resBit(2, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB96() { resBit(2, hlOperand(), true); }
 void op_0xCB97() { resBit(2, &CPUreg.af.A, false); }
 
 // RES 3
@@ -1795,7 +1921,7 @@ void op_0xCB9A() { resBit(3, &CPUreg.de.D, false); }
 void op_0xCB9B() { resBit(3, &CPUreg.de.E, false); }
 void op_0xCB9C() { resBit(3, &CPUreg.hl.H, false); }
 void op_0xCB9D() { resBit(3, &CPUreg.hl.L, false); }
-void op_0xCB9E() { resBit(3, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCB9E() { resBit(3, hlOperand(), true); }
 void op_0xCB9F() { resBit(3, &CPUreg.af.A, false); }
 
 // RES 4
@@ -1805,7 +1931,7 @@ void op_0xCBA2() { resBit(4, &CPUreg.de.D, false); }
 void op_0xCBA3() { resBit(4, &CPUreg.de.E, false); }
 void op_0xCBA4() { resBit(4, &CPUreg.hl.H, false); }
 void op_0xCBA5() { resBit(4, &CPUreg.hl.L, false); }
-void op_0xCBA6() { resBit(4, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBA6() { resBit(4, hlOperand(), true); }
 void op_0xCBA7() { resBit(4, &CPUreg.af.A, false); }
 
 // RES 5
@@ -1815,7 +1941,7 @@ void op_0xCBAA() { resBit(5, &CPUreg.de.D, false); }
 void op_0xCBAB() { resBit(5, &CPUreg.de.E, false); }
 void op_0xCBAC() { resBit(5, &CPUreg.hl.H, false); }
 void op_0xCBAD() { resBit(5, &CPUreg.hl.L, false); }
-void op_0xCBAE() { resBit(5, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBAE() { resBit(5, hlOperand(), true); }
 void op_0xCBAF() { resBit(5, &CPUreg.af.A, false); }
 
 // RES 6
@@ -1825,7 +1951,7 @@ void op_0xCBB2() { resBit(6, &CPUreg.de.D, false); }
 void op_0xCBB3() { resBit(6, &CPUreg.de.E, false); }
 void op_0xCBB4() { resBit(6, &CPUreg.hl.H, false); }
 void op_0xCBB5() { resBit(6, &CPUreg.hl.L, false); }
-void op_0xCBB6() { resBit(6, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBB6() { resBit(6, hlOperand(), true); }
 void op_0xCBB7() { resBit(6, &CPUreg.af.A, false); }
 
 // RES 7
@@ -1836,7 +1962,7 @@ void op_0xCBBB() { resBit(7, &CPUreg.de.E, false); }
 void op_0xCBBC() { resBit(7, &CPUreg.hl.H, false); }
 void op_0xCBBD() { resBit(7, &CPUreg.hl.L, false); }
 void op_0xCBBE() { 
-    resBit(7, memory.memoryMap[CPUreg.hl.HL], true);
+    resBit(7, hlOperand(), true);
 }
 void op_0xCBBF() { resBit(7, &CPUreg.af.A, false); }
 
@@ -1846,6 +1972,8 @@ void setBit(uint8_t bit, uint8_t* reg, bool isMemory) {
     uint8_t value = *reg;
     value |= (1 << bit);
     if (isMemory) {
+        HEAT_READ(CPUreg.hl.HL);
+        HEAT_WRITE(CPUreg.hl.HL);
         LDVal8(value, memory.memoryMap[CPUreg.hl.HL], CPUreg.hl.HL, 1, 0xFFFF); // if memory, store value in memory
     }
     else{
@@ -1862,7 +1990,7 @@ void op_0xCBC2() { setBit(0, &CPUreg.de.D, false); }
 void op_0xCBC3() { setBit(0, &CPUreg.de.E, false); }
 void op_0xCBC4() { setBit(0, &CPUreg.hl.H, false); }
 void op_0xCBC5() { setBit(0, &CPUreg.hl.L, false); }
-void op_0xCBC6() { setBit(0, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBC6() { setBit(0, hlOperand(), true); }
 void op_0xCBC7() { setBit(0, &CPUreg.af.A, false); }
 
 // SET 1
@@ -1872,7 +2000,7 @@ void op_0xCBCA() { setBit(1, &CPUreg.de.D, false); }
 void op_0xCBCB() { setBit(1, &CPUreg.de.E, false); }
 void op_0xCBCC() { setBit(1, &CPUreg.hl.H, false); }
 void op_0xCBCD() { setBit(1, &CPUreg.hl.L, false); }
-void op_0xCBCE() { setBit(1, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBCE() { setBit(1, hlOperand(), true); }
 void op_0xCBCF() { setBit(1, &CPUreg.af.A, false); }
 
 // SET 2
@@ -1882,7 +2010,7 @@ void op_0xCBD2() { setBit(2, &CPUreg.de.D, false); }
 void op_0xCBD3() { setBit(2, &CPUreg.de.E, false); }
 void op_0xCBD4() { setBit(2, &CPUreg.hl.H, false); }
 void op_0xCBD5() { setBit(2, &CPUreg.hl.L, false); }
-void op_0xCBD6() { setBit(2, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBD6() { setBit(2, hlOperand(), true); }
 void op_0xCBD7() { setBit(2, &CPUreg.af.A, false); }
 
 // SET 3
@@ -1892,7 +2020,7 @@ void op_0xCBDA() { setBit(3, &CPUreg.de.D, false); }
 void op_0xCBDB() { setBit(3, &CPUreg.de.E, false); }
 void op_0xCBDC() { setBit(3, &CPUreg.hl.H, false); }
 void op_0xCBDD() { setBit(3, &CPUreg.hl.L, false); }
-void op_0xCBDE() { setBit(3, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBDE() { setBit(3, hlOperand(), true); }
 void op_0xCBDF() { setBit(3, &CPUreg.af.A, false); }
 
 // SET 4
@@ -1902,7 +2030,7 @@ void op_0xCBE2() { setBit(4, &CPUreg.de.D, false); }
 void op_0xCBE3() { setBit(4, &CPUreg.de.E, false); }
 void op_0xCBE4() { setBit(4, &CPUreg.hl.H, false); }
 void op_0xCBE5() { setBit(4, &CPUreg.hl.L, false); }
-void op_0xCBE6() { setBit(4, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBE6() { setBit(4, hlOperand(), true); }
 void op_0xCBE7() { setBit(4, &CPUreg.af.A, false); }
 
 // SET 5
@@ -1912,7 +2040,7 @@ void op_0xCBEA() { setBit(5, &CPUreg.de.D, false); }
 void op_0xCBEB() { setBit(5, &CPUreg.de.E, false); }
 void op_0xCBEC() { setBit(5, &CPUreg.hl.H, false); }
 void op_0xCBED() { setBit(5, &CPUreg.hl.L, false); }
-void op_0xCBEE() { setBit(5, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBEE() { setBit(5, hlOperand(), true); }
 void op_0xCBEF() { setBit(5, &CPUreg.af.A, false); }
 
 // SET 6
@@ -1922,7 +2050,7 @@ void op_0xCBF2() { setBit(6, &CPUreg.de.D, false); }
 void op_0xCBF3() { setBit(6, &CPUreg.de.E, false); }
 void op_0xCBF4() { setBit(6, &CPUreg.hl.H, false); }
 void op_0xCBF5() { setBit(6, &CPUreg.hl.L, false); }
-void op_0xCBF6() { setBit(6, memory.memoryMap[CPUreg.hl.HL], true); }
+void op_0xCBF6() { setBit(6, hlOperand(), true); }
 void op_0xCBF7() { setBit(6, &CPUreg.af.A, false); }
 
 // SET 7
@@ -1933,7 +2061,7 @@ void op_0xCBFB() { setBit(7, &CPUreg.de.E, false); }
 void op_0xCBFC() { setBit(7, &CPUreg.hl.H, false); }
 void op_0xCBFD() { setBit(7, &CPUreg.hl.L, false); }
 void op_0xCBFE() { 
-    setBit(7, memory.memoryMap[CPUreg.hl.HL], true);
+    setBit(7, hlOperand(), true);
 
  }
 void op_0xCBFF() { setBit(7, &CPUreg.af.A, false); }
@@ -2199,6 +2327,7 @@ void executeOpcode(uint8_t opcode) {
         case 0xFE: op_0xFE(); break;
         case 0xFF: op_0xFF(); break;
         default: 
+            dumpTraceTail(TRACE_DUMP_RECORDS); //how it got here, when there's a trace running
             printf("Invalid or unimplemented opcode: 0x%02X at PC=0x%04X\n", opcode, CPUreg.PC - 1);
             getchar(); // Exit if an unknown opcode is encountered
             CPUreg.PC += 1; // increment PC to skip unknown opcode
@@ -2465,6 +2594,7 @@ void executeOpcodeCB(uint8_t opcode) {
         case 0xFE: op_0xCBFE(); break;
         case 0xFF: op_0xCBFF(); break;
         default: 
+            dumpTraceTail(TRACE_DUMP_RECORDS);
             printf("Invalid or unimplemented CB opcode: 0x%02X at PC=0x%04X\n", opcode, CPUreg.PC - 1);
             //exit(1); // Exit if an unknown opcode is encountered
             //CPUreg.PC += 1; // increment PC to skip unknown opcode
@@ -2510,7 +2640,9 @@ void handleInterrupts() {
 
             // Push PC to stack (high byte first)
             *memory.memoryMap[--CPUreg.SP] = (CPUreg.PC >> 8) & 0xFF;
+            HEAT_WRITE(CPUreg.SP);
             *memory.memoryMap[--CPUreg.SP] = CPUreg.PC & 0xFF;
+            HEAT_WRITE(CPUreg.SP);
 
             CPUreg.PC = interrupts[i].vector; // Jump to interrupt vector
             CPUreg.cyclesAccumulated += 20; // Interrupt takes 20 cycles
@@ -2530,6 +2662,7 @@ void handleInterrupts() {
 }
 
 void stepCPU(){
+    systemCycles++;
     if(CPUreg.CBFlag != 1){ //make sure interrupt not called before CB instruction finishes execution
         handleInterrupts();
         }
@@ -2542,13 +2675,19 @@ void stepCPU(){
         CPUreg.CPUtimer--;
     }
     if (CPUreg.CPUtimer == 0){
-                //fprintf(logFile, "PC: %04X, Opcode: %02X, Cycles: %d, SP: %04X, A: %02X, B: %02X, C: %02X, D: %02X, E: %02X, F: %02X, H: %02X, L: %02X, LY: %02X, LYC: %02X, FF80: %02X, FF85: %02X, FF00: %02X, FFFF: %02X, FF0F: %02X, FF40: %02X, FF41: %02X, FF44: %02X, FF45: %02X\n", CPUreg.PC, opcode, realCyclesAccumulated, CPUreg.SP, CPUreg.af.A, CPUreg.bc.B, CPUreg.bc.C, CPUreg.de.D, CPUreg.de.E, CPUreg.af.F, CPUreg.hl.H, CPUreg.hl.L, *(ppu.ly), *(ppu.lyc), *memoryMap[0xFF80], *memoryMap[0xFF85], *memoryMap[0xFF00], *memoryMap[0xFFFF], *memoryMap[0xFF0F], *memoryMap[0xFF40], *memoryMap[0xFF41], *memoryMap[0xFF44], *memoryMap[0xFF45]);
                 //fprintf(logFile, "Mode 1 Timer: %d, Mode 0 Timer: %d, Mode 2 Timer: %d, Mode 3 Timer: %d, xPos: %d, scanlineTimer: %d\n", mode1Timer, mode0Timer, mode2Timer, mode3Timer, xPos, scanlineTimer);
                 //halt mode 1 handled in interrupt handler
                 //fprintf(logFile, "Haltmode %d, CPUtimer: %d\n", haltMode, CPUtimer);
 
             if(CPUreg.haltMode != 1){ //execute CPU only if haltMode is not 1 (CPU not halted)
 
+            if (debugger.armed && CPUreg.CBFlag == 0 && debugCheck()) { //breakpoint or end of a step, stop in front of the instruction
+                systemCycles--; //this cycle didn't happen, it runs again on resume
+                return;
+            }
+            if (trace.active && CPUreg.CBFlag == 0) traceInstruction(); //binary record into the ring, the writer thread does the IO
+            if (CPUreg.CBFlag == 0) HEAT_EXEC(CPUreg.PC); //nothing at all without -DHEATMAP
+
             if (CPUreg.haltMode == 2) {
                 // HALT bug: execute same instruction twice
                 //pcBacktrace[backtraceIndex] = CPUreg.PC - 1;
@@ -2561,6 +2700,7 @@ void stepCPU(){
 
                 CPUreg.PC--; //set PC back by one so byte is read twice
                 executeOpcode(opcode);
+                instructionsExecuted++;
 
                 CPUreg.CPUtimer = CPUreg.cyclesAccumulated;
                 CPUreg.haltMode = 0;
@@ -2575,6 +2715,7 @@ void stepCPU(){
                         }
                         //printf("Executing opcode %02X at PC=%04X\n", opcode, CPUreg.PC);
                         executeOpcode(opcode);
+                        instructionsExecuted++; //a CB prefixed one counts once, here
                         CPUreg.CPUtimer = CPUreg.cyclesAccumulated;
                     } else {
                         if (CPUreg.EIFlag == -1){
@@ -2593,4 +2734,38 @@ void stepCPU(){
             }
         }     
 
+}
+
+//Halted with nothing pending, every cycle until some unit's next event would only count up.
+//Jumps to the cycle before the earliest one so that event still lands on its own cycle
+static void skipHalt(){
+    if (*memory.memoryMap[0xFFFF] & *memory.memoryMap[0xFF0F] & 0x1F) return; //wakes up this cycle
+    uint64_t next = apu.nextEventCycle; //frame sequencer ticks every 8192 cycles even powered off, so the jump is never open ended
+    if (ppu.nextEventCycle < next) next = ppu.nextEventCycle;
+    if (serial.nextEventCycle < next) next = serial.nextEventCycle;
+    if (timer.nextEventCycle < next) next = timer.nextEventCycle;
+    if (movie.nextEventCycle < next) next = movie.nextEventCycle;
+    //host boundary of whichever loop is running, one that never moves it (lanes, movie seeks) just leaves it behind
+    if (input.nextPollCycle > systemCycles && input.nextPollCycle < next) next = input.nextPollCycle;
+    if (next <= systemCycles + 1) return;
+
+    uint64_t skip = next - 1 - systemCycles;
+    systemCycles += skip;
+    CPUreg.CPUtimer = (uint64_t)CPUreg.CPUtimer > skip ? CPUreg.CPUtimer - (int)skip : 0;
+    haltSkippedCycles += skip;
+}
+
+//One T-cycle of the whole machine, units that are asleep don't even get called
+void stepSystem(){
+    if (CPUreg.haltMode == 1) skipHalt();
+    stepCPU();
+    if (debugger.stopped) return; //the CPU backed out of this cycle, nothing else runs it either
+    if (systemCycles >= ppu.nextEventCycle) { //PPU sleeps between events
+        hud.unit = HUD_PPU; //for the sampler's CPU/PPU split
+        stepPPU();
+        hud.unit = HUD_CPU;
+    }
+    if (systemCycles >= serial.nextEventCycle) stepSerial(); //transfers and link cable clock sync
+    if (systemCycles >= timer.nextEventCycle) stepTimer(); //only wakes for TIMA reloads, counts are worked out on read
+    if (systemCycles >= apu.nextEventCycle) stepAPU(); //frame sequencer ticks, channels run in batches in between
 }
\ No newline at end of file
@@ -31,8 +31,13 @@ typedef struct {
 } CPUState;
 
 extern CPUState CPUreg;
+extern uint64_t systemCycles; //T-cycles since power on, bumped once per stepCPU
+extern uint64_t instructionsExecuted; //opcodes run since start, not part of the machine state
+extern uint64_t haltSkippedCycles; //T-cycles a halted CPU jumped over instead of stepping, same
 
 void initCPU();
 void stepCPU();
+void stepSystem(); //CPU plus every unit that's due this cycle
+void updateBanks(); //remaps ROM/ERAM from the MBC registers
 
 #endif
\ No newline at end of file
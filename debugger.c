@@ -0,0 +1,272 @@
+#include "debugger.h"
+#include "cpu.h"
+#include "memory.h"
+#include "disasm.h"
+#include "symbols.h"
+
+DebuggerState debugger;
+
+static void updateArmed() {
+    debugger.armed = debugger.breakpointCount > 0 || debugger.mode != DEBUG_RUN;
+}
+
+//Cartridge offset of a ROM address as currently mapped, covers MBC1 putting other banks at 0000 too
+static size_t romOffset(uint16_t addr) {
+    return (size_t)(memory.memoryMap[addr] - memory.cartridge);
+}
+
+static int breakpointAt(uint16_t pc) {
+    if (pc >= 0x8000) return (debugger.ramBits[(pc - 0x8000) >> 3] >> (pc & 7)) & 1;
+    size_t offset = romOffset(pc);
+    uint8_t *bits = debugger.romBits[offset >> 14];
+    return bits && ((bits[(offset & 0x3FFF) >> 3] >> (offset & 7)) & 1);
+}
+
+int debugCheck() {
+    if (debugger.skipOnce) {
+        debugger.skipOnce = 0;
+        return 0;
+    }
+
+    int stop = 0;
+    switch (debugger.mode) {
+        case DEBUG_STEP: stop = --debugger.stepsLeft <= 0; break;
+        case DEBUG_STEP_OVER: stop = CPUreg.PC == debugger.overPC && CPUreg.SP >= debugger.overSP; break;
+        case DEBUG_STEP_OUT: stop = CPUreg.SP > debugger.outSP; break;
+    }
+    if (!stop && debugger.breakpointCount && breakpointAt(CPUreg.PC)) {
+        debugger.hits++;
+        debugger.prompt = 1; //a breakpoint always wants the console
+        stop = 1;
+    }
+    if (!stop) return 0;
+
+    debugger.mode = DEBUG_RUN;
+    debugger.stopped = 1;
+    debugger.skipOnce = 1;
+    updateArmed();
+    return 1;
+}
+
+//A label from the .sym, "bank:addr" or "addr", both hex. A ROM address without a bank means whichever bank is mapped there now
+static int parseLocation(const char *spec, int *bank, uint16_t *addr) {
+    if (findSymbolAddress(spec, bank, addr) == 0) return 0; //labels first, "Add" would read as hex otherwise
+    char *end;
+    unsigned long first = strtoul(spec, &end, 16);
+    if (end == spec) return -1;
+    if (*end == ':') {
+        const char *rest = end + 1;
+        unsigned long second = strtoul(rest, &end, 16);
+        if (end == rest || *end || second > 0xFFFF || first >= DEBUG_ROM_BANKS) return -1;
+        *bank = (int)first;
+        *addr = (uint16_t)second;
+        if (*addr >= 0x4000 && *addr < 0x8000 && *bank == 0) return -1; //bank 0 is never mapped at 4000
+        return 0;
+    }
+    if (*end || first > 0xFFFF) return -1;
+    *addr = (uint16_t)first;
+    *bank = *addr < 0x8000 ? (int)(romOffset(*addr) >> 14) : 0;
+    return 0;
+}
+
+int setBreakpoint(const char *spec, int on) {
+    int bank;
+    uint16_t addr;
+    if (parseLocation(spec, &bank, &addr) != 0) {
+        printf("Bad address %s, use a label or [bank:]addr in hex\n", spec);
+        return -1;
+    }
+
+    uint8_t *byte;
+    int bit;
+    if (addr >= 0x8000) {
+        byte = &debugger.ramBits[(addr - 0x8000) >> 3];
+        bit = addr & 7;
+    } else {
+        if (!debugger.romBits[bank]) {
+            if (!on) return 0;
+            debugger.romBits[bank] = calloc(0x4000 / 8, 1);
+            if (!debugger.romBits[bank]) return -1;
+        }
+        byte = &debugger.romBits[bank][(addr & 0x3FFF) >> 3];
+        bit = addr & 7;
+    }
+
+    int was = (*byte >> bit) & 1;
+    if (on && !was) {
+        *byte |= 1 << bit;
+        debugger.breakpointCount++;
+    } else if (!on && was) {
+        *byte &= ~(1 << bit);
+        debugger.breakpointCount--;
+    }
+    updateArmed();
+    return 0;
+}
+
+static void listBreakpoints() {
+    for (int bank = 0; bank < DEBUG_ROM_BANKS; bank++) {
+        if (!debugger.romBits[bank]) continue;
+        for (int i = 0; i < 0x4000; i++) {
+            if ((debugger.romBits[bank][i >> 3] >> (i & 7)) & 1) {
+                char where[300];
+                formatSymbol(bank, bank == 0 ? i : 0x4000 + i, where, sizeof(where));
+                printf("  %02X:%04X %s\n", bank, bank == 0 ? i : 0x4000 + i, symbols.total ? where : "");
+            }
+        }
+    }
+    for (int i = 0; i < 0x8000; i++) {
+        if ((debugger.ramBits[i >> 3] >> (i & 7)) & 1) printf("  %04X\n", 0x8000 + i);
+    }
+    printf("%d breakpoints, %llu hits\n", debugger.breakpointCount, (unsigned long long)debugger.hits);
+}
+
+void debugStep(long count) {
+    debugger.mode = DEBUG_STEP;
+    debugger.stepsLeft = count > 0 ? count : 1;
+    updateArmed();
+}
+
+void debugStepOver() {
+    uint8_t opcode = *memory.memoryMap[CPUreg.PC];
+    if (!isCallOpcode(opcode)) {
+        debugStep(1);
+        return;
+    }
+    debugger.mode = DEBUG_STEP_OVER;
+    debugger.overPC = CPUreg.PC + opcodeLength(opcode);
+    debugger.overSP = CPUreg.SP;
+    updateArmed();
+}
+
+void debugStepOut() {
+    debugger.mode = DEBUG_STEP_OUT;
+    debugger.outSP = CPUreg.SP; //the RET pops past this
+    updateArmed();
+}
+
+void debugBreak() {
+    debugger.skipOnce = 0; //stop in front of the very next instruction, even the one we may be stopped at
+    debugger.prompt = 1;
+    debugStep(1);
+}
+
+static void printLocation(uint16_t addr) {
+    if (addr < 0x8000) printf("%02X:%04X", (unsigned)(romOffset(addr) >> 14), addr);
+    else printf("   %04X", addr);
+}
+
+static void printDisassembly(uint16_t addr, int count) {
+    char text[DISASM_LINE_MAX];
+    for (int i = 0; i < count; i++) {
+        uint16_t offset;
+        const char *label = findSymbol(symbolBank(addr), addr, &offset);
+        if (label && offset == 0) printf("%s:\n", label);
+        int length = disassemble(addr, text, sizeof(text));
+        printf("%s", addr == CPUreg.PC ? "=> " : "   ");
+        printLocation(addr);
+        printf("  ");
+        for (int b = 0; b < 3; b++) {
+            if (b < length) printf("%02X ", *memory.memoryMap[(uint16_t)(addr + b)]);
+            else printf("   ");
+        }
+        printf(" %s\n", text);
+        addr += length;
+    }
+}
+
+static void printRegisters() {
+    uint8_t F = CPUreg.af.F;
+    printf("AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X PC=%04X  %c%c%c%c IME=%d%s\n",
+        CPUreg.af.AF, CPUreg.bc.BC, CPUreg.de.DE, CPUreg.hl.HL, CPUreg.SP, CPUreg.PC,
+        F & 0x80 ? 'Z' : '-', F & 0x40 ? 'N' : '-', F & 0x20 ? 'H' : '-', F & 0x10 ? 'C' : '-',
+        CPUreg.IME, CPUreg.haltMode == 1 ? " HALT" : "");
+    printf("IE=%02X IF=%02X LCDC=%02X STAT=%02X LY=%02X  ROM bank %02X, cycle %llu, %llu instructions\n",
+        *memory.memoryMap[0xFFFF], *memory.memoryMap[0xFF0F], *memory.memoryMap[0xFF40], *memory.memoryMap[0xFF41],
+        *memory.memoryMap[0xFF44], (unsigned)(romOffset(0x4000) >> 14),
+        (unsigned long long)systemCycles, (unsigned long long)instructionsExecuted);
+}
+
+//Raw bytes as mapped, registers like DIV and TIMA show their last written value
+static void printMemory(uint16_t addr, int length) {
+    for (int line = 0; line < length; line += 16) {
+        printf("%04X ", (uint16_t)(addr + line));
+        for (int i = 0; i < 16 && line + i < length; i++) printf(" %02X", *memory.memoryMap[(uint16_t)(addr + line + i)]);
+        printf("\n");
+    }
+}
+
+static void printHelp() {
+    printf("c            continue\n"
+           "s [n]        step n instructions\n"
+           "n            step over, runs through CALL and RST\n"
+           "f            step out of the current function\n"
+           "b label|[bank:]addr  set a breakpoint, d to delete, bl lists them\n"
+           "r            registers\n"
+           "x addr [len] memory\n"
+           "l [addr] [n] disassemble\n"
+           "g            back to the window, paused\n"
+           "q            quit\n"
+           "Enter repeats the last step\n");
+}
+
+int debugConsole() {
+    if (symbols.total) {
+        char where[300];
+        formatSymbol(symbolBank(CPUreg.PC), CPUreg.PC, where, sizeof(where));
+        printf("Stopped at %s\n", where);
+    }
+    printDisassembly(CPUreg.PC, 1);
+    if (!debugger.prompt) return DEBUG_PAUSE;
+    printRegisters();
+
+    static char last[16] = "s"; //Enter repeats a step command
+    char line[128];
+    while (1) {
+        printf("(debug) ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin)) { //stdin gone, nothing left to take commands from
+            debugger.prompt = 0;
+            return DEBUG_PAUSE;
+        }
+        char cmd[16] = "", arg1[32] = "", arg2[32] = "";
+        if (sscanf(line, "%15s %31s %31s", cmd, arg1, arg2) < 1) strcpy(cmd, last);
+
+        if (strcmp(cmd, "c") == 0) {
+            debugger.prompt = 0; //only breakpoints bring the console back
+            return DEBUG_CONTINUE;
+        } else if (strcmp(cmd, "s") == 0) {
+            debugStep(arg1[0] ? strtol(arg1, NULL, 10) : 1);
+            strcpy(last, cmd);
+            return DEBUG_CONTINUE;
+        } else if (strcmp(cmd, "n") == 0) {
+            debugStepOver();
+            strcpy(last, cmd);
+            return DEBUG_CONTINUE;
+        } else if (strcmp(cmd, "f") == 0) {
+            debugStepOut();
+            strcpy(last, cmd);
+            return DEBUG_CONTINUE;
+        } else if ((strcmp(cmd, "b") == 0 || strcmp(cmd, "d") == 0) && arg1[0]) {
+            setBreakpoint(arg1, cmd[0] == 'b');
+        } else if (strcmp(cmd, "bl") == 0) {
+            listBreakpoints();
+        } else if (strcmp(cmd, "r") == 0) {
+            printRegisters();
+        } else if (strcmp(cmd, "x") == 0 && arg1[0]) {
+            int length = arg2[0] ? (int)strtol(arg2, NULL, 16) : 64;
+            printMemory((uint16_t)strtoul(arg1, NULL, 16), length > 0 && length <= 0x10000 ? length : 64);
+        } else if (strcmp(cmd, "l") == 0) {
+            uint16_t addr = arg1[0] ? (uint16_t)strtoul(arg1, NULL, 16) : CPUreg.PC;
+            int count = arg2[0] ? (int)strtol(arg2, NULL, 10) : 10;
+            printDisassembly(addr, count > 0 && count <= 1000 ? count : 10);
+        } else if (strcmp(cmd, "g") == 0) {
+            debugger.prompt = 0;
+            return DEBUG_PAUSE;
+        } else if (strcmp(cmd, "q") == 0) {
+            return DEBUG_QUIT;
+        } else {
+            printHelp();
+        }
+    }
+}
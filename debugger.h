@@ -0,0 +1,42 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+#define DEBUG_ROM_BANKS 512 //8MB of cartridge, the most memory.cartridge holds
+
+enum { DEBUG_RUN, DEBUG_STEP, DEBUG_STEP_OVER, DEBUG_STEP_OUT }; //what the CPU is running until
+enum { DEBUG_CONTINUE, DEBUG_PAUSE, DEBUG_QUIT }; //what debugConsole wants the main loop to do
+
+//PC breakpoints, one bit per address. ROM ones are per bank so a breakpoint in bank 3 doesn't fire
+//when bank 5 is mapped there, everything from 8000 up shares one map.
+typedef struct {
+    int armed; //stepCPU looks at nothing else unless this is set, so no breakpoints costs one load per instruction
+    int stopped; //stepCPU backed out of the cycle, the main loop takes it from here
+    int mode;
+    int prompt; //stops go to the console instead of just printing where we are
+    int skipOnce; //the instruction we stopped in front of runs on resume
+    long stepsLeft;
+    uint16_t overPC, overSP; //step over runs until PC comes back with the stack where it was
+    uint16_t outSP; //step out runs until the stack unwinds past this
+
+    int breakpointCount;
+    uint8_t *romBits[DEBUG_ROM_BANKS]; //allocated on the first breakpoint in a bank
+    uint8_t ramBits[0x8000 / 8];
+    uint64_t hits;
+} DebuggerState;
+
+extern DebuggerState debugger;
+
+int debugCheck(); //stepCPU, before each instruction while armed. 1 = stop in front of it
+int setBreakpoint(const char *spec, int on); //"bank:addr" or "addr" in hex, 0 on success
+void debugStep(long count);
+void debugStepOver();
+void debugStepOut();
+void debugBreak(); //stop in front of the next instruction and open the console
+int debugConsole(); //prints where the CPU stopped, reads commands from stdin when prompting
+
+#endif
@@ -0,0 +1,271 @@
+#include "disasm.h"
+#include "memory.h"
+#include "symbols.h"
+
+//Operands: %b d8, %w d16/a16, %r relative jump target, %h FF00+a8, %s signed e8
+static const char *mnemonics[256] = {
+    "NOP", "LD BC,%w", "LD (BC),A", "INC BC", "INC B", "DEC B", "LD B,%b", "RLCA",
+    "LD (%w),SP", "ADD HL,BC", "LD A,(BC)", "DEC BC", "INC C", "DEC C", "LD C,%b", "RRCA",
+    "STOP", "LD DE,%w", "LD (DE),A", "INC DE", "INC D", "DEC D", "LD D,%b", "RLA",
+    "JR %r", "ADD HL,DE", "LD A,(DE)", "DEC DE", "INC E", "DEC E", "LD E,%b", "RRA",
+    "JR NZ,%r", "LD HL,%w", "LD (HL+),A", "INC HL", "INC H", "DEC H", "LD H,%b", "DAA",
+    "JR Z,%r", "ADD HL,HL", "LD A,(HL+)", "DEC HL", "INC L", "DEC L", "LD L,%b", "CPL",
+    "JR NC,%r", "LD SP,%w", "LD (HL-),A", "INC SP", "INC (HL)", "DEC (HL)", "LD (HL),%b", "SCF",
+    "JR C,%r", "ADD HL,SP", "LD A,(HL-)", "DEC SP", "INC A", "DEC A", "LD A,%b", "CCF",
+    [0x76] = "HALT",
+    [0xC0] = "RET NZ", "POP BC", "JP NZ,%w", "JP %w", "CALL NZ,%w", "PUSH BC", "ADD A,%b", "RST $00",
+    "RET Z", "RET", "JP Z,%w", NULL, "CALL Z,%w", "CALL %w", "ADC A,%b", "RST $08",
+    "RET NC", "POP DE", "JP NC,%w", NULL, "CALL NC,%w", "PUSH DE", "SUB %b", "RST $10",
+    "RET C", "RETI", "JP C,%w", NULL, "CALL C,%w", NULL, "SBC A,%b", "RST $18",
+    "LDH (%h),A", "POP HL", "LD ($FF00+C),A", NULL, NULL, "PUSH HL", "AND %b", "RST $20",
+    "ADD SP,%s", "JP HL", "LD (%w),A", NULL, NULL, NULL, "XOR %b", "RST $28",
+    "LDH A,(%h)", "POP AF", "LD A,($FF00+C)", "DI", NULL, "PUSH AF", "OR %b", "RST $30",
+    "LD HL,SP%s", "LD SP,HL", "LD A,(%w)", "EI", NULL, NULL, "CP %b", "RST $38",
+};
+
+static const char *aluOps[8] = { "ADD A,", "ADC A,", "SUB ", "SBC A,", "AND ", "XOR ", "OR ", "CP " };
+static const char *cbOps[8] = { "RLC", "RRC", "RL", "RR", "SLA", "SRA", "SWAP", "SRL" };
+static const char *cbBitOps[4] = { NULL, "BIT", "RES", "SET" };
+static const char *regNames[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+
+#define DISASM_CHUNK 4096
+
+static OpcodeInfo opcodes[512];
+static uint8_t lengths[256]; //by first byte alone, CB prefixed are all 2
+//Up to OPERAND_HIGH: "$" and its digits, then how lo and hi make the value, d8 shows as the top 2 of 4 digits
+static const uint8_t operandWidth[] = { 0, 3, 5, 5, 5 };
+static const uint8_t operandShift[] = { 0, 8, 0, 0, 0 };
+static const uint8_t operandHigh[] = { 0, 0, 0, 0, 0xFF };
+static char hexPairs[256][2];
+static char byteColumns[2][256][2]; //[0] is all blanks, indexed by whether the byte is part of the instruction
+static int built = 0;
+
+static void setText(OpcodeInfo *info, const char *text) {
+    const char *arg = strchr(text, '%');
+    info->length = 1;
+    info->operand = OPERAND_NONE;
+    memset(info->prefix, ' ', sizeof(info->prefix));
+    memset(info->suffix, ' ', sizeof(info->suffix));
+    size_t split = arg ? (size_t)(arg - text) : strlen(text);
+    memcpy(info->prefix, text, split);
+    info->prefixLength = (uint8_t)split;
+    info->suffixLength = 0;
+    if (!arg) return;
+
+    switch (arg[1]) {
+        case 'b': info->operand = OPERAND_D8; break;
+        case 'w': info->operand = OPERAND_D16; break;
+        case 'r': info->operand = OPERAND_REL; break;
+        case 'h': info->operand = OPERAND_HIGH; break;
+        default: info->operand = OPERAND_SIGNED; break;
+    }
+    info->length = info->operand == OPERAND_D16 ? 3 : 2;
+    info->suffixLength = (uint8_t)strlen(arg + 2);
+    memcpy(info->suffix, arg + 2, info->suffixLength);
+}
+
+//Fills the table once from the mnemonic list, the regular blocks get generated
+static void buildOpcodes() {
+    static const char hex[] = "0123456789ABCDEF";
+    for (int i = 0; i < 256; i++) {
+        hexPairs[i][0] = hex[i >> 4];
+        hexPairs[i][1] = hex[i & 15];
+        memcpy(byteColumns[0][i], "  ", 2);
+        memcpy(byteColumns[1][i], hexPairs[i], 2);
+    }
+
+    char text[16];
+    for (int op = 0; op < 256; op++) {
+        OpcodeInfo *info = &opcodes[op];
+        if (op >= 0x40 && op < 0x80 && op != 0x76) {
+            snprintf(text, sizeof(text), "LD %s,%s", regNames[(op >> 3) & 7], regNames[op & 7]);
+            setText(info, text);
+        } else if (op >= 0x80 && op < 0xC0) {
+            snprintf(text, sizeof(text), "%s%s", aluOps[(op >> 3) & 7], regNames[op & 7]);
+            setText(info, text);
+        } else if (op == 0xCB) {
+            setText(info, "PREFIX CB");
+            info->length = 2;
+        } else if (mnemonics[op]) {
+            const char *m = mnemonics[op]; //control flow only comes from this table, the generated blocks have none
+            setText(info, m);
+            if (strncmp(m, "CALL", 4) == 0 || strncmp(m, "RST", 3) == 0) info->flags |= OPCODE_CALL;
+            if (strncmp(m, "JP", 2) == 0 || strncmp(m, "JR", 2) == 0) info->flags |= OPCODE_JUMP;
+            if (strncmp(m, "RET", 3) == 0) info->flags |= OPCODE_RETURN;
+            int cc = op & 0xE7; //JR cc, RET cc, JP cc and CALL cc with the condition bits masked off
+            if (cc == 0x20 || cc == 0xC0 || cc == 0xC2 || cc == 0xC4) info->flags |= OPCODE_CONDITIONAL;
+            if (info->operand == OPERAND_HIGH || info->operand == OPERAND_REL
+                || (info->operand == OPERAND_D16 && ((info->flags & (OPCODE_CALL | OPCODE_JUMP)) || strchr(m, '(')))) {
+                info->flags |= OPCODE_ADDRESS;
+            }
+        } else {
+            snprintf(text, sizeof(text), "DB $%02X", op);
+            setText(info, text);
+            info->flags = OPCODE_INVALID;
+        }
+    }
+
+    for (int op = 0; op < 256; op++) {
+        int kind = op >> 6;
+        if (kind == 0) snprintf(text, sizeof(text), "%s %s", cbOps[(op >> 3) & 7], regNames[op & 7]);
+        else snprintf(text, sizeof(text), "%s %d,%s", cbBitOps[kind], (op >> 3) & 7, regNames[op & 7]);
+        setText(&opcodes[256 + op], text);
+        opcodes[256 + op].length = 2;
+    }
+
+    for (int i = 0; i < 512; i++) { //operand bytes stay blank here, disassembleRange fills them in
+        OpcodeInfo *info = &opcodes[i];
+        memset(info->row, ' ', sizeof(info->row));
+        memcpy(info->row + 1, hexPairs[i < 256 ? i : 0xCB], 2);
+        memcpy(info->row + 11, info->prefix, info->prefixLength);
+        info->rowLength = 11 + info->prefixLength;
+        if (info->operand == OPERAND_NONE) info->row[info->rowLength++] = '\n';
+        if (i < 256) lengths[i] = info->length;
+    }
+    built = 1;
+}
+
+const OpcodeInfo *opcodeInfo(uint8_t opcode, uint8_t next) {
+    if (!built) buildOpcodes();
+    return opcode == 0xCB ? &opcodes[256 + next] : &opcodes[opcode];
+}
+
+int opcodeLength(uint8_t opcode) {
+    return opcodeInfo(opcode, 0)->length;
+}
+
+int isCallOpcode(uint8_t opcode) {
+    return (opcodeInfo(opcode, 0)->flags & OPCODE_CALL) != 0;
+}
+
+//Operand as text, a label instead of a number when one covers the address
+static char *putOperand(char *out, const OpcodeInfo *info, uint16_t addr, uint8_t lo, uint8_t hi, int bank) {
+    uint16_t value;
+    switch (info->operand) {
+        case OPERAND_D8:
+            *out++ = '$';
+            memcpy(out, hexPairs[lo], 2);
+            return out + 2;
+        case OPERAND_SIGNED: {
+            int v = (int8_t)lo;
+            *out++ = v < 0 ? '-' : '+';
+            if (v < 0) v = -v;
+            if (v >= 100) *out++ = '1';
+            if (v >= 10) *out++ = '0' + (v / 10) % 10;
+            *out++ = '0' + v % 10;
+            return out;
+        }
+        case OPERAND_REL: value = (uint16_t)(addr + 2 + (int8_t)lo); break;
+        case OPERAND_HIGH: value = 0xFF00 | lo; break;
+        default: value = lo | (hi << 8); break;
+    }
+
+    if (symbols.total && (info->flags & OPCODE_ADDRESS)) {
+        int targetBank = value < 0x4000 ? 0 : value < 0x8000 ? bank : symbolBank(value);
+        uint16_t offset;
+        const char *name = findSymbol(targetBank, value, &offset);
+        if (name && (offset == 0 || (value >= 0x8000 && offset < 0x100))) { //wData+5 reads fine, Main+1F3 as a jump target doesn't
+            size_t n = strlen(name);
+            memcpy(out, name, n);
+            out += n;
+            if (offset) out += sprintf(out, "+%X", offset);
+            return out;
+        }
+    }
+    *out++ = '$';
+    memcpy(out, hexPairs[value >> 8], 2);
+    memcpy(out + 2, hexPairs[value & 0xFF], 2);
+    return out + 4;
+}
+
+//Writes up to 16 bytes past what it returns, callers leave room
+static char *putInstruction(char *out, const OpcodeInfo *info, uint16_t addr, uint8_t lo, uint8_t hi, int bank) {
+    memcpy(out, info->prefix, 16);
+    out += info->prefixLength;
+    if (info->operand == OPERAND_NONE) return out;
+    out = putOperand(out, info, addr, lo, hi, bank);
+    memcpy(out, info->suffix, 16);
+    return out + info->suffixLength;
+}
+
+int disassembleBytes(const uint8_t *bytes, uint16_t addr, int bank, char *out, size_t size) {
+    const OpcodeInfo *info = opcodeInfo(bytes[0], bytes[1]);
+    char line[DISASM_LINE_MAX];
+    char *end = putInstruction(line, info, addr, bytes[1], bytes[2], bank);
+    snprintf(out, size, "%.*s", (int)(end - line), line);
+    return info->length;
+}
+
+int disassemble(uint16_t addr, char *out, size_t size) {
+    uint8_t bytes[3];
+    for (int i = 0; i < 3; i++) bytes[i] = *memory.memoryMap[(uint16_t)(addr + i)];
+    return disassembleBytes(bytes, addr, symbolBank(0x4000), out, size); //targets in 4000-7FFF are in whatever bank is mapped
+}
+
+size_t disassembleRange(const uint8_t *bytes, size_t length, uint16_t base, int bank, char *out) {
+    if (!built) buildOpcodes();
+    char *start = out;
+    int labelled = symbols.total != 0;
+    const SymbolEntry *labels = bank >= 0 && bank < SYMBOL_BANKS ? symbols.banks[bank] : NULL;
+    int labelCount = labels ? symbols.counts[bank] : 0, nextLabel = 0;
+
+    //Where each instruction starts only depends on the one before's length, so that walk is the part that
+    //can't overlap. Looking the lengths up for a whole chunk first leaves it one load per instruction.
+    //The chunk's bytes get copied with 2 more after, zeros past the end, so operands need no bounds checks
+    uint8_t steps[DISASM_CHUNK];
+    uint8_t data[DISASM_CHUNK + 2];
+    size_t i = 0, chunk = 0;
+    while (i < length) {
+        if (i >= chunk + DISASM_CHUNK || i == 0) {
+            chunk = i;
+            size_t end = length - chunk < DISASM_CHUNK + 2 ? length - chunk : DISASM_CHUNK + 2;
+            memcpy(data, bytes + chunk, end);
+            memset(data + end, 0, sizeof(data) - end); //an instruction hanging off the end reads zeros
+            for (size_t j = 0; j < DISASM_CHUNK; j++) steps[j] = lengths[data[j]];
+        }
+        uint16_t addr = (uint16_t)(base + i);
+        while (nextLabel < labelCount && labels[nextLabel].addr < addr) nextLabel++;
+        if (nextLabel < labelCount && labels[nextLabel].addr == addr) { //labels sort first within an address, only the first is shown
+            const char *name = symbols.names + labels[nextLabel].name;
+            size_t n = strlen(name);
+            memcpy(out, name, n);
+            out[n] = ':';
+            out[n + 1] = '\n';
+            out += n + 2;
+            nextLabel++;
+        }
+
+        uint8_t opcode = data[i - chunk];
+        uint8_t lo = data[i - chunk + 1];
+        uint8_t hi = data[i - chunk + 2];
+        const OpcodeInfo *info = opcode == 0xCB ? &opcodes[256 + lo] : &opcodes[opcode];
+
+        memcpy(out, hexPairs[addr >> 8], 2);
+        memcpy(out + 2, hexPairs[addr & 0xFF], 2);
+        memcpy(out + 4, info->row, sizeof(info->row)); //opcode, blanks and mnemonic in one copy
+        memcpy(out + 8, byteColumns[info->length > 1][lo], 2); //lookups, not branches, opcodes come in any order
+        memcpy(out + 11, byteColumns[info->length > 2][hi], 2);
+        out += 4 + info->rowLength;
+        if (info->operand == OPERAND_NONE) { //padding is long runs of these, so this one stays predictable
+            i += steps[i - chunk];
+            continue;
+        }
+        if (info->operand == OPERAND_SIGNED || (labelled && (info->flags & OPCODE_ADDRESS))) {
+            out = putOperand(out, info, addr, lo, hi, bank); //rare, or there are names to look up
+        } else { //every other operand is "$" and 4 digits cut down to its width
+            int kind = info->operand; //tables and a mask, a switch or a chain of ?: comes out as branches
+            uint16_t value = (uint16_t)((lo | (hi | operandHigh[kind]) << 8) << operandShift[kind]);
+            uint16_t relative = (uint16_t)-(kind == OPERAND_REL);
+            value = (value & ~relative) | ((uint16_t)(addr + 2 + (int8_t)lo) & relative);
+            out[0] = '$';
+            memcpy(out + 1, hexPairs[value >> 8], 2);
+            memcpy(out + 3, hexPairs[value & 0xFF], 2);
+            out += operandWidth[info->operand];
+        }
+        memcpy(out, info->suffix, 16);
+        out += info->suffixLength;
+        *out++ = '\n';
+        i += steps[i - chunk];
+    }
+    return (size_t)(out - start);
+}
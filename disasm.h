@@ -0,0 +1,41 @@
+#ifndef DISASM_H
+#define DISASM_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+enum { OPERAND_NONE, OPERAND_D8, OPERAND_D16, OPERAND_REL, OPERAND_HIGH, OPERAND_SIGNED };
+
+#define OPCODE_CALL 0x01 //CALL and RST, what step over runs through
+#define OPCODE_JUMP 0x02
+#define OPCODE_RETURN 0x04
+#define OPCODE_CONDITIONAL 0x08
+#define OPCODE_ADDRESS 0x10 //operand is an address, gets a label when there are symbols
+#define OPCODE_INVALID 0x20 //locks up real hardware
+
+#define DISASM_LINE_MAX 600 //most disassembleRange writes for one instruction, a long label line and operand included
+
+//One opcode, 0-255 plain and 256-511 CB prefixed. The mnemonic is split around the operand and
+//both halves padded to 16 bytes, so output is fixed size copies and some hex, no format strings
+typedef struct {
+    char prefix[16]; //mnemonic up to the operand
+    char suffix[16]; //after it, ")" or ",A" and the like
+    uint8_t prefixLength;
+    uint8_t suffixLength;
+    uint8_t length; //bytes including the operand, CB prefixed ones are all 2
+    uint8_t operand;
+    uint8_t flags;
+    uint8_t rowLength;
+    char row[32]; //what a range dump puts after the address: " OP      " byte columns, then the prefix, and the newline when there's no operand
+} OpcodeInfo;
+
+const OpcodeInfo *opcodeInfo(uint8_t opcode, uint8_t next); //next is only looked at after a CB
+int opcodeLength(uint8_t opcode);
+int isCallOpcode(uint8_t opcode);
+int disassemble(uint16_t addr, char *out, size_t size); //reads through the memory map, returns the length
+int disassembleBytes(const uint8_t *bytes, uint16_t addr, int bank, char *out, size_t size); //3 bytes from anywhere, bank places jump targets
+size_t disassembleRange(const uint8_t *bytes, size_t length, uint16_t base, int bank, char *out); //out holds DISASM_LINE_MAX per byte
+
+#endif
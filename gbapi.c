@@ -0,0 +1,95 @@
+#include "gbapi.h"
+#include "cpu.h"
+#include "memory.h"
+#include "input.h"
+#include "ppu.h"
+#include "present.h"
+#include "timer.h"
+#include "serial.h"
+#include "testrom.h"
+#include "movie.h"
+#include "savestate.h"
+#include "apu.h"
+#include "rtc.h"
+
+static GBObservation obs;
+static int framesLeft; //VBlanks the current buttons are still held for
+static SaveState *powerOnState;
+
+static void updateObservation(int frameDone) {
+    obs.framebuffer = getFramebuffer(&obs.frame);
+    obs.wram = memory.wram;
+    obs.hram = memory.hram;
+    obs.io = memory.io;
+    obs.cycles = systemCycles;
+    obs.lagFrame = !input.polled;
+    obs.frameDone = frameDone;
+}
+
+int gbInit(const char *romPath) {
+    systemCycles = 0; //init functions schedule from it, a second gbInit has to start the clock over too
+    initMemory();
+    loadROM(romPath);
+    updateERAMMapping();
+    initRTC(); //no .sav, the clock starts at 0 every time so runs repeat exactly
+    initCPU();
+    initInput();
+    initTimer();
+    initSerial();
+    initAPU();
+    initTestDetection();
+    initPPU();
+    initPresent();
+    initMovie();
+
+    if (!powerOnState) powerOnState = malloc(sizeof(SaveState));
+    if (!powerOnState) return -1;
+    captureState(powerOnState);
+    framesLeft = 0;
+    updateObservation(1);
+    return 0;
+}
+
+void gbReset() {
+    restoreState(powerOnState);
+    framesLeft = 0;
+    updateObservation(1);
+}
+
+//Straight to the joypad, no SDL events or input queue in between
+void gbSetButtons(uint8_t buttons, int frames) {
+    setButtonState(~buttons);
+    framesLeft = frames;
+}
+
+const GBObservation *gbRunToVBlank() {
+    uint32_t seq = ppu.frameSeq;
+    uint64_t limit = systemCycles + GB_FRAME_CYCLES + 456; //LCD off never reaches VBlank, end on time instead
+    input.polled = 0;
+    input.nextPollCycle = limit; //no host events here, but a halted CPU mustn't jump past the end of the call
+
+    while (ppu.frameSeq == seq && systemCycles < limit) {
+        stepSystem();
+        if (systemCycles >= movie.nextEventCycle) stepMovie(); //agents can record their episodes too
+    }
+
+    updateObservation(ppu.frameSeq != seq);
+    if (framesLeft > 0 && --framesLeft == 0) setButtonState(0xFF); //let go
+    return &obs;
+}
+
+const GBObservation *gbStep(uint8_t buttons, int frames) {
+    if (frames < 1) frames = 1;
+    gbSetButtons(buttons, frames);
+    for (int i = 0; i < frames; i++) gbRunToVBlank();
+    return &obs;
+}
+
+uint8_t gbReadIO(uint16_t addr) {
+    switch (addr) {
+        case 0xFF00: return readJoypad(*memory.memoryMap[0xFF00]);
+        case 0xFF04:
+        case 0xFF05: return readTimer(addr);
+        default: return *memory.memoryMap[addr];
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef GBAPI_H
+#define GBAPI_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+//Driving the emulator from code instead of SDL, for bots and training agents.
+//One emulator per process, everything here runs on the calling thread and nothing opens a window.
+//A step is whole frames of emulation, so expect hundreds of steps/s per core, not thousands. Skipping HALT
+//barely helps with the LCD on since the PPU still draws mode 3 one dot at a time.
+
+//Button bits for gbSetButtons/gbStep, 1 = held
+#define GB_BUTTON_RIGHT  0x01
+#define GB_BUTTON_LEFT   0x02
+#define GB_BUTTON_UP     0x04
+#define GB_BUTTON_DOWN   0x08
+#define GB_BUTTON_A      0x10
+#define GB_BUTTON_B      0x20
+#define GB_BUTTON_SELECT 0x40
+#define GB_BUTTON_START  0x80
+
+#define GB_FRAME_CYCLES 70224
+
+//Views straight into emulator memory, no copies. Pointers stay valid until the next step call.
+typedef struct {
+    const uint8_t *framebuffer; //160x144 colour indices 0-3, row major, the last completed frame
+    const uint8_t *wram; //C000-DFFF, 0x2000 bytes
+    const uint8_t *hram; //FF80-FFFE, 0x7F bytes
+    const uint8_t *io; //FF00-FF7F as stored, DIV/TIMA/joypad are only current through gbReadIO
+    uint32_t frame; //frames completed since power on
+    uint64_t cycles; //T-cycles since power on
+    int lagFrame; //game never read the joypad during the last frame
+    int frameDone; //0 = LCD was off and the frame ended on the time limit instead of at VBlank
+} GBObservation;
+
+int gbInit(const char *romPath); //loads the ROM and powers on, 0 on success
+void gbReset(); //back to the power on state, much cheaper than gbInit
+void gbSetButtons(uint8_t buttons, int frames); //held for the next `frames` VBlanks, then released
+const GBObservation *gbRunToVBlank(); //runs to the start of the next VBlank
+const GBObservation *gbStep(uint8_t buttons, int frames); //set buttons, run `frames` VBlanks, one call per agent step
+uint8_t gbReadIO(uint16_t addr); //FF00-FF7F the way the CPU would read it right now
+
+#endif
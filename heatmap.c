@@ -0,0 +1,195 @@
+#include "heatmap.h"
+#include <math.h>
+
+HeatmapState heat;
+
+//Only ever touched by the render thread
+static SDL_Renderer *heatRenderer = NULL;
+static SDL_Texture *heatTexture = NULL;
+
+static uint32_t heatRows() {
+    return (heat.pages + HEAT_ROW - 1) / HEAT_ROW;
+}
+
+int startHeatmap(const char *dumpPath, const char *range, SDL_Window *window) {
+#ifndef HEATMAP
+    (void)dumpPath; (void)range; (void)window;
+    printf("Built without heatmaps, rebuild with -DHEATMAP to count memory accesses\n");
+    return -1;
+#else
+    memset(&heat, 0, sizeof(heat));
+    uint32_t banks = (uint32_t)(memory.romSize / 0x4000);
+    if (banks < 2) banks = 2;
+    heat.romPages = banks * HEAT_ROM_PAGES;
+    heat.vramBase = heat.romPages;
+    heat.wramBase = heat.vramBase + HEAT_RAM_PAGES;
+    heat.eramBase = heat.wramBase + HEAT_RAM_PAGES;
+    heat.eramPages = memory.totalRamBanks * HEAT_RAM_PAGES;
+    if (heat.eramPages > sizeof(memory.eram) >> HEAT_PAGE_SHIFT) heat.eramPages = sizeof(memory.eram) >> HEAT_PAGE_SHIFT;
+    heat.highBase = heat.eramBase + heat.eramPages;
+    heat.pages = heat.highBase + HEAT_HIGH_PAGES;
+    heat.frame = calloc(heat.pages + 1, sizeof(heat.frame[0])); //+1 for the unmapped sink
+    if (!heat.frame) return -1;
+
+    heat.lastFrame = UINT64_MAX;
+    if (range) {
+        char *end;
+        heat.firstFrame = strtoull(range, &end, 10);
+        heat.lastFrame = *end == '-' ? strtoull(end + 1, NULL, 10) : heat.firstFrame;
+    }
+    if (dumpPath) {
+        heat.dump = fopen(dumpPath, "w");
+        if (!heat.dump) {
+            perror("Failed to open heatmap dump");
+            return -1;
+        }
+        fprintf(heat.dump, "frame,region,bank,address,reads,writes,executes\n");
+    }
+
+    if (window) {
+        heat.recent = calloc(heat.pages, sizeof(heat.recent[0]));
+        heat.shown = calloc(heat.pages, sizeof(heat.shown[0]));
+        if (!heat.recent || !heat.shown) return -1;
+        SDL_SetWindowSize(window, HEAT_ROW * HEAT_SCALE, heatRows() * HEAT_SCALE < HEAT_WINDOW_MAX ? heatRows() * HEAT_SCALE : HEAT_WINDOW_MAX);
+        heat.window = window;
+    }
+    heat.on = 1;
+    return 0;
+#endif
+}
+
+//Where a flat page number lives, for the dump
+static const char *describePage(uint32_t page, int *bank, uint16_t *addr) {
+    if (page < heat.romPages) {
+        *bank = page / HEAT_ROM_PAGES;
+        *addr = (uint16_t)((*bank ? 0x4000 : 0) + (page % HEAT_ROM_PAGES) * 0x100);
+        return "rom";
+    }
+    if (page < heat.wramBase) {
+        *bank = 0;
+        *addr = (uint16_t)(0x8000 + (page - heat.vramBase) * 0x100);
+        return "vram";
+    }
+    if (page < heat.eramBase) {
+        *bank = 0;
+        *addr = (uint16_t)(0xC000 + (page - heat.wramBase) * 0x100);
+        return "wram";
+    }
+    if (page < heat.highBase) {
+        *bank = (page - heat.eramBase) / HEAT_RAM_PAGES;
+        *addr = (uint16_t)(0xA000 + (page - heat.eramBase) % HEAT_RAM_PAGES * 0x100);
+        return "eram";
+    }
+    *bank = 0;
+    *addr = (uint16_t)(0xFE00 + (page - heat.highBase) * 0x100);
+    return "high";
+}
+
+static void dumpFrame() {
+    for (uint32_t page = 0; page < heat.pages; page++) {
+        uint16_t *c = heat.frame[page];
+        if (!(c[HEAT_KIND_READ] | c[HEAT_KIND_WRITE] | c[HEAT_KIND_EXEC])) continue; //most pages sit idle, only busy ones get a row
+        int bank;
+        uint16_t addr;
+        const char *region = describePage(page, &bank, &addr);
+        fprintf(heat.dump, "%llu,%s,%d,%04X,%u,%u,%u\n", (unsigned long long)heat.frameNumber, region, bank, addr,
+            c[HEAT_KIND_READ], c[HEAT_KIND_WRITE], c[HEAT_KIND_EXEC]);
+        heat.rows++;
+    }
+}
+
+void heatFrame() {
+    if (!heat.on) return;
+    if (heat.dump && heat.frameNumber >= heat.firstFrame) {
+        dumpFrame();
+        if (heat.frameNumber >= heat.lastFrame) { //range done, the file is complete
+            fclose(heat.dump);
+            heat.dump = NULL;
+            if (!heat.window) heat.on = 0; //nobody left to count for
+        }
+    }
+
+    if (heat.window) {
+        for (uint32_t page = 0; page < heat.pages; page++) {
+            for (int k = 0; k < HEAT_KINDS; k++) heat.recent[page][k] += heat.frame[page][k];
+        }
+        heat.recentFrames++;
+        if (SDL_AtomicGet(&heat.shownFrames) == 0) { //render thread is done with the last copy, hand over a new one
+            memcpy(heat.shown, heat.recent, heat.pages * sizeof(heat.recent[0]));
+            SDL_AtomicSet(&heat.shownFrames, (int)heat.recentFrames);
+            memset(heat.recent, 0, heat.pages * sizeof(heat.recent[0]));
+            heat.recentFrames = 0;
+        }
+    }
+
+    memset(heat.frame, 0, (heat.pages + 1) * sizeof(heat.frame[0]));
+    heat.frameNumber++;
+}
+
+//Log scale, a page read once a frame still shows next to one hammered every cycle
+static uint8_t heatLevel(double perFrame) {
+    if (perFrame <= 0) return 0;
+    double level = 48 + 207 * log2(1 + perFrame) / log2(1 + 70224 / 4.0); //most one page can see is an access every M-cycle
+    return level > 255 ? 255 : (uint8_t)level;
+}
+
+//Red writes, green reads, blue executes, one pixel a page, one ROM bank a row
+void drawHeatmap() {
+    if (!heat.window) return;
+    int frames = SDL_AtomicGet(&heat.shownFrames);
+    if (frames == 0) return;
+
+    if (!heatRenderer) {
+        heatRenderer = SDL_CreateRenderer(heat.window, -1, SDL_RENDERER_ACCELERATED); //no vsync, the main window already waits on it
+        if (!heatRenderer) {
+            printf("Failed to create heatmap renderer: %s\n", SDL_GetError());
+            heat.window = NULL;
+            return;
+        }
+        heatTexture = SDL_CreateTexture(heatRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, HEAT_ROW, heatRows());
+    }
+
+    void *pixels;
+    int pitch;
+    if (heatTexture && SDL_LockTexture(heatTexture, NULL, &pixels, &pitch) == 0) {
+        for (uint32_t row = 0; row < heatRows(); row++) {
+            uint32_t *out = (uint32_t *)((uint8_t *)pixels + row * pitch);
+            for (uint32_t x = 0; x < HEAT_ROW; x++) {
+                uint32_t page = row * HEAT_ROW + x;
+                if (page >= heat.pages) {
+                    out[x] = 0xFF000000;
+                    continue;
+                }
+                uint32_t *c = heat.shown[page];
+                out[x] = 0xFF000000 | (uint32_t)heatLevel((double)c[HEAT_KIND_WRITE] / frames) << 16
+                    | (uint32_t)heatLevel((double)c[HEAT_KIND_READ] / frames) << 8 | heatLevel((double)c[HEAT_KIND_EXEC] / frames);
+            }
+        }
+        SDL_UnlockTexture(heatTexture);
+    }
+    SDL_AtomicSet(&heat.shownFrames, 0); //emulation thread may fill it again
+
+    SDL_RenderClear(heatRenderer);
+    SDL_RenderCopy(heatRenderer, heatTexture, NULL, NULL);
+    SDL_RenderPresent(heatRenderer);
+    heat.redraws++;
+}
+
+void closeHeatmapRenderer() {
+    if (heatTexture) SDL_DestroyTexture(heatTexture);
+    heatTexture = NULL;
+    if (heatRenderer) SDL_DestroyRenderer(heatRenderer);
+    heatRenderer = NULL;
+}
+
+void stopHeatmap() {
+    if (heat.dump) fclose(heat.dump); //range ran past the end of the run
+    heat.dump = NULL;
+    heat.on = 0;
+}
+
+void printHeatmapStats() {
+    if (!heat.frame) return;
+    printf("Heatmap: %llu pages over %llu frames, %llu dump rows, window redrawn %u times\n", (unsigned long long)heat.pages,
+        (unsigned long long)heat.frameNumber, (unsigned long long)heat.rows, heat.redraws);
+}
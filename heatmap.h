@@ -0,0 +1,83 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //heatmap window texture
+
+#include "memory.h"
+
+#define HEAT_PAGE_SHIFT 8 //256 byte pages
+#define HEAT_ROM_PAGES 64 //per 16KB ROM bank
+#define HEAT_RAM_PAGES 32 //per 8KB VRAM, WRAM or ERAM bank
+#define HEAT_HIGH_PAGES 2 //FE00 OAM, FF00 IO/HRAM/IE
+#define HEAT_ROW 64 //pages per row of the live window, one ROM bank
+#define HEAT_SCALE 8 //window pixels per page
+#define HEAT_WINDOW_MAX 720 //tallest the live window gets, big ROMs get squashed
+
+enum { HEAT_KIND_READ, HEAT_KIND_WRITE, HEAT_KIND_EXEC, HEAT_KINDS };
+
+//Per page read/write/execute counts, for finding hot code and data in the emulator or a homebrew ROM.
+//Pages are numbered flat: every ROM bank, VRAM, WRAM, every ERAM bank, then the FE and FF pages.
+//Only counted when built with -DHEATMAP, otherwise the hooks in cpu.c compile to nothing.
+typedef struct {
+    int on;
+    uint32_t pages; //real pages, there's one more after them that unmapped ERAM accesses land in
+    uint32_t romPages;
+    uint32_t vramBase;
+    uint32_t wramBase;
+    uint32_t eramBase;
+    uint32_t eramPages;
+    uint32_t highBase;
+    uint16_t (*frame)[HEAT_KINDS]; //this frame, one access per M-cycle at most so 16 bits never wrap
+    uint64_t frameNumber; //frames finished since start
+
+    //--heatmap-dump, nonzero pages of each frame in the range as CSV
+    FILE *dump;
+    uint64_t firstFrame;
+    uint64_t lastFrame;
+    uint64_t rows;
+
+    //--heatmap, live window drawn by the render thread
+    SDL_Window *window;
+    uint32_t (*recent)[HEAT_KINDS]; //summed since the render thread last took a copy
+    uint32_t recentFrames;
+    uint32_t (*shown)[HEAT_KINDS]; //the copy handed over
+    SDL_atomic_t shownFrames; //frames summed in shown, 0 once the render thread is done with it
+    uint32_t redraws;
+} HeatmapState;
+
+extern HeatmapState heat;
+
+#ifdef HEATMAP
+static inline uint32_t heatPage(uint16_t addr) {
+    if (addr < 0x8000) { //whichever bank is mapped, straight from the pointer
+        uint32_t page = (uint32_t)((memory.memoryMap[addr] - memory.cartridge) >> HEAT_PAGE_SHIFT);
+        return page < heat.romPages ? page : heat.pages;
+    }
+    if (addr < 0xA000) return heat.vramBase + ((addr >> HEAT_PAGE_SHIFT) & 0x1F);
+    if (addr < 0xC000) { //RTC registers and disabled RAM aren't in eram
+        uint32_t page = (uint32_t)((memory.memoryMap[addr] - memory.eram) >> HEAT_PAGE_SHIFT);
+        return page < heat.eramPages ? heat.eramBase + page : heat.pages;
+    }
+    if (addr < 0xFE00) return heat.wramBase + ((addr >> HEAT_PAGE_SHIFT) & 0x1F); //echo RAM counts as WRAM
+    return heat.highBase + ((addr >> HEAT_PAGE_SHIFT) & 1);
+}
+#define HEAT_COUNT(addr, kind) do { if (heat.on) heat.frame[heatPage(addr)][kind]++; } while (0)
+#else
+#define HEAT_COUNT(addr, kind) ((void)0)
+#endif
+#define HEAT_READ(addr) HEAT_COUNT(addr, HEAT_KIND_READ)
+#define HEAT_WRITE(addr) HEAT_COUNT(addr, HEAT_KIND_WRITE)
+#define HEAT_EXEC(addr) HEAT_COUNT(addr, HEAT_KIND_EXEC)
+
+int startHeatmap(const char *dumpPath, const char *range, SDL_Window *window); //range is FIRST-LAST in frames, NULL = all
+void heatFrame(); //once per emulated frame at the host event boundary
+void drawHeatmap(); //render thread
+void closeHeatmapRenderer(); //render thread, on its way out
+void stopHeatmap();
+void printHeatmapStats();
+
+#endif
@@ -0,0 +1,262 @@
+#include "hud.h"
+#include "cpu.h"
+#include "pace.h"
+#include "present.h"
+#include <time.h>
+#include <SDL2/SDL_ttf.h>  // fonts
+
+HudState hud;
+
+//Only ever touched by the render thread
+static TTF_Font *font = NULL;
+static int fontFailed = 0;
+static SDL_Texture *textTexture = NULL;
+static int textWidth, textHeight;
+static int drawnSeq = -1;
+
+static const char *fontPaths[] = {
+    "DejaVuSansMono.ttf", //next to the emulator wins
+    "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+    "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
+    "/usr/share/fonts/dejavu/DejaVuSansMono.ttf",
+    "/System/Library/Fonts/Menlo.ttc",
+    "C:\\Windows\\Fonts\\consola.ttf",
+};
+
+uint64_t hudClock() {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+    return (uint64_t)((double)SDL_GetPerformanceCounter() * 1e9 / SDL_GetPerformanceFrequency());
+#endif
+}
+
+//Statistical profile of the emulation thread, cheaper than reading the clock around every PPU step
+static int samplerThread(void *data) {
+    (void)data;
+    while (SDL_AtomicGet(&hud.running)) {
+        SDL_Delay(HUD_SAMPLE_MS);
+        SDL_AtomicAdd(&hud.samples[hud.unit], 1);
+    }
+    return 0;
+}
+
+static void startWindow(uint64_t now) {
+    hud.windowStart = now;
+    hud.lastFrame = now;
+    hud.lastSlept = pace.sleptNs;
+    hud.frames = 0;
+    hud.busyNs = 0;
+    hud.inputNs = 0;
+    hud.startCycle = systemCycles;
+    hud.startInstructions = instructionsExecuted;
+    hud.startHaltSkipped = haltSkippedCycles;
+    for (int i = 0; i < HUD_UNITS; i++) hud.startSamples[i] = SDL_AtomicGet(&hud.samples[i]);
+    hud.startPresented = SDL_AtomicGet(&present.presentedFrames);
+    hud.startRenderNs = SDL_AtomicGet(&present.renderNs);
+    hud.frameTimeCount = 0;
+}
+
+static void startHud() {
+    if (hud.active) return;
+    hud.active = 1;
+    SDL_AtomicSet(&hud.running, 1);
+    hud.sampler = SDL_CreateThread(samplerThread, "hud sampler", NULL);
+    if (!hud.sampler) { //still get everything but the CPU/PPU split
+        printf("Failed to start HUD sampler: %s\n", SDL_GetError());
+        SDL_AtomicSet(&hud.running, 0);
+    }
+    startWindow(hudClock());
+}
+
+int initHud(const char *telemetryPath, const char *fontPath, int visible) {
+    memset(&hud, 0, sizeof(hud));
+    hud.fontPath = fontPath;
+    hud.visible = visible;
+    hud.startNs = hudClock();
+    snprintf(hud.text[0], HUD_TEXT_MAX, "measuring...");
+
+    if (telemetryPath) {
+        hud.telemetry = fopen(telemetryPath, "w");
+        if (!hud.telemetry) {
+            perror("Failed to open telemetry file");
+            return -1;
+        }
+        const char *ext = strrchr(telemetryPath, '.');
+        hud.telemetryCsv = ext && strcmp(ext, ".csv") == 0;
+        if (hud.telemetryCsv) {
+            fprintf(hud.telemetry, "time,uptime,frames,fps,speed,frame_ns,cpu_ns,ppu_ns,input_ns,present_ns,"
+                "instructions,halt_skipped,p50_ns,p95_ns,p99_ns,max_ns\n");
+        }
+    }
+    if (visible || hud.telemetry) startHud();
+    return 0;
+}
+
+void toggleHud() {
+    hud.visible = !hud.visible;
+    if (hud.visible) startHud();
+}
+
+static int compareTimes(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void writeTelemetry(const HudSnapshot *s) {
+    double uptime = (hudClock() - hud.startNs) / 1e9;
+    long long now = (long long)time(NULL);
+    if (hud.telemetryCsv) {
+        fprintf(hud.telemetry, "%lld,%.3f,%llu,%.2f,%.3f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%u,%u,%u,%u\n",
+            now, uptime, (unsigned long long)hud.frames, s->fps, s->speed, s->frameNs, s->cpuNs, s->ppuNs, s->inputNs,
+            s->presentNs, s->instructions, s->haltSkipped, s->p50, s->p95, s->p99, s->max);
+    } else {
+        fprintf(hud.telemetry, "{\"time\":%lld,\"uptime\":%.3f,\"frames\":%llu,\"fps\":%.2f,\"speed\":%.3f,"
+            "\"frame_ns\":%.0f,\"cpu_ns\":%.0f,\"ppu_ns\":%.0f,\"input_ns\":%.0f,\"present_ns\":%.0f,"
+            "\"instructions\":%.0f,\"halt_skipped\":%.0f,\"p50_ns\":%u,\"p95_ns\":%u,\"p99_ns\":%u,\"max_ns\":%u}\n",
+            now, uptime, (unsigned long long)hud.frames, s->fps, s->speed, s->frameNs, s->cpuNs, s->ppuNs, s->inputNs,
+            s->presentNs, s->instructions, s->haltSkipped, s->p50, s->p95, s->p99, s->max);
+    }
+    fflush(hud.telemetry); //dashboards tail the file
+    hud.rows++;
+}
+
+//Window's counters into per frame numbers, then the overlay text and a telemetry row
+static void finishWindow(uint64_t now) {
+    HudSnapshot *s = &hud.last;
+    double frames = (double)hud.frames;
+    double seconds = (now - hud.windowStart) / 1e9;
+    s->fps = frames / seconds;
+    s->speed = (double)(systemCycles - hud.startCycle) / PACE_CLOCK / seconds;
+    s->frameNs = hud.busyNs / frames;
+    s->inputNs = hud.inputNs / frames;
+    s->instructions = (instructionsExecuted - hud.startInstructions) / frames;
+    s->haltSkipped = (haltSkippedCycles - hud.startHaltSkipped) / frames;
+
+    //whatever isn't host events is emulation, split by where the samples fell
+    double emulated = s->frameNs > s->inputNs ? s->frameNs - s->inputNs : 0;
+    int cpu = SDL_AtomicGet(&hud.samples[HUD_CPU]) - hud.startSamples[HUD_CPU];
+    int ppu = SDL_AtomicGet(&hud.samples[HUD_PPU]) - hud.startSamples[HUD_PPU];
+    double ppuShare = cpu + ppu > 0 ? (double)ppu / (cpu + ppu) : 0;
+    s->ppuNs = emulated * ppuShare;
+    s->cpuNs = emulated - s->ppuNs;
+
+    //both counters wrap, the difference doesn't care
+    int presented = SDL_AtomicGet(&present.presentedFrames) - hud.startPresented;
+    unsigned renderNs = (unsigned)SDL_AtomicGet(&present.renderNs) - (unsigned)hud.startRenderNs;
+    s->presentNs = presented > 0 ? (double)renderNs / presented : 0;
+
+    uint32_t sorted[HUD_FRAME_TIMES];
+    uint32_t count = hud.frameTimeCount < HUD_FRAME_TIMES ? hud.frameTimeCount : HUD_FRAME_TIMES;
+    memcpy(sorted, hud.frameTimes, count * sizeof(sorted[0]));
+    qsort(sorted, count, sizeof(sorted[0]), compareTimes);
+    s->p50 = sorted[(count - 1) * 50 / 100];
+    s->p95 = sorted[(count - 1) * 95 / 100];
+    s->p99 = sorted[(count - 1) * 99 / 100];
+    s->max = sorted[count - 1];
+
+    int next = (SDL_AtomicGet(&hud.textSeq) + 1) & 1;
+    snprintf(hud.text[next], HUD_TEXT_MAX,
+        "%.1f fps  %.2fx\n"
+        "frame %.2f ms  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f\n"
+        "cpu %.2f  ppu %.2f  input %.3f  present %.2f ms\n"
+        "%.0f instructions a frame  %.0f%% of cycles halt skipped",
+        s->fps, s->speed, s->frameNs / 1e6, s->p50 / 1e6, s->p95 / 1e6, s->p99 / 1e6, s->max / 1e6,
+        s->cpuNs / 1e6, s->ppuNs / 1e6, s->inputNs / 1e6, s->presentNs / 1e6,
+        s->instructions, 100.0 * (haltSkippedCycles - hud.startHaltSkipped) / (systemCycles - hud.startCycle));
+    SDL_AtomicAdd(&hud.textSeq, 1); //render thread picks it up on its next present
+
+    if (hud.telemetry) writeTelemetry(s);
+}
+
+void hudFrame() {
+    if (!hud.active) return;
+    uint64_t now = hudClock();
+    uint64_t wall = now - hud.lastFrame;
+    uint64_t slept = pace.sleptNs - hud.lastSlept;
+    if (wall > 2 * HUD_WINDOW_NS || systemCycles < hud.startCycle) { //paused, debugger, or a savestate went back in time
+        startWindow(now);
+        return;
+    }
+    hud.lastFrame = now;
+    hud.lastSlept = pace.sleptNs;
+
+    uint64_t busy = wall > slept ? wall - slept : 0;
+    hud.busyNs += busy;
+    hud.frames++;
+    hud.frameTimes[hud.frameTimeCount++ % HUD_FRAME_TIMES] = (uint32_t)busy;
+
+    if (now - hud.windowStart >= HUD_WINDOW_NS) {
+        finishWindow(now);
+        startWindow(now);
+    }
+}
+
+static TTF_Font *openFont() {
+    if (hud.fontPath) return TTF_OpenFont(hud.fontPath, HUD_FONT_SIZE);
+    for (size_t i = 0; i < sizeof(fontPaths) / sizeof(fontPaths[0]); i++) {
+        TTF_Font *f = TTF_OpenFont(fontPaths[i], HUD_FONT_SIZE);
+        if (f) return f;
+    }
+    return NULL;
+}
+
+//Text only goes through TTF when a window finished, every other present reuses the texture
+void drawHud(SDL_Renderer *renderer) {
+    if (!hud.visible || fontFailed) return;
+    if (!font) {
+        font = openFont();
+        if (!font) {
+            printf("No font for the HUD, pass one with --hud-font: %s\n", TTF_GetError());
+            fontFailed = 1;
+            return;
+        }
+    }
+
+    int seq = SDL_AtomicGet(&hud.textSeq);
+    if (seq != drawnSeq) {
+        SDL_Color white = { 255, 255, 255, 255 };
+        SDL_Surface *surface = TTF_RenderText_Blended_Wrapped(font, hud.text[seq & 1], white, 780);
+        if (!surface) return;
+        if (textTexture) SDL_DestroyTexture(textTexture);
+        textTexture = SDL_CreateTextureFromSurface(renderer, surface);
+        textWidth = surface->w;
+        textHeight = surface->h;
+        SDL_FreeSurface(surface);
+        drawnSeq = seq;
+        hud.redraws++;
+    }
+    if (!textTexture) return;
+
+    SDL_Rect back = { 4, 4, textWidth + 8, textHeight + 8 };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160); //dark box so it reads over any game
+    SDL_RenderFillRect(renderer, &back);
+    SDL_Rect text = { 8, 8, textWidth, textHeight };
+    SDL_RenderCopy(renderer, textTexture, NULL, &text);
+}
+
+void closeHudRenderer() {
+    if (textTexture) SDL_DestroyTexture(textTexture);
+    textTexture = NULL;
+    if (font) TTF_CloseFont(font);
+    font = NULL;
+    drawnSeq = -1;
+}
+
+void stopHud() {
+    if (hud.sampler) {
+        SDL_AtomicSet(&hud.running, 0);
+        SDL_WaitThread(hud.sampler, NULL);
+        hud.sampler = NULL;
+    }
+    if (hud.telemetry) fclose(hud.telemetry);
+    hud.telemetry = NULL;
+}
+
+void printHudStats() {
+    if (!hud.active) return;
+    printf("HUD: %llu telemetry rows, overlay text redrawn %u times\n", (unsigned long long)hud.rows, hud.redraws);
+}
@@ -0,0 +1,86 @@
+#ifndef HUD_H
+#define HUD_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //overlay drawing and the sampler thread
+
+#define HUD_WINDOW_NS 500000000ull //counters turn into per frame numbers this often, for the overlay and the telemetry file
+#define HUD_FRAME_TIMES 1024 //most recent frame times the percentiles come from
+#define HUD_SAMPLE_MS 1 //sampler period, the CPU/PPU split is the share of samples that land in each
+#define HUD_TEXT_MAX 512
+#define HUD_FONT_SIZE 16
+
+//What the emulation thread is busy with, the sampler thread reads it
+enum {
+    HUD_CPU, //CPU and every unit that isn't the PPU
+    HUD_PPU,
+    HUD_HOST, //pacing, host events and the rest of the frame boundary, measured directly instead
+    HUD_UNITS
+};
+
+//One window's worth of numbers, times are host ns per emulated frame
+typedef struct {
+    double fps; //emulated frames per host second
+    double speed; //emulated time over host time
+    double frameNs; //emulating a frame, sleep left out
+    double cpuNs;
+    double ppuNs;
+    double inputNs;
+    double presentNs; //render thread, per frame it put on screen
+    double instructions;
+    double haltSkipped; //cycles a halted CPU jumped over
+    uint32_t p50, p95, p99, max; //frame time percentiles, ns
+} HudSnapshot;
+
+typedef struct {
+    int active; //counters are being kept, overlay or telemetry asked for them
+    int visible; //overlay drawn over the frame
+    const char *fontPath; //NULL = try a few common monospace fonts
+    volatile uint8_t unit; //HUD_CPU/PPU/HOST, written by the emulation thread every PPU step
+
+    SDL_Thread *sampler;
+    SDL_atomic_t running;
+    SDL_atomic_t samples[HUD_UNITS];
+
+    //current window
+    uint64_t windowStart;
+    uint64_t lastFrame; //host ns of the previous frame boundary
+    uint64_t lastSlept; //pace.sleptNs at the previous frame boundary
+    uint64_t frames;
+    uint64_t busyNs;
+    uint64_t inputNs; //added to by the main loop around host events
+    uint64_t startCycle;
+    uint64_t startInstructions;
+    uint64_t startHaltSkipped;
+    int startSamples[HUD_UNITS];
+    int startPresented;
+    int startRenderNs;
+    uint32_t frameTimes[HUD_FRAME_TIMES]; //ring
+    uint32_t frameTimeCount;
+
+    HudSnapshot last;
+    char text[2][HUD_TEXT_MAX]; //overlay text, a new one goes into the slot the render thread isn't reading
+    SDL_atomic_t textSeq; //bumped once a text is complete, text[textSeq & 1] is the current one
+    uint32_t redraws; //times the render thread turned the text into a texture
+
+    FILE *telemetry;
+    int telemetryCsv; //CSV for a .csv file, otherwise one JSON object per line
+    uint64_t rows;
+    uint64_t startNs;
+} HudState;
+
+extern HudState hud;
+
+int initHud(const char *telemetryPath, const char *fontPath, int visible); //-1 if the telemetry file can't be made
+uint64_t hudClock(); //host ns, monotonic
+void hudFrame(); //once per emulated frame at the host event boundary
+void toggleHud(); //overlay on/off, starts the counters the first time
+void drawHud(SDL_Renderer *renderer); //render thread, on top of the frame
+void closeHudRenderer(); //render thread, before the renderer goes
+void stopHud();
+void printHudStats();
+
+#endif
@@ -1,7 +1,19 @@
 #include "input.h"
 #include "memory.h"
+#include "movie.h"
+#include "cpu.h"
 
 InputState input;
+InputQueue inputQueue;
+
+void initInput() {
+    input.buttonState = 0xFF; // active low, nothing held
+    input.polled = 0;
+    input.nextPollCycle = systemCycles + INPUT_POLL_CYCLES;
+    SDL_AtomicSet(&inputQueue.head, 0);
+    SDL_AtomicSet(&inputQueue.tail, 0);
+    inputQueue.hostState = 0xFF;
+}
 
 uint8_t readJoypad(uint8_t select) {
     // select: current value at 0xFF00 (written by CPU)
@@ -19,22 +31,88 @@ uint8_t readJoypad(uint8_t select) {
 }
 
 void handleButtonPress(SDL_Event *event) {
+    if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) return;
     int pressed = (event->type == SDL_KEYDOWN) ? 0 : 1;
-    uint8_t prevState = input.buttonState;
+    uint8_t state = inputQueue.hostState;
 
     switch (event->key.keysym.sym) {
         // D-pad (P14 group)
-        case SDLK_w: if (pressed) input.buttonState |= (1 << 2); else input.buttonState &= ~(1 << 2); break; // Up
-        case SDLK_s: if (pressed) input.buttonState |= (1 << 3); else input.buttonState &= ~(1 << 3); break; // Down
-        case SDLK_a: if (pressed) input.buttonState |= (1 << 1); else input.buttonState &= ~(1 << 1); break; // Left
-        case SDLK_d: if (pressed) input.buttonState |= (1 << 0); else input.buttonState &= ~(1 << 0); break; // Right
+        case SDLK_w: if (pressed) state |= (1 << 2); else state &= ~(1 << 2); break; // Up
+        case SDLK_s: if (pressed) state |= (1 << 3); else state &= ~(1 << 3); break; // Down
+        case SDLK_a: if (pressed) state |= (1 << 1); else state &= ~(1 << 1); break; // Left
+        case SDLK_d: if (pressed) state |= (1 << 0); else state &= ~(1 << 0); break; // Right
 
         // Action buttons (P15 group)
-        case SDLK_v: if (pressed) input.buttonState |= (1 << 4); else input.buttonState &= ~(1 << 4); break; // A
-        case SDLK_c: if (pressed) input.buttonState |= (1 << 5); else input.buttonState &= ~(1 << 5); break; // B
-        case SDLK_r: if (pressed) input.buttonState |= (1 << 6); else input.buttonState &= ~(1 << 6); break; // Select
-        case SDLK_f: if (pressed) input.buttonState |= (1 << 7); else input.buttonState &= ~(1 << 7); break; // Start
+        case SDLK_v: if (pressed) state |= (1 << 4); else state &= ~(1 << 4); break; // A
+        case SDLK_c: if (pressed) state |= (1 << 5); else state &= ~(1 << 5); break; // B
+        case SDLK_r: if (pressed) state |= (1 << 6); else state &= ~(1 << 6); break; // Select
+        case SDLK_f: if (pressed) state |= (1 << 7); else state &= ~(1 << 7); break; // Start
+        default: return;
     }
+    if (state == inputQueue.hostState) return; // key repeat
+
+    // SDL stamps events in milliseconds when the OS hands them over, backdate the counter to that
+    uint32_t age = SDL_GetTicks() - event->key.timestamp;
+    uint64_t hostTicks = SDL_GetPerformanceCounter() - (uint64_t)age * SDL_GetPerformanceFrequency() / 1000;
+    queueButtonState(state, hostTicks);
+}
+
+// Host side, the joypad only changes when the emulation reaches the next poll cycle
+void queueButtonState(uint8_t state, uint64_t hostTicks) {
+    unsigned head = (unsigned)SDL_AtomicGet(&inputQueue.head);
+    if (head - (unsigned)SDL_AtomicGet(&inputQueue.tail) >= INPUT_QUEUE_SIZE) {
+        inputQueue.dropped++;
+        return;
+    }
+    InputEvent *slot = &inputQueue.slots[head & (INPUT_QUEUE_SIZE - 1)];
+    slot->buttons = state;
+    slot->hostTicks = hostTicks;
+    inputQueue.hostState = state;
+    SDL_AtomicSet(&inputQueue.head, (int)(head + 1)); // publish only once the slot is written
+}
+
+// Emulation side, called on input.nextPollCycle so when a key lands depends on emulated time only.
+// A button changes at most once per boundary, a tap shorter than a frame would otherwise press and
+// release on the same cycle and the game would never see it. Its release and anything queued after
+// wait for the next boundary
+void applyQueuedInput() {
+    input.nextPollCycle += INPUT_POLL_CYCLES;
+
+    unsigned tail = (unsigned)SDL_AtomicGet(&inputQueue.tail);
+    unsigned head = (unsigned)SDL_AtomicGet(&inputQueue.head);
+    if (tail == head) return;
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    uint8_t changed = 0; // buttons already changed at this boundary
+    while (tail != head) {
+        InputEvent *event = &inputQueue.slots[tail & (INPUT_QUEUE_SIZE - 1)];
+        uint8_t flips = event->buttons ^ input.buttonState;
+        if (flips & changed) break;
+        changed |= flips;
+        setButtonState(event->buttons);
+        uint64_t latency = now > event->hostTicks ? now - event->hostTicks : 0;
+        inputQueue.latencyTicks += latency;
+        if (latency > inputQueue.latencyMaxTicks) inputQueue.latencyMaxTicks = latency;
+        inputQueue.applied++;
+        tail++;
+    }
+    SDL_AtomicSet(&inputQueue.tail, (int)tail);
+}
+
+void printInputStats() {
+    if (inputQueue.applied == 0) return;
+    double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+    printf("Input: %llu changes, key to joypad avg %.2f ms, max %.2f ms, %llu dropped\n",
+        (unsigned long long)inputQueue.applied, inputQueue.latencyTicks * msPerTick / inputQueue.applied,
+        inputQueue.latencyMaxTicks * msPerTick, (unsigned long long)inputQueue.dropped);
+}
+
+//Every joypad change goes through here, keys and movie playback alike
+void setButtonState(uint8_t state) {
+    uint8_t prevState = input.buttonState;
+    if (state == prevState) return;
+    input.buttonState = state;
+    if (movie.mode == MOVIE_RECORD) recordMovieInput(state);
 
     // Update 0xFF00 using correct readJoypad behavior
     *memory.memoryMap[0xFF00] = readJoypad(*memory.memoryMap[0xFF00]);
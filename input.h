@@ -3,13 +3,42 @@
 #include <stdint.h>
 #include <SDL2/SDL.h>
 
+#define INPUT_QUEUE_SIZE 64 //host events waiting for the next boundary, power of 2
+#define INPUT_POLL_CYCLES 70224 //host input is looked at and applied once per frame of emulated time
+
 typedef struct {
     uint8_t buttonState;  // bits for joypad
+    int polled; // FF00 read since the last movie frame, frames without one are lag frames
+    uint64_t nextPollCycle; // queued host input gets applied at the end of this cycle
 } InputState;
 
+typedef struct {
+    uint8_t buttons; // whole joypad state after the event
+    uint64_t hostTicks; // performance counter when the OS got the key
+} InputEvent;
+
+typedef struct {
+    SDL_atomic_t head; // written by the host side only
+    SDL_atomic_t tail; // written by the emulation only
+    InputEvent slots[INPUT_QUEUE_SIZE];
+    uint8_t hostState; // newest state queued, what the keyboard says right now
+
+    //stats
+    uint64_t dropped; // queue was full, host side
+    uint64_t applied; // emulation side from here on
+    uint64_t latencyTicks; // summed time from the key to the joypad changing
+    uint64_t latencyMaxTicks;
+} InputQueue; // single producer single consumer, the host can feed it from any one thread
+
 extern InputState input;
+extern InputQueue inputQueue;
 
+void initInput();
 void handleButtonPress(SDL_Event *event);
+void setButtonState(uint8_t state);
+void queueButtonState(uint8_t state, uint64_t hostTicks);
+void applyQueuedInput();
+void printInputStats();
 uint8_t readJoypad(uint8_t select);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include "lanes.h"
+#include "cpu.h"
+#include "memory.h"
+#include "ppu.h"
+#include "savestate.h"
+#include <SDL2/SDL.h> //CPU count and the step timer
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+GBLanes lanes;
+
+//stats, coordinator side
+static uint64_t steps;
+static uint64_t stepTicks;
+static uint64_t stepInstructions;
+
+#ifndef _WIN32
+
+//Lives at the start of the shared mapping, the lane arrays follow it
+typedef struct {
+    sem_t start[LANES_MAX_WORKERS]; //one post per step, per worker
+    sem_t done; //each worker posts once its lanes are through
+    int frames;
+    int quit;
+} LaneControl;
+
+static LaneControl *control;
+static void *shared;
+static size_t sharedSize;
+static pid_t pids[LANES_MAX_WORKERS];
+
+//Carves the lane arrays out of one block, 64 byte aligned so workers don't share cache lines at the edges
+static size_t layoutLanes(uint8_t *base, int count) {
+    size_t offset = (sizeof(LaneControl) + 63) & ~(size_t)63;
+    #define LANE_ARRAY(field, size) \
+        if (base) lanes.field = (void *)(base + offset); \
+        offset = (offset + (size_t)(size) * count + 63) & ~(size_t)63;
+    LANE_ARRAY(buttons, 1);
+    LANE_ARRAY(reset, 1);
+    LANE_ARRAY(framebuffer, 144 * 160);
+    LANE_ARRAY(wram, 0x2000);
+    LANE_ARRAY(hram, 0x7F);
+    LANE_ARRAY(io, 0x80);
+    LANE_ARRAY(cycles, sizeof(uint64_t));
+    LANE_ARRAY(frame, sizeof(uint32_t));
+    LANE_ARRAY(lagFrame, 1);
+    LANE_ARRAY(instructions, sizeof(uint64_t));
+    #undef LANE_ARRAY
+    return offset;
+}
+
+static void writeLane(int lane, const GBObservation *obs) {
+    memcpy(lanes.framebuffer[lane], obs->framebuffer, sizeof(lanes.framebuffer[0]));
+    memcpy(lanes.wram[lane], obs->wram, sizeof(lanes.wram[0]));
+    memcpy(lanes.hram[lane], obs->hram, sizeof(lanes.hram[0]));
+    memcpy(lanes.io[lane], obs->io, sizeof(lanes.io[0]));
+    lanes.cycles[lane] = obs->cycles;
+    lanes.frame[lane] = obs->frame;
+    lanes.lagFrame[lane] = obs->lagFrame;
+    lanes.instructions[lane] = instructionsExecuted;
+}
+
+//Worker process, owns lanes first..first+count-1 and never returns
+static void laneWorker(int worker, int first, int count) {
+    SaveState *states = NULL; //lanes not currently loaded into the emulator
+    uint64_t *laneInstructions = calloc(count, sizeof(uint64_t));
+    if (!laneInstructions) _exit(1);
+    if (count > 1) {
+        states = malloc(sizeof(SaveState) * count);
+        if (!states) _exit(1);
+        for (int i = 0; i < count; i++) captureState(&states[i]); //all at power on
+    }
+
+    while (1) {
+        while (sem_wait(&control->start[worker]) != 0); //EINTR
+        if (control->quit) break;
+
+        for (int i = 0; i < count; i++) {
+            int lane = first + i;
+            if (states) restoreState(&states[i]); //one lane alone never leaves the emulator
+            instructionsExecuted = laneInstructions[i];
+            if (lanes.reset[lane]) {
+                gbReset();
+                lanes.reset[lane] = 0;
+            }
+            writeLane(lane, gbStep(lanes.buttons[lane], control->frames));
+            laneInstructions[i] = instructionsExecuted;
+            if (states) captureState(&states[i]);
+        }
+        sem_post(&control->done);
+    }
+    _exit(0); //atexit handlers belong to the coordinator
+}
+
+int gbLanesInit(const char *romPath, int count, int workers) {
+    if (count < 1 || count > LANES_MAX) {
+        printf("Lane count has to be 1-%d\n", LANES_MAX);
+        return -1;
+    }
+    if (workers <= 0) workers = SDL_GetCPUCount();
+    if (workers > count) workers = count;
+    if (workers > LANES_MAX_WORKERS) workers = LANES_MAX_WORKERS;
+
+    if (gbInit(romPath) != 0) return -1; //loaded once here, workers get it copy on write
+
+    sharedSize = layoutLanes(NULL, count);
+    shared = mmap(NULL, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("Failed to map lane memory");
+        shared = NULL;
+        return -1;
+    }
+    memset(shared, 0, sharedSize);
+    control = shared;
+    layoutLanes(shared, count);
+    lanes.count = count;
+    lanes.workers = workers;
+    sem_init(&control->done, 1, 0);
+    for (int w = 0; w < workers; w++) sem_init(&control->start[w], 1, 0);
+
+    for (int lane = 0; lane < count; lane++) {
+        memcpy(lanes.wram[lane], memory.wram, sizeof(lanes.wram[0]));
+        memcpy(lanes.hram[lane], memory.hram, sizeof(lanes.hram[0]));
+        memcpy(lanes.io[lane], memory.io, sizeof(lanes.io[0]));
+        lanes.cycles[lane] = systemCycles; //nothing run yet, every lane starts out as power on
+    }
+
+    fflush(stdout); //children would print whatever is still buffered again
+    int first = 0;
+    for (int w = 0; w < workers; w++) {
+        int laneCount = count / workers + (w < count % workers);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("Failed to start lane worker");
+            lanes.workers = w;
+            gbLanesClose();
+            return -1;
+        }
+        if (pid == 0) laneWorker(w, first, laneCount);
+        pids[w] = pid;
+        first += laneCount;
+    }
+
+    steps = 0;
+    stepTicks = 0;
+    stepInstructions = 0;
+    return 0;
+}
+
+int gbLanesStep(int frames) {
+    if (!control) return -1;
+    if (frames < 1) frames = 1;
+    uint64_t before = 0;
+    for (int lane = 0; lane < lanes.count; lane++) before += lanes.instructions[lane];
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    control->frames = frames;
+    for (int w = 0; w < lanes.workers; w++) sem_post(&control->start[w]);
+    for (int w = 0; w < lanes.workers; w++) {
+        while (sem_wait(&control->done) != 0); //EINTR
+    }
+    stepTicks += SDL_GetPerformanceCounter() - start;
+
+    uint64_t after = 0;
+    for (int lane = 0; lane < lanes.count; lane++) after += lanes.instructions[lane];
+    stepInstructions += after - before; //resets start a lane's count over, then this undercounts a little
+    steps++;
+    return 0;
+}
+
+void gbLanesClose() {
+    if (!control) return;
+    control->quit = 1;
+    for (int w = 0; w < lanes.workers; w++) sem_post(&control->start[w]);
+    for (int w = 0; w < lanes.workers; w++) waitpid(pids[w], NULL, 0);
+    for (int w = 0; w < lanes.workers; w++) sem_destroy(&control->start[w]);
+    sem_destroy(&control->done);
+    munmap(shared, sharedSize); //lane arrays are gone from here on, count and workers stay for the stats
+    shared = NULL;
+    control = NULL;
+}
+
+#else
+
+int gbLanesInit(const char *romPath, int count, int workers) { (void)romPath; (void)count; (void)workers; printf("Lanes aren't supported on this platform\n"); return -1; }
+int gbLanesStep(int frames) { (void)frames; return -1; }
+void gbLanesClose() {}
+
+#endif
+
+void printLanesStats() {
+    if (steps == 0) return;
+    double seconds = (double)stepTicks / SDL_GetPerformanceFrequency();
+    printf("Lanes: %d lanes on %d workers, %llu steps, %.1f M instructions/s total, %.2f M per lane\n",
+        lanes.count, lanes.workers, (unsigned long long)steps, stepInstructions / seconds / 1e6,
+        stepInstructions / seconds / 1e6 / lanes.count);
+}
+
+//Same buttons for a lane in both runs, different across lanes so they don't all do the same thing
+static uint8_t laneButtons(int lane, int step) {
+    return (uint8_t)(((step + lane) / 8 & 1 ? GB_BUTTON_RIGHT : 0) | ((step * 3 + lane) / 16 & 1 ? GB_BUTTON_A : 0));
+}
+
+static uint32_t laneSum(const uint8_t *framebuffer, uint64_t cycles) { //FNV-1a of the frame and the cycle count
+    uint32_t sum = 2166136261u;
+    for (int i = 0; i < 144 * 160; i++) sum = (sum ^ framebuffer[i]) * 16777619u;
+    for (int i = 0; i < 8; i++) sum = (sum ^ (uint8_t)(cycles >> (i * 8))) * 16777619u;
+    return sum;
+}
+
+//`count` scalar instances of the ROM one after another on this thread, then the same as `count` lanes on one
+//worker (the same single core, plus the savestate swaps) and on one worker per CPU. Every lane has to end
+//with the frame and cycle count its scalar run did
+int compareLanes(const char *romPath, int count, int frames) {
+    if (count < 1 || count > LANES_MAX) {
+        printf("Lane count has to be 1-%d\n", LANES_MAX);
+        return -1;
+    }
+    uint32_t *sums = malloc(sizeof(uint32_t) * count);
+    if (!sums || gbInit(romPath) != 0) {
+        free(sums);
+        return -1;
+    }
+
+    uint64_t instructions = 0;
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (int lane = 0; lane < count; lane++) {
+        gbReset();
+        uint64_t before = instructionsExecuted;
+        const GBObservation *obs = NULL;
+        for (int step = 0; step < frames; step++) obs = gbStep(laneButtons(lane, step), 1);
+        instructions += instructionsExecuted - before;
+        sums[lane] = laneSum(obs->framebuffer, obs->cycles);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("Scalar: %d instances one after another, %d frames each, %.1f M instructions/s total\n",
+        count, frames, instructions / seconds / 1e6);
+
+    int mismatched = 0;
+    int cpus = SDL_GetCPUCount();
+    for (int config = 0; config < 2; config++) {
+        int workers = config == 0 ? 1 : 0; //0 = one per CPU
+        if (config == 1 && (cpus <= 1 || count == 1)) break; //would be the same run again
+        if (gbLanesInit(romPath, count, workers) != 0) {
+            free(sums);
+            return -1;
+        }
+        for (int step = 0; step < frames; step++) {
+            for (int lane = 0; lane < count; lane++) lanes.buttons[lane] = laneButtons(lane, step);
+            gbLanesStep(1);
+        }
+        for (int lane = 0; lane < count; lane++) {
+            if (laneSum(&lanes.framebuffer[lane][0][0], lanes.cycles[lane]) != sums[lane]) mismatched++;
+        }
+        gbLanesClose();
+        printLanesStats();
+    }
+    free(sums);
+    if (mismatched) printf("Lanes: %d lane runs ended somewhere else than their scalar run\n", mismatched);
+    else printf("Lanes: every lane ended where its scalar run did\n");
+    return mismatched ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef LANES_H
+#define LANES_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+#include "gbapi.h"
+
+#define LANES_MAX 1024
+#define LANES_MAX_WORKERS 64
+
+//Many copies of one ROM stepped together, for training runs that want a whole batch per step.
+//The emulator is one machine per process, so lanes are spread over worker processes and a worker
+//with several lanes swaps them in and out as savestates. Inputs and observations are structure of
+//arrays in memory every process shares, lane i is index i in each of them. Nothing runs in SIMD
+//lockstep, every lane is the ordinary one instruction at a time interpreter.
+typedef struct {
+    int count; //lanes
+    int workers; //processes running them
+
+    //in, set before gbLanesStep
+    uint8_t *buttons; //GB_BUTTON_* bits per lane, held for the whole step
+    uint8_t *reset; //1 = lane goes back to power on before this step, cleared once done
+
+    //out, valid after gbLanesStep returns
+    uint8_t (*framebuffer)[144][160]; //last completed frame, colour indices 0-3
+    uint8_t (*wram)[0x2000];
+    uint8_t (*hram)[0x7F];
+    uint8_t (*io)[0x80];
+    uint64_t *cycles;
+    uint32_t *frame;
+    uint8_t *lagFrame;
+    uint64_t *instructions; //executed since power on, for throughput numbers
+} GBLanes;
+
+extern GBLanes lanes;
+
+int gbLanesInit(const char *romPath, int count, int workers); //workers 0 = one per CPU, 0 on success
+int gbLanesStep(int frames); //every lane runs `frames` VBlanks, returns once all of them are done
+void gbLanesClose();
+void printLanesStats();
+int compareLanes(const char *romPath, int count, int frames); //--lanes, scalar instances against lanes, 0 if they ended the same
+
+#endif
@@ -12,31 +12,324 @@
 #include "memory.h"
 #include "input.h"
 #include "ppu.h"
+#include "present.h"
+#include "timer.h"
+#include "serial.h"
+#include "testrom.h"
+#include "savestate.h"
+#include "movie.h"
+#include "apu.h"
+#include "audio.h"
+#include "pace.h"
+#include "rtc.h"
+#include "sram.h"
+#include "debugger.h"
+#include "disasm.h"
+#include "symbols.h"
+#include "trace.h"
+#include "hud.h"
+#include "heatmap.h"
+#include "lanes.h"
 
 FILE *logFile = NULL; //for debugging
 
-int main(){
+static int isPaused = 0;
+static double baseSpeed = 1.0; //--speed, what releasing the turbo key goes back to
+
+//Drains the host's events, joypad keys go into the input queue. Returns 0 when the window was closed
+static int pollHostEvents(const char *stateName) {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE
+            && heat.window && event.window.windowID == SDL_GetWindowID(heat.window)) {
+            SDL_HideWindow(heat.window); //just the heatmap, the game carries on
+            continue;
+        }
+        if (event.type == SDL_QUIT || (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE)) { //with two windows open closing one doesn't quit
+            printf("Exiting emulator...\n");
+            getchar();
+            return 0; //close emulator loop and exit
+        }
+
+        if (event.key.keysym.sym == SDLK_TAB && !event.key.repeat) { //turbo while held
+            if (event.type == SDL_KEYDOWN) setPaceSpeed(0);
+            else if (event.type == SDL_KEYUP) setPaceSpeed(baseSpeed);
+        }
+
+        if (event.type == SDL_KEYDOWN) {
+            switch (event.key.keysym.sym) {
+                case SDLK_SPACE: // Toggle pause
+                    isPaused = !isPaused;
+                    break;
+                case SDLK_n: // Step one instruction
+                    if (isPaused) {
+                        debugStep(1);
+                        isPaused = 0; //runs until the debugger stops it again
+                    }
+                    break;
+                case SDLK_o: // Step over a call
+                    if (isPaused) {
+                        debugStepOver();
+                        isPaused = 0;
+                    }
+                    break;
+                case SDLK_u: // Step out of the current function
+                    if (isPaused) {
+                        debugStepOut();
+                        isPaused = 0;
+                    }
+                    break;
+                case SDLK_b: // Break into the debugger console in the terminal
+                    debugBreak();
+                    isPaused = 0;
+                    break;
+                case SDLK_F1: // Performance overlay
+                    toggleHud();
+                    break;
+                case SDLK_F5: // Save state
+                    saveStateFile(stateName);
+                    break;
+                case SDLK_F8: // Load state, not while a movie is going, it would break it
+                    if (movie.mode == MOVIE_NONE) loadStateFile(stateName);
+                    break;
+            }
+        }
+
+        if (movie.mode != MOVIE_PLAY) handleButtonPress(&event); //movie owns the joypad while it plays
+    }
+    return 1;
+}
+
+int main(int argc, char **argv){
+    const char *romPath = "Tetris.gb";
+    int headless = 0; //no window or input, for running test ROMs
+    uint64_t maxCycles = 0; //0 = no limit
+    LinkTransport linkTransport = LINK_NONE;
+    int linkHost = 0;
+    const char *linkName = NULL;
+    const char *recordPath = NULL;
+    const char *playPath = NULL;
+    const char *statePath = NULL; //--load-state, loaded before the first cycle
+    long seekFrame = -1;
+    const char *breakpoints[32]; //--break, set once the ROM is mapped so bare addresses find their bank
+    int breakpointCount = 0;
+    const char *symPath = NULL; //--sym, otherwise the ROM's own .sym when there is one
+    int disasmBank = -1; //--disasm, prints a ROM bank and exits
+    const char *tracePath = NULL; //--trace, every instruction to a binary file
+    int traceRing = 0; //--trace-ring, only the last ones in memory for the invalid opcode dump
+    int showHud = 0; //--hud, overlay on from the start, F1 toggles it either way
+    const char *hudFont = NULL; //--hud-font
+    const char *telemetryPath = NULL; //--telemetry, same counters as the overlay, .csv or JSON lines
+    int heatmapWindow = 0; //--heatmap, live per page access window, needs a -DHEATMAP build
+    const char *heatmapDump = NULL; //--heatmap-dump, per frame page counts as CSV
+    const char *heatmapFrames = NULL; //--heatmap-frames FIRST-LAST, which frames go into the dump
+    int laneCount = 0; //--lanes, scalar instances against lanes and exits
+    int renderThreads = 0; //--render-threads, >0 only times mode 3 and draws the recorded scanlines on this many threads at VBlank
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--max-cycles") == 0) {
+            maxCycles = strtoull(argv[++i], NULL, 10);
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--record") == 0) {
+            recordPath = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--play") == 0) {
+            playPath = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--seek") == 0) {
+            seekFrame = strtol(argv[++i], NULL, 10);
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--speed") == 0) {
+            baseSpeed = strtod(argv[++i], NULL); //0 = as fast as it goes
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--load-state") == 0) {
+            statePath = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--break") == 0) {
+            if (breakpointCount < 32) breakpoints[breakpointCount++] = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--sym") == 0) {
+            symPath = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--disasm") == 0) {
+            disasmBank = (int)strtol(argv[++i], NULL, 16);
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--trace") == 0) {
+            tracePath = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--trace-ring") == 0) {
+            traceRing = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--hud") == 0) {
+            showHud = 1;
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--hud-font") == 0) {
+            hudFont = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--telemetry") == 0) {
+            telemetryPath = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--heatmap") == 0) {
+            heatmapWindow = 1;
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--heatmap-dump") == 0) {
+            heatmapDump = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--heatmap-frames") == 0) {
+            heatmapFrames = argv[++i];
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--lanes") == 0) {
+            laneCount = atoi(argv[++i]);
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--render-threads") == 0) {
+            renderThreads = atoi(argv[++i]);
+            continue;
+        }
+        if (i + 1 < argc && strcmp(argv[i], "--decode-trace") == 0) { //offline, prints gameboy-doctor lines and exits
+            return decodeTrace(argv[++i], stdout) == 0 ? 0 : 1;
+        }
+        if (argv[i][0] != '-') {
+            romPath = argv[i];
+            continue;
+        }
+        if (i + 1 < argc && (strcmp(argv[i], "--link-host") == 0 || strcmp(argv[i], "--link-join") == 0)) {
+            linkTransport = LINK_SOCKET; //Unix socket path
+            linkHost = strcmp(argv[i], "--link-host") == 0;
+            linkName = argv[++i];
+        }
+        else if (i + 1 < argc && (strcmp(argv[i], "--link-shm-host") == 0 || strcmp(argv[i], "--link-shm-join") == 0)) {
+            linkTransport = LINK_SHM; //shared memory name
+            linkHost = strcmp(argv[i], "--link-shm-host") == 0;
+            linkName = argv[++i];
+        }
+        else {
+            printf("Usage: %s [rom.gb] [--headless] [--max-cycles N] [--link-host|--link-join SOCKET] [--link-shm-host|--link-shm-join NAME] [--load-state FILE] [--speed N] [--render-threads N] [--break [BANK:]ADDR] [--sym FILE] [--disasm BANK] [--lanes N] [--trace FILE|--trace-ring] [--decode-trace FILE] [--hud] [--hud-font FILE] [--telemetry FILE] [--heatmap] [--heatmap-dump FILE [--heatmap-frames FIRST-LAST]] [--record MOVIE] [--play MOVIE [--seek FRAME]]\n", argv[0]);
+            return 1;
+        }
+    }
+
     int div_counter = 0;
     int tima_counter = 0;
 
-    SDL_Init(SDL_INIT_VIDEO);
-    if (TTF_Init() < 0) {
-    printf("Failed to initialize SDL_ttf: %s\n", TTF_GetError());
-    return 1;
+    char romName[256]; //ROM path without the extension, the .sav goes next to it
+    snprintf(romName, sizeof(romName), "%s", romPath);
+    char *dot = strrchr(romName, '.');
+    char *slash = strrchr(romName, '/');
+    if (dot && (!slash || dot > slash)) *dot = 0;
+    char stateName[264]; //F5 saves here, F8 loads it
+    snprintf(stateName, sizeof(stateName), "%s.state", romName);
+    char symName[264];
+    snprintf(symName, sizeof(symName), "%s.sym", romName);
+    if (symPath) {
+        if (loadSymbols(symPath) != 0) {
+            perror("Failed to open symbol file");
+            return 1;
+        }
+    } else {
+        loadSymbols(symName); //RGBDS puts it next to the ROM, fine if it isn't there
+    }
+
+    if (laneCount > 0) return compareLanes(romPath, laneCount, 300) == 0 ? 0 : 1; //300 frames per instance, nothing else runs
+
+    if (disasmBank >= 0) { //no emulation, just the bank as text
+        initMemory();
+        loadROM(romPath);
+        long banks = memory.romSize / 0x4000;
+        if (disasmBank >= banks) {
+            printf("ROM only has %ld banks\n", banks);
+            return 1;
+        }
+        char *text = malloc((size_t)0x4000 * DISASM_LINE_MAX);
+        if (!text) return 1;
+        memset(text, 0, (size_t)0x4000 * DISASM_LINE_MAX); //fault the pages in and build the tables first, so only the dump gets timed
+        opcodeInfo(0, 0);
+        uint64_t start = SDL_GetPerformanceCounter();
+        size_t length = disassembleRange(&memory.cartridge[disasmBank * 0x4000], 0x4000, disasmBank ? 0x4000 : 0, disasmBank, text);
+        double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        fwrite(text, 1, length, stdout);
+        fprintf(stderr, "Bank %02X: 16 KB to %zu KB of text in %.3f ms, %.0f MB/s of ROM\n", disasmBank, length / 1024, seconds * 1000, 0x4000 / seconds / 1e6);
+        free(text);
+        return 0;
     }
 
-    SDL_Window *window = SDL_CreateWindow("GB-EMU", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800, 720, 0); //window width and height 160x144
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED); //default driver gpu accelerated if possible
+    SDL_Window *window = NULL;
+    if (headless) {
+        SDL_Init(0); //threads and timers only
+    }
+    else {
+        SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+        if (TTF_Init() < 0) {
+        printf("Failed to initialize SDL_ttf: %s\n", TTF_GetError());
+        return 1;
+        }
+
+        window = SDL_CreateWindow("GB-EMU", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800, 720, 0); //window width and height 160x144
+    }
 
     initMemory();
-    loadROM("Tetris.gb"); //initialises  memory in this function as well
+    loadROM(romPath); //initialises  memory in this function as well
     updateERAMMapping();
-    loadSRAM("Tetris");
+    initRTC();
+    loadSRAM(romName); //RTC footer included
     initCPU();
+    initInput();
+    initTimer();
+    initSerial();
+    initAPU();
+    initTestDetection();
+    if (linkTransport != LINK_NONE) {
+        if (linkHost) hostLink(linkTransport, linkName);
+        else joinLink(linkTransport, linkName);
+    }
     initPPU();
+    setDeferredRendering(renderThreads);
+    initPresent();
+    initMovie();
+    if (!playPath && openSRAM(romName) != 0) return 1; //a movie brings its own battery RAM, the real .sav stays as it is
+    if (statePath && loadStateFile(statePath) != 0) return 1;
+    for (int i = 0; i < breakpointCount; i++) {
+        if (setBreakpoint(breakpoints[i], 1) != 0) return 1;
+    }
+    if ((tracePath || traceRing) && startTrace(tracePath) != 0) return 1;
+    if (playPath) {
+        if (startPlayback(playPath) != 0) return 1;
+        if (seekFrame > 0 && seekMovie(seekFrame) != 0) return 1;
+    }
+    else if (recordPath && startRecording(recordPath, statePath == NULL) != 0) return 1;
+    if (initHud(telemetryPath, hudFont, showHud && !headless) != 0) return 1;
+    SDL_Window *heatWindow = NULL;
+    if (heatmapWindow && !headless) { //sized once the ROM's bank count is known
+        heatWindow = SDL_CreateWindow("GB-EMU heatmap", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, HEAT_ROW * HEAT_SCALE, HEAT_SCALE, 0);
+    }
+    if ((heatWindow || heatmapDump) && startHeatmap(heatmapDump, heatmapFrames, heatWindow) != 0) return 1;
     printromHeader();
-    printf("Press Enter to start...\n");
-    getchar();
+    if (!headless) {
+        printf("Press Enter to start...\n");
+        getchar();
+        startPresentThread(window); //renderer lives on its own thread so vsync never stalls emulation
+        setAudioOutput(startAudio(48000)); //headless runs never make samples
+    }
 
     logFile = fopen("emu_log.txt", "w"); //debug file
     if (!logFile) {
@@ -45,114 +338,102 @@ int main(){
     }
 
     int open = 1;
-    SDL_Event event;
-    int overflowFlag = -1;
-    uint8_t serialByte;
-    int serialCounter = 0;
-    int serialInProgress = 0;
-    int isPaused = 0;
-    int stepMode = 0;
-    uint16_t divInternal = 0;
-    uint16_t prev_div = 0;
     int realCyclesAccumulated = 0;
+    initPace(); //headless runs never wait on it
+    setPaceSpeed(baseSpeed);
+    uint32_t titleSeq = 0;
 
     while(open) {
 
-            if (!isPaused || stepMode) {
-                //fprintf(logFile, "PC: %04X, Opcode: %02X, Cycles: %d, SP: %04X, A: %02X, B: %02X, C: %02X, D: %02X, E: %02X, F: %02X, H: %02X, L: %02X, FF80: %02X, FF85: %02X, FF00: %02X, FFFF: %02X, FF0F: %02X, FF40: %02X, FF41: %02X, FF44: %02X, FF45: %02X\n", CPUreg.PC, *memory.memoryMap[CPUreg.PC], realCyclesAccumulated, CPUreg.SP, CPUreg.af.A, CPUreg.bc.B, CPUreg.bc.C, CPUreg.de.D, CPUreg.de.E, CPUreg.af.F, CPUreg.hl.H, CPUreg.hl.L, *memory.memoryMap[0xFF80], *memory.memoryMap[0xFF85], *memory.memoryMap[0xFF00], *memory.memoryMap[0xFFFF], *memory.memoryMap[0xFF0F], *memory.memoryMap[0xFF40], *memory.memoryMap[0xFF41], *memory.memoryMap[0xFF44], *memory.memoryMap[0xFF45]);
-                stepCPU();
-                stepPPU(renderer);     
-                //fprintf(logFile, "xPos: %02X, LY: %02X, scx: %02X,BGFetchStage: %d, windowFetchMode %d, wy %02X, wx %02X, LCDC: %02X, BGFifoCount: %d \n  ", ppu.xPos, *memory.memoryMap[0xFF44], *memory.memoryMap[0xFF43], ppu.fetchStage.BGFetchStage, ppu.fetchStage.windowFetchMode, *memory.memoryMap[0xFF4A], *memory.memoryMap[0xFF4B], *memory.memoryMap[0xFF40], ppu.BGFifo.count);
-
-                //Serial communication
-
-                if (!serialInProgress && (*memory.memoryMap[0xFF02] & 0x80)) {
-                    // Start transfer
-                    serialInProgress = 1;
-                    serialCounter = 1024;
-                    serialByte = *memory.memoryMap[0xFF01];
+            if (!isPaused) {
+                stepSystem(); //CPU, then PPU/serial/timer if they're due
+                if (debugger.stopped) { //breakpoint or a finished step, the CPU stopped in front of an instruction
+                    debugger.stopped = 0;
+                    int action = debugConsole();
+                    if (action == DEBUG_QUIT) open = 0;
+                    isPaused = action == DEBUG_PAUSE && !headless; //headless has no window to sit paused in
+                    continue;
                 }
+                //fprintf(logFile, "xPos: %02X, LY: %02X, scx: %02X,BGFetchStage: %d, windowFetchMode %d, wy %02X, wx %02X, LCDC: %02X, BGFifoCount: %d \n  ", ppu.xPos, *memory.memoryMap[0xFF44], *memory.memoryMap[0xFF43], ppu.fetchStage.BGFetchStage, ppu.fetchStage.windowFetchMode, *memory.memoryMap[0xFF4A], *memory.memoryMap[0xFF4B], *memory.memoryMap[0xFF40], ppu.BGFifo.count);
 
-                if (serialInProgress) {
-                    serialCounter--;
-                    //*memoryMap[0xFF02] |= 0x80; // Set SC bit to indicate transfer in progress
-                    if (serialCounter == 0) {
-                        // Transfer complete
-                        *memory.memoryMap[0xFF01] = 0xFF;   // echo back
-                        *memory.memoryMap[0xFF02] &= ~0x80;       // clear SC
-                        //*memoryMap[0xFF0F] |= 0x08;        // request serial interrupt
-                        //don't request interrupt since no link cable support yet in this emulator
-                        printf("%c", serialByte);          // optional
-                        fflush(stdout);
-                        serialInProgress = 0;
-                    }
-                }
-
-                // Timer and DIV handling
-                divInternal++; // increment by 1 CPU cycle
-                *memory.memoryMap[0xFF04] = divInternal >> 8; // upper 8 bits visible as DIV
-
-                uint8_t tac = *memory.memoryMap[0xFF07];
-                if (tac & 0x04) { // Timer enabled
-                    // Which DIV bit triggers TIMA, not actually done by cycles elapsed but monitoring DIV bits
-                    const uint8_t timerBit[4] = {9, 3, 5, 7};
-                    uint16_t mask = 1 << timerBit[tac & 0x03];
+                if (systemCycles >= movie.nextEventCycle) stepMovie(); //movie inputs and frame boundaries
 
-                    // Check for rising edge of the relevant DIV bit
-                    if ((prev_div & mask) != 0 && (divInternal & mask) == 0) { //check if relevant bit changed from 1 to 0 (falling edge)
-                        if (++(*memory.memoryMap[0xFF05]) == 0) { // TIMA overflow
-                            overflowFlag = 4; // 4 CPU cycles delay for TIMA reload
+                if (systemCycles >= input.nextPollCycle) { //host events once per frame of emulated time instead of every few cycles
+                    hud.unit = HUD_HOST; //timed below, the sampler leaves it out
+                    if (!headless) {
+                        paceFrame(); //real time speed, sleeps off whatever is left of the frame
+                        if (pace.speedSeq != titleSeq) {
+                            char title[64];
+                            snprintf(title, sizeof(title), "GB-EMU - %.2fx", pace.achievedSpeed);
+                            SDL_SetWindowTitle(window, title);
+                            titleSeq = pace.speedSeq;
                         }
                     }
-                }
-                prev_div = divInternal;
-
-                // Handle TIMA reload and interrupt
-                if (overflowFlag > 0) {
-                    overflowFlag--; 
-                    *memory.memoryMap[0xFF05] = 0; // keep TIMA at 0 for 4 cycle period
-                    if (overflowFlag == 0) {
-                        *memory.memoryMap[0xFF05] = *memory.memoryMap[0xFF06]; // Reload TIMA from TMA
-                        *memory.memoryMap[0xFF0F] |= 0x04;              // Request timer interrupt
-                    // printf("Timer interrrupt requested\n");
-                    }
+                    uint64_t inputStart = hudClock();
+                    if (!headless) open = pollHostEvents(stateName);
+                    applyQueuedInput(); //keys land on this cycle no matter how fast the host is running
+                    hud.inputNs += hudClock() - inputStart;
+                    stepSRAM(); //dirty battery RAM pages go to the writer once the game stops writing
+                    hudFrame(); //overlay and telemetry numbers
+                    heatFrame(); //per page access counts, nothing unless they were asked for
+                    if (headless) sumFrame(); //polls come once a frame, so this sees every frame for tests/run.sh to compare
+                    hud.unit = HUD_CPU;
                 }
 
-                if (stepMode) stepMode = 0;
+                if (headless && (test.status != TEST_RUNNING || movie.finished || (maxCycles && systemCycles >= maxCycles))) {
+                    open = 0; //stop the moment the test ROM reports, no fixed cycle budget needed
+                }
                 
             } //end of pause
-            realCyclesAccumulated++;
-    if(realCyclesAccumulated % (16) == 0){
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                saveSRAM("Tetris");
-                printf("Exiting emulator...\n");
-                getchar();
-                open = 0; //close emulator loop and exit
-                break;
-            }
-
-            if (event.type == SDL_KEYDOWN) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_SPACE: // Toggle pause
-                        isPaused = !isPaused;
-                        break;
-                    case SDLK_n: // Step through instruction
-                        if (isPaused) stepMode = 1;
-                        break;
-                }
+            else {
+                SDL_WaitEventTimeout(NULL, 10); //paused, sleep until the host has something instead of spinning
+                stepSRAM();
+                open = pollHostEvents(stateName);
             }
-
-            handleButtonPress(&event);
-            }
-    }
+            realCyclesAccumulated++;
         } //end of while open
 
             
 
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    stopMovie(); //before anything else, the end state gets hashed into the file
+    closeSRAM(); //last dirty pages and the RTC
+    finishStateWrites(); //an F5 right before quitting still lands
+    stopTrace(); //whatever is still in the ring goes to the file
+    stopHud();
+    stopHeatmap(); //last frames of an open ended dump
+    flushSerialEcho(); //last line may not have ended in a newline
+    stopPresentThread();
+    stopAudio();
+    printPresentStats();
+    printRenderStats();
+    closeLink();
+    printLinkStats();
+    printMovieStats();
+    printInputStats();
+    printSRAMStats();
+    printStateStats();
+    printTraceStats();
+    printHudStats();
+    printHeatmapStats();
+    if (!headless) printPaceStats();
+    printAPUStats();
+    printAudioStats();
+    printf("PPU ran on %llu of %llu cycles, halted CPU skipped %llu\n", (unsigned long long)ppu.activeCycles,
+        (unsigned long long)systemCycles, (unsigned long long)haltSkippedCycles);
+    setDeferredRendering(0); //joins the scanline workers
+    if (window) SDL_DestroyWindow(window);
+    if (heatWindow) SDL_DestroyWindow(heatWindow);
     SDL_Quit();
 
+    if (headless && playPath) return movie.desynced ? 1 : 0;
+    if (headless) {
+        if (test.status == TEST_RUNNING) {
+            printf("\nTest timed out after %llu cycles\n", (unsigned long long)systemCycles);
+            return 2;
+        }
+        printf("\nTest %s after %llu cycles (%s)\n", test.status == TEST_PASSED ? "passed" : "failed",
+            (unsigned long long)test.endCycle, test.source);
+        return test.status == TEST_PASSED ? 0 : 1;
+    }
     return 0;
 }
\ No newline at end of file
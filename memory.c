@@ -1,4 +1,5 @@
 #include "memory.h"
+#include "rtc.h"
 
 MemoryState memory;
 
@@ -227,24 +228,14 @@ void printromHeader() { // for debug
     printf("Global Checksum: 0x%02X%02X\n", *memory.memoryMap[0x014E], *memory.memoryMap[0x014F]);
 }
 
-void saveSRAM(const char *romname) {
-    if (memory.totalRamBanks == 0) return; // no SRAM
-    char savename[256];
-    snprintf(savename, sizeof(savename), "%s.sav", romname);
-    FILE *f = fopen(savename, "wb");
-    if (f) {
-        fwrite(memory.eram, 1, memory.totalRamBanks * 0x2000, f);
-        fclose(f);
-    }
-}
-
 void loadSRAM(const char *romname) {
-    if (memory.totalRamBanks == 0) return;
+    if (memory.totalRamBanks == 0 && !rtc.present) return;
     char savename[256];
     snprintf(savename, sizeof(savename), "%s.sav", romname);
     FILE *f = fopen(savename, "rb");
     if (f) {
         fread(memory.eram, 1, memory.totalRamBanks * 0x2000, f);
+        loadRTCFooter(f);
         fclose(f);
     }
 }
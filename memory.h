@@ -37,7 +37,6 @@ void initMemory();
 void loadROM(const char *path);
 void updateERAMMapping();
 void printromHeader();
-void saveSRAM(const char *romname);
 void loadSRAM(const char *romname);
 
 #endif
\ No newline at end of file
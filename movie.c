@@ -0,0 +1,336 @@
+#include "movie.h"
+#include "cpu.h"
+#include "memory.h"
+#include "input.h"
+#include "ppu.h"
+
+MovieState movie;
+
+//File layout, all little endian:
+//  header   magic, version, flags, frames, length, lag frames, end hash, ROM checksum, input count, snapshot count
+//  inputs   per change: cycles since the previous change as a varint, then the button byte
+//  snapshots per snapshot: frame, lag frames so far, packed size, packState stream of the SaveState
+
+static void putU16(FILE *f, uint16_t v) { fputc(v & 0xFF, f); fputc(v >> 8, f); }
+static void putU32(FILE *f, uint32_t v) { putU16(f, v & 0xFFFF); putU16(f, v >> 16); }
+static void putU64(FILE *f, uint64_t v) { putU32(f, (uint32_t)v); putU32(f, (uint32_t)(v >> 32)); }
+
+static void putVarint(FILE *f, uint64_t v) { //7 bits a byte, most changes are a few thousand cycles apart so 2-3 bytes
+    while (v >= 0x80) {
+        fputc((v & 0x7F) | 0x80, f);
+        v >>= 7;
+    }
+    fputc((int)v, f);
+}
+
+static int readFailed; //set by any get that hits the end of the file
+
+static uint8_t getU8(FILE *f) {
+    int c = fgetc(f);
+    if (c == EOF) {
+        readFailed = 1;
+        return 0;
+    }
+    return (uint8_t)c;
+}
+static uint16_t getU16(FILE *f) { uint16_t lo = getU8(f); return lo | (getU8(f) << 8); }
+static uint32_t getU32(FILE *f) { uint32_t lo = getU16(f); return lo | ((uint32_t)getU16(f) << 16); }
+static uint64_t getU64(FILE *f) { uint64_t lo = getU32(f); return lo | ((uint64_t)getU32(f) << 32); }
+
+static uint64_t getVarint(FILE *f) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && !readFailed; shift += 7) {
+        uint8_t b = getU8(f);
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) break;
+    }
+    return v;
+}
+
+static void freeMovie() {
+    for (int i = 0; i < movie.snapshotCount; i++) free(movie.snapshots[i].packed);
+    free(movie.snapshots);
+    free(movie.inputs);
+    memset(&movie, 0, sizeof(movie));
+    movie.nextEventCycle = UINT64_MAX;
+}
+
+void initMovie() {
+    memset(&movie, 0, sizeof(movie));
+    movie.nextEventCycle = UINT64_MAX;
+}
+
+static void scheduleMovie() {
+    movie.nextEventCycle = movie.nextFrameCycle;
+    if (movie.mode != MOVIE_PLAY) return;
+    if (movie.nextInput < movie.inputCount && movie.startCycle + movie.inputs[movie.nextInput].cycle < movie.nextEventCycle) {
+        movie.nextEventCycle = movie.startCycle + movie.inputs[movie.nextInput].cycle;
+    }
+    if (movie.startCycle + movie.length < movie.nextEventCycle) movie.nextEventCycle = movie.startCycle + movie.length;
+}
+
+static int addSnapshot() {
+    if (movie.snapshotCount == movie.snapshotCapacity) {
+        int capacity = movie.snapshotCapacity ? movie.snapshotCapacity * 2 : 16;
+        MovieSnapshot *grown = realloc(movie.snapshots, capacity * sizeof(MovieSnapshot));
+        if (!grown) return -1;
+        movie.snapshots = grown;
+        movie.snapshotCapacity = capacity;
+    }
+    SaveState *state = malloc(sizeof(SaveState)); //kept packed, raw they add up to tens of MB an hour
+    uint8_t *packed = malloc(PACK_BOUND(sizeof(SaveState)));
+    if (!state || !packed) {
+        free(state);
+        free(packed);
+        return -1;
+    }
+    captureState(state);
+    size_t packedSize = packState((const uint8_t *)state, sizeof(SaveState), packed);
+    free(state);
+    uint8_t *shrunk = realloc(packed, packedSize);
+    MovieSnapshot *snap = &movie.snapshots[movie.snapshotCount++];
+    snap->frame = movie.frame;
+    snap->lagFrames = movie.lagFrames;
+    snap->packed = shrunk ? shrunk : packed;
+    snap->packedSize = (uint32_t)packedSize;
+    return 0;
+}
+
+//FNV-1a over what the player can see and what the game will do next, two runs that match here are in step
+uint64_t machineHash() {
+    uint64_t hash = 1469598103934665603ull;
+    #define HASH_BYTES(ptr, len) for (size_t i = 0; i < (size_t)(len); i++) { hash ^= ((const uint8_t *)(ptr))[i]; hash *= 1099511628211ull; }
+    uint16_t regs[6] = {CPUreg.af.AF, CPUreg.bc.BC, CPUreg.de.DE, CPUreg.hl.HL, CPUreg.SP, CPUreg.PC};
+    HASH_BYTES(regs, sizeof(regs));
+    HASH_BYTES(&systemCycles, sizeof(systemCycles));
+    HASH_BYTES(getFramebuffer(NULL), 160 * 144);
+    HASH_BYTES(memory.vram, sizeof(memory.vram));
+    HASH_BYTES(memory.wram, sizeof(memory.wram));
+    HASH_BYTES(memory.eram, memory.totalRamBanks * 0x2000);
+    HASH_BYTES(memory.oam, sizeof(memory.oam));
+    HASH_BYTES(memory.hram, sizeof(memory.hram));
+    HASH_BYTES(memory.io, sizeof(memory.io));
+    #undef HASH_BYTES
+    return hash;
+}
+
+int startRecording(const char *path, int fromPowerOn) {
+    freeMovie();
+    snprintf(movie.path, sizeof(movie.path), "%s", path);
+    movie.fromPowerOn = fromPowerOn;
+    movie.startCycle = systemCycles;
+    movie.nextFrameCycle = systemCycles + MOVIE_FRAME_CYCLES;
+    input.polled = 0;
+    if (addSnapshot() != 0) { //the start, power on included so .sav contents and all come along
+        freeMovie();
+        return -1;
+    }
+    movie.mode = MOVIE_RECORD;
+    scheduleMovie();
+    printf("Recording movie to %s\n", path);
+    return 0;
+}
+
+void recordMovieInput(uint8_t buttons) {
+    if (movie.inputCount == movie.inputCapacity) {
+        int capacity = movie.inputCapacity ? movie.inputCapacity * 2 : 256;
+        MovieInput *grown = realloc(movie.inputs, capacity * sizeof(MovieInput));
+        if (!grown) return;
+        movie.inputs = grown;
+        movie.inputCapacity = capacity;
+    }
+    movie.inputs[movie.inputCount].cycle = systemCycles - movie.startCycle;
+    movie.inputs[movie.inputCount].buttons = buttons;
+    movie.inputCount++;
+}
+
+static int writeMovie() {
+    FILE *f = fopen(movie.path, "wb");
+    if (!f) {
+        perror("Failed to write movie");
+        return -1;
+    }
+    putU32(f, MOVIE_MAGIC);
+    putU32(f, MOVIE_VERSION);
+    putU32(f, movie.fromPowerOn ? 1 : 0);
+    putU32(f, movie.frame);
+    putU64(f, movie.length);
+    putU32(f, movie.lagFrames);
+    putU64(f, movie.recordedHash);
+    putU16(f, romChecksum());
+    putU32(f, movie.inputCount);
+    putU32(f, movie.snapshotCount);
+
+    uint64_t previous = 0;
+    for (int i = 0; i < movie.inputCount; i++) {
+        putVarint(f, movie.inputs[i].cycle - previous);
+        fputc(movie.inputs[i].buttons, f);
+        previous = movie.inputs[i].cycle;
+    }
+    for (int i = 0; i < movie.snapshotCount; i++) {
+        putU32(f, movie.snapshots[i].frame);
+        putU32(f, movie.snapshots[i].lagFrames);
+        putU32(f, movie.snapshots[i].packedSize);
+        fwrite(movie.snapshots[i].packed, 1, movie.snapshots[i].packedSize, f);
+    }
+    int failed = ferror(f);
+    fclose(f);
+    return failed ? -1 : 0;
+}
+
+int startPlayback(const char *path) {
+    freeMovie();
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("Failed to open movie");
+        return -1;
+    }
+    readFailed = 0;
+    if (getU32(f) != MOVIE_MAGIC || getU32(f) != MOVIE_VERSION) {
+        printf("%s is not a movie from this version of the emulator\n", path);
+        fclose(f);
+        return -1;
+    }
+    snprintf(movie.path, sizeof(movie.path), "%s", path);
+    movie.fromPowerOn = getU32(f) & 1;
+    getU32(f); //frame count, only there for tools
+    movie.length = getU64(f);
+    movie.recordedLagFrames = getU32(f);
+    movie.recordedHash = getU64(f);
+    getU16(f); //ROM checksum, restoring the start snapshot checks it
+    uint32_t inputCount = getU32(f);
+    uint32_t snapshotCount = getU32(f);
+
+    movie.inputs = malloc((inputCount ? inputCount : 1) * sizeof(MovieInput));
+    movie.snapshots = calloc(snapshotCount ? snapshotCount : 1, sizeof(MovieSnapshot));
+    if (!movie.inputs || !movie.snapshots) readFailed = 1;
+
+    uint64_t cycle = 0;
+    for (uint32_t i = 0; i < inputCount && !readFailed; i++) {
+        cycle += getVarint(f);
+        movie.inputs[i].cycle = cycle;
+        movie.inputs[i].buttons = getU8(f);
+        movie.inputCount++;
+    }
+    for (uint32_t i = 0; i < snapshotCount && !readFailed; i++) {
+        movie.snapshots[i].frame = getU32(f);
+        movie.snapshots[i].lagFrames = getU32(f);
+        uint32_t packedSize = getU32(f);
+        if (readFailed || packedSize == 0 || packedSize > PACK_BOUND(sizeof(SaveState))) {
+            readFailed = 1;
+            break;
+        }
+        movie.snapshots[i].packed = malloc(packedSize);
+        movie.snapshots[i].packedSize = packedSize;
+        if (!movie.snapshots[i].packed || fread(movie.snapshots[i].packed, 1, packedSize, f) != packedSize) {
+            free(movie.snapshots[i].packed);
+            readFailed = 1;
+            break;
+        }
+        movie.snapshotCount++;
+    }
+    fclose(f);
+
+    if (readFailed || movie.snapshotCount == 0 || movie.snapshots[0].frame != 0) {
+        printf("Movie %s is truncated\n", path);
+        freeMovie();
+        return -1;
+    }
+
+    movie.mode = MOVIE_PLAY;
+    if (seekMovie(0) != 0) {
+        freeMovie();
+        return -1;
+    }
+    printf("Playing movie %s, %llu frames\n", path, (unsigned long long)(movie.length / MOVIE_FRAME_CYCLES));
+    return 0;
+}
+
+static void finishPlayback() {
+    movie.finished = 1;
+    movie.desynced = movie.lagFrames != movie.recordedLagFrames || machineHash() != movie.recordedHash;
+    printf("Movie finished after %u frames (%u lag), %s\n", movie.frame, movie.lagFrames,
+        movie.desynced ? "DESYNC, state differs from the recording" : "matches the recording");
+    movie.mode = MOVIE_NONE; //input goes back to the keyboard
+    movie.nextEventCycle = UINT64_MAX;
+}
+
+void stepMovie() {
+    if (systemCycles < movie.nextEventCycle) return;
+    uint64_t now = systemCycles - movie.startCycle;
+
+    if (movie.mode == MOVIE_PLAY) {
+        while (movie.nextInput < movie.inputCount && movie.inputs[movie.nextInput].cycle <= now) {
+            setButtonState(movie.inputs[movie.nextInput].buttons);
+            movie.nextInput++;
+        }
+    }
+
+    if (systemCycles >= movie.nextFrameCycle) {
+        if (!input.polled) movie.lagFrames++;
+        input.polled = 0;
+        movie.frame++;
+        movie.nextFrameCycle += MOVIE_FRAME_CYCLES;
+        if (movie.mode == MOVIE_RECORD && movie.frame % MOVIE_SNAPSHOT_INTERVAL == 0) addSnapshot();
+    }
+
+    if (movie.mode == MOVIE_PLAY && now >= movie.length) { //recording stopped at the end of this cycle
+        finishPlayback();
+        return;
+    }
+    scheduleMovie();
+}
+
+int seekMovie(uint32_t frame) {
+    if (movie.mode != MOVIE_PLAY) return -1;
+
+    int best = 0;
+    for (int i = 1; i < movie.snapshotCount; i++) {
+        if (movie.snapshots[i].frame <= frame) best = i;
+    }
+    SaveState *state = malloc(sizeof(SaveState));
+    if (!state) return -1;
+    const MovieSnapshot *snap = &movie.snapshots[best];
+    int failed = unpackState(snap->packed, snap->packedSize, (uint8_t *)state, sizeof(SaveState)) != 0;
+    if (failed) printf("Movie snapshot at frame %u is damaged\n", snap->frame);
+    else failed = restoreState(state) != 0;
+    free(state);
+    if (failed) return -1;
+
+    if (best == 0) movie.startCycle = systemCycles; //everything else is relative to where the movie began
+    movie.frame = movie.snapshots[best].frame;
+    movie.lagFrames = movie.snapshots[best].lagFrames;
+    movie.nextFrameCycle = movie.startCycle + (uint64_t)(movie.frame + 1) * MOVIE_FRAME_CYCLES;
+    movie.finished = 0;
+
+    //inputs logged on the snapshot's own cycle came in after it was taken
+    uint64_t now = systemCycles - movie.startCycle;
+    movie.nextInput = 0;
+    while (movie.nextInput < movie.inputCount && movie.inputs[movie.nextInput].cycle < now) movie.nextInput++;
+    movie.nextEventCycle = 0;
+    stepMovie();
+
+    while (movie.mode == MOVIE_PLAY && movie.frame < frame) { //flat out to the frame asked for
+        stepSystem();
+        if (systemCycles >= movie.nextEventCycle) stepMovie();
+    }
+    return 0;
+}
+
+void stopMovie() {
+    if (movie.mode == MOVIE_RECORD) {
+        movie.length = systemCycles - movie.startCycle;
+        movie.recordedHash = machineHash();
+        if (writeMovie() == 0) {
+            printf("Movie saved to %s: %u frames, %u lag, %d input changes, %d snapshots\n", movie.path,
+                movie.frame, movie.lagFrames, movie.inputCount, movie.snapshotCount);
+        }
+    }
+    movie.mode = MOVIE_NONE;
+    movie.nextEventCycle = UINT64_MAX;
+}
+
+void printMovieStats() {
+    if (movie.frame == 0) return;
+    printf("Movie: %u frames, %u lag frames (%.1f%%)\n", movie.frame, movie.lagFrames, 100.0 * movie.lagFrames / movie.frame);
+}
@@ -0,0 +1,74 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+#include "savestate.h"
+
+#define MOVIE_MAGIC 0x564D4247 //"GBMV"
+#define MOVIE_VERSION 2 //1 stored snapshots as raw SaveStates
+#define MOVIE_FRAME_CYCLES 70224 //movie frames are fixed slices of time, so they keep counting with the LCD off
+#define MOVIE_SNAPSHOT_INTERVAL 600 //frames between the savestates embedded for seeking
+
+typedef enum {
+    MOVIE_NONE,
+    MOVIE_RECORD,
+    MOVIE_PLAY
+} MovieMode;
+
+typedef struct {
+    uint64_t cycle; //cycles since the movie started
+    uint8_t buttons; //input.buttonState from the end of that cycle on
+} MovieInput;
+
+typedef struct {
+    uint32_t frame;
+    uint32_t lagFrames; //lag frames before this one
+    uint8_t *packed; //packState of the SaveState taken on the frame boundary, before that cycle's input
+    uint32_t packedSize;
+} MovieSnapshot;
+
+typedef struct {
+    MovieMode mode;
+    char path[256];
+    int fromPowerOn;
+
+    uint64_t startCycle; //systemCycles at frame 0
+    uint64_t length; //cycles the recording ran, playback stops here
+    uint32_t frame; //frames completed since the start
+    uint32_t lagFrames; //frames where the game never read FF00
+    uint64_t nextFrameCycle;
+    uint64_t nextEventCycle; //stepMovie has nothing to do before this
+
+    MovieInput *inputs;
+    int inputCount;
+    int inputCapacity;
+    int nextInput; //playback position
+
+    MovieSnapshot *snapshots; //snapshots[0] is always the start
+    int snapshotCount;
+    int snapshotCapacity;
+
+    //what the recording ended on, playback has to match it
+    uint32_t recordedLagFrames;
+    uint64_t recordedHash;
+    int finished;
+    int desynced;
+} MovieState;
+
+extern MovieState movie;
+
+void initMovie();
+int startRecording(const char *path, int fromPowerOn);
+int startPlayback(const char *path);
+void stopMovie(); //writes the file when recording
+void stepMovie();
+void recordMovieInput(uint8_t buttons);
+int seekMovie(uint32_t frame); //playback only, restores the closest snapshot and runs forward from it
+uint64_t machineHash();
+void printMovieStats();
+
+#endif
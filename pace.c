@@ -0,0 +1,167 @@
+#include "pace.h"
+#include "cpu.h"
+#include "apu.h"
+#include "audio.h"
+#include "ppu.h"
+#include "movie.h"
+#include <time.h>
+#include <SDL2/SDL.h> //performance counter and SDL_Delay to sleep off the frame
+
+#ifndef _WIN32
+#include <errno.h>
+#endif
+
+PaceState pace;
+
+#define PACE_FRAME_CYCLES 70224
+
+static uint64_t nowNs() {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+    return (uint64_t)((double)SDL_GetPerformanceCounter() * 1e9 / SDL_GetPerformanceFrequency());
+#endif
+}
+
+//Sleeps until the host clock reads `deadline`, the thread is idle the whole time
+static void sleepUntil(uint64_t deadline) {
+#ifndef _WIN32
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR); //absolute, so an interrupted sleep just goes again
+#else
+    uint64_t now = nowNs();
+    if (deadline > now) SDL_Delay((Uint32)((deadline - now) / 1000000)); //only ms resolution here
+#endif
+}
+
+void initPace() {
+    memset(&pace, 0, sizeof(pace));
+    pace.deadline = nowNs();
+    pace.frameStart = pace.deadline;
+    pace.lastCycle = systemCycles;
+    pace.audioFill = 1.0;
+    pace.speed = 1.0;
+    pace.lastDrawn = pace.deadline;
+    pace.windowStart = pace.deadline;
+    pace.windowCycle = systemCycles;
+}
+
+void setPaceSpeed(double speed) {
+    if (speed < 0) speed = 0;
+    if (speed == pace.speed) return;
+    int wasRealTime = pace.speed == 1.0;
+    pace.speed = speed;
+    pace.deadline = nowNs(); //new speed counts from here
+    if (audio.sampleRate && wasRealTime != (speed == 1.0)) { //sound only plays at real time, faster would just overrun the ring
+        setAudioOutput(speed == 1.0 ? audio.sampleRate : 0);
+        pace.audioFill = 1.0;
+    }
+}
+
+//With audio on the device's clock is the one that counts, the host clock only gets us close.
+//Bends the sample rate a little toward the target fill, and moves the deadline when the ring is way off it.
+static void paceAudio(uint64_t now) {
+    int queued = audioQueued();
+    pace.audioFill += ((double)queued / PACE_AUDIO_TARGET - pace.audioFill) * 0.05; //callbacks take 512 at a time, smooth that out
+    double ratio = 1.0 + PACE_AUDIO_SKEW * (pace.audioFill - 1.0); //too full, make fewer samples per emulated second
+    if (ratio < 1.0 - PACE_AUDIO_SKEW) ratio = 1.0 - PACE_AUDIO_SKEW;
+    if (ratio > 1.0 + PACE_AUDIO_SKEW) ratio = 1.0 + PACE_AUDIO_SKEW;
+    setAudioRateRatio(ratio);
+
+    if (queued < PACE_AUDIO_TARGET / 2) { //starting up, or the device ran ahead, skip some sleep to fill it back up
+        uint64_t deficit = (uint64_t)(PACE_AUDIO_TARGET - queued) * 1000000000ull / audio.sampleRate;
+        pace.deadline = pace.deadline > now + deficit ? pace.deadline - deficit : now;
+        pace.audioFill = 1.0;
+        pace.audioJumps++;
+    }
+    else if (queued > PACE_AUDIO_TARGET * 2) { //host clock and device clock have drifted well apart, let the device drain
+        uint64_t excess = (uint64_t)(queued - PACE_AUDIO_TARGET) * 1000000000ull / audio.sampleRate;
+        if (pace.deadline < now + excess) pace.deadline = now + excess;
+        pace.audioFill = 1.0;
+        pace.audioJumps++;
+    }
+}
+
+//Skipped frames still run the PPU for timing and interrupts, they just draw nothing
+static void chooseFrameSkip(uint64_t now, int behind) {
+    int skip;
+    if (movie.mode != MOVIE_NONE) skip = 0; //framebuffer is part of the movie's end hash
+    else if (pace.speed == 1.0) skip = behind && pace.skipRun < PACE_MAX_SKIP; //drop pixels to catch up before dropping time
+    else skip = now - pace.lastDrawn < PACE_DRAW_INTERVAL_NS && pace.skipRun < PACE_MAX_SKIP_FAST; //only as many as the screen can show
+    if (skip) {
+        pace.skipRun++;
+    }
+    else {
+        pace.skipRun = 0;
+        pace.lastDrawn = now;
+    }
+    ppu.skipNext = skip;
+}
+
+static void measureSpeed(uint64_t now) {
+    if (systemCycles < pace.windowCycle) { //savestate went back in time
+        pace.windowStart = now;
+        pace.windowCycle = systemCycles;
+    }
+    if (now - pace.windowStart < PACE_SPEED_WINDOW_NS) return;
+    pace.achievedSpeed = (double)(systemCycles - pace.windowCycle) / PACE_CLOCK / ((now - pace.windowStart) / 1e9);
+    pace.windowStart = now;
+    pace.windowCycle = systemCycles;
+    pace.speedSeq++;
+}
+
+void paceFrame() {
+    uint64_t now = nowNs();
+    uint64_t cycles = systemCycles - pace.lastCycle;
+    if (systemCycles < pace.lastCycle || cycles > PACE_FRAME_CYCLES * 4) cycles = PACE_FRAME_CYCLES; //savestate moved the clock
+    pace.lastCycle = systemCycles;
+
+    uint64_t busy = now - pace.frameStart;
+    pace.frames++;
+    pace.busyNs += busy;
+    if (busy > pace.maxBusyNs) pace.maxBusyNs = busy;
+    measureSpeed(now);
+
+    if (pace.speed == 0) { //unbounded, nothing to wait for
+        pace.deadline = now;
+        chooseFrameSkip(now, 0);
+        pace.frameStart = now;
+        return;
+    }
+
+    pace.deadline += (uint64_t)(cycles * 1e9 / (PACE_CLOCK * pace.speed));
+    int behind = 0;
+    if (now > pace.deadline + PACE_MAX_LAG_NS) { //paused, or the host can't keep up, start counting from here
+        pace.deadline = now;
+        pace.resyncs++;
+    }
+    else if (now > pace.deadline) {
+        pace.lateFrames++;
+        behind = 1;
+    }
+    if (audio.sampleRate && pace.speed == 1.0) paceAudio(now);
+    chooseFrameSkip(now, behind);
+
+    if (pace.deadline > now) {
+        sleepUntil(pace.deadline);
+        pace.frameStart = nowNs();
+        pace.sleptNs += pace.frameStart - now;
+    }
+    else {
+        pace.frameStart = now;
+    }
+}
+
+void printPaceStats() {
+    if (pace.frames == 0) return;
+    printf("Pacing: %.2f ms host time per frame (max %.2f, budget %.2f), %llu late, %llu resyncs, idle %.0f%%\n",
+        pace.busyNs / 1e6 / pace.frames, pace.maxBusyNs / 1e6, PACE_FRAME_CYCLES * 1000.0 / PACE_CLOCK,
+        (unsigned long long)pace.lateFrames, (unsigned long long)pace.resyncs,
+        100.0 * pace.sleptNs / (pace.sleptNs + pace.busyNs));
+    if (ppu.skippedFrames) printf("Skipped drawing %u frames\n", ppu.skippedFrames);
+    if (audio.sampleRate) printf("Audio ring at %.0f%% of target, %llu jumps to get back to it\n", pace.audioFill * 100, (unsigned long long)pace.audioJumps);
+}
@@ -0,0 +1,52 @@
+#ifndef PACE_H
+#define PACE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+#define PACE_CLOCK 4194304 //T-cycles per second, 70224 of them a frame is 59.7275 fps
+#define PACE_MAX_LAG_NS 100000000ull //further behind than this and we stop trying to catch up
+#define PACE_AUDIO_TARGET 2048 //frames we want waiting for the audio device, about 43ms at 48kHz
+#define PACE_AUDIO_SKEW 0.005 //most the sample rate gets bent to hold the target, 0.5% is too little to hear
+#define PACE_DRAW_INTERVAL_NS 15000000ull //fast forward draws a frame once this much host time has gone by, a bit under 60Hz
+#define PACE_MAX_SKIP 4 //frames in a row dropped at normal speed when the host falls behind
+#define PACE_MAX_SKIP_FAST 60 //same, fast forward, so something still shows if the host is swamped
+#define PACE_SPEED_WINDOW_NS 500000000ull //how often the achieved speed gets measured
+
+//Keeps emulated time in step with the host clock. Emulation runs flat out for a frame, then sleeps
+//until that frame is due. With audio on the fill level of the audio ring also steers it.
+typedef struct {
+    uint64_t deadline; //host ns the emulated time reached so far is due at
+    uint64_t lastCycle; //systemCycles at the previous frame
+    uint64_t frameStart; //host ns the current frame started being emulated
+    double audioFill; //smoothed audio ring level, in PACE_AUDIO_TARGETs
+    double speed; //multiplier on real time, 0 = as fast as the host goes
+    int skipRun; //frames skipped in a row so far
+    uint64_t lastDrawn; //host ns the last drawn frame was decided on
+
+    //achieved speed, remeasured every PACE_SPEED_WINDOW_NS
+    double achievedSpeed;
+    uint32_t speedSeq; //bumped whenever achievedSpeed changes
+    uint64_t windowStart;
+    uint64_t windowCycle;
+
+    //stats
+    uint64_t frames;
+    uint64_t busyNs; //time spent emulating, summed over frames
+    uint64_t maxBusyNs;
+    uint64_t sleptNs;
+    uint64_t lateFrames; //frames that took longer to emulate than they last
+    uint64_t resyncs; //times we gave up on catching up
+    uint64_t audioJumps; //deadline moved because the audio ring was nearly empty or way too full
+} PaceState;
+
+extern PaceState pace;
+
+void initPace(); //call right before the loop starts, the clock starts now
+void paceFrame(); //once per emulated frame, sleeps until it's due
+void setPaceSpeed(double speed); //1 = real time, 4 = four times as fast, 0 = unbounded
+void printPaceStats();
+
+#endif
@@ -1,6 +1,7 @@
 #include "ppu.h"
 #include "memory.h"
 #include "cpu.h"
+#include "present.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h> //for unsignted ints
@@ -11,7 +12,8 @@
 #include <SDL2/SDL.h> //for graphics and input of the game
 
 PPUState ppu;
-int display[160][144]; //display array, 160x144 pixels, each pixel is 5x5 window pixel
+uint8_t framebuffers[2][144][160]; //double buffered row major colour indices, PPU draws into one while the other is readable
+uint8_t packedFramebuffer[144][40]; //2bpp copy of the front buffer, only built when asked for
 
 // Initialise queue
 void initQueue(Queue* q) {
@@ -62,6 +64,10 @@ void initPPU() {
     ppu.mode2Timer = 0;
     ppu.mode3Timer = 0;
 
+    ppu.lastStepCycle = systemCycles;
+    ppu.nextEventCycle = 0;
+    ppu.activeCycles = 0;
+
     ppu.xPos = 0;
     ppu.scxCounter = 0;
     ppu.newScanLine = 1;
@@ -79,8 +85,38 @@ void initPPU() {
 
     memset(ppu.spriteBuffer, 0, sizeof(ppu.spriteBuffer));
     ppu.spriteCount = 0;
-    memset(display, 0, sizeof(display));
-
+    memset(ppu.spriteLine, 0, sizeof(ppu.spriteLine));
+    ppu.spriteLineSize = 0;
+
+    ppu.oamGeneration = 0;
+    ppu.indexGeneration = 0;
+    ppu.indexSize = 0;
+    ppu.indexValid = 0;
+    ppu.indexRebuilds = 0;
+    memset(framebuffers, 0, sizeof(framebuffers));
+    memset(packedFramebuffer, 0, sizeof(packedFramebuffer));
+    ppu.drawBuffer = framebuffers[0];
+    ppu.frontBuffer = framebuffers[1];
+    ppu.frameSeq = 0;
+    ppu.packedSeq = 0;
+
+    ppu.deferredActive = 0;
+    ppu.serialFrames = 0;
+    ppu.lineDeferred = 0;
+    ppu.currentLine = 0;
+    ppu.mode3Dots = 0;
+    ppu.vramGeneration = 0;
+    memset(ppu.linePending, 0, sizeof(ppu.linePending));
+    ppu.pendingCount = 0;
+    ppu.deferredFrames = 0;
+    ppu.midLineFallbacks = 0;
+    ppu.parallelFlushes = 0;
+    ppu.serialFlushes = 0;
+    ppu.staleLines = 0;
+
+    ppu.skipFrame = 0;
+    ppu.skipNext = 0;
+    ppu.skippedFrames = 0;
 }
 
 void LCDUpdate(int enable) {
@@ -88,6 +124,7 @@ void LCDUpdate(int enable) {
         ppu.LCDdelayflag = 4;
     }                                                       
     else{
+        syncDeferredLines(); //whatever was recorded this frame has to be drawn before the line state is thrown away
         *memory.memoryMap[0xFF44] = 0; // Reset LY to 0
         *memory.memoryMap[0xFF41] = (*memory.memoryMap[0xFF41] & ~0x03) | 0x00; // Set mode to 0 (HBlank)
         *memory.memoryMap[0xFF41] &= ~(1 << 2); // Coincidence flag cleared (unless LY==LYC)
@@ -112,62 +149,105 @@ void LCDUpdate(int enable) {
 
 //Mode 2
 
-int spriteSearchOAM(uint8_t ly, Sprite* buffer) { //pass in sprite array of size 10
-    int count = 0; //track number of sprites in buffer currently
-    Sprite spr;
-
-    for (int i = 0; i < 40; i++) { //read all 40 sprites X attributes
-        for (int j = 0; j < 4; j++) { 
-            uint8_t address = memory.oam[i * 4 + j]; //get value at specific OAM address
-            switch (j) {
-                case 0: spr.yPos = address; break;
-                case 1: spr.xPos = address; break;
-                case 2: spr.tileNum = address; break;
-                case 3: spr.flags = address; break;
-            }
-        }
-        uint8_t lcdc = *memory.memoryMap[0xFF40]; //get sprites height from 2nd bit of lcdc
-        int spriteHeight;
-        if ((lcdc & 0x04) == 0){
-            spriteHeight = 8;
-        }
-        else{
-            spriteHeight = 16;
-        }
+//Work out once which lines each sprite covers, only redone when OAM or the sprite size changes
+void buildSpriteIndex(int spriteHeight) {
+    memset(ppu.lineSpriteCount, 0, sizeof(ppu.lineSpriteCount));
 
-        if (spr.xPos > 0 && (ly + 16) >= spr.yPos && (ly + 16) < (spr.yPos + spriteHeight)) { //check whether sprite is on the line
-            if (count < 10) { //make sure only 10 sprites per line max
-                buffer[count++] = spr;
-            } else {
-                break;
+    for (int i = 0; i < 40; i++) { //OAM order, so the first 10 per line are the ones the scan would pick
+        const uint8_t *attr = &memory.oam[i * 4];
+        if (attr[1] == 0) continue; //X = 0 never gets selected
+
+        int top = attr[0] - 16;
+        for (int line = top; line < top + spriteHeight; line++) {
+            if (line < 0 || line >= 144) continue;
+            if (ppu.lineSpriteCount[line] < 10) {
+                ppu.lineSprites[line][ppu.lineSpriteCount[line]++] = i;
             }
         }
     }
-    
-        for (int i = 0; i < count - 1; i++) {
-        for (int j = 0; j < count - i - 1; j++) {
-            if (buffer[j].xPos > buffer[j + 1].xPos) {
-                Sprite tmp = buffer[j];
-                buffer[j] = buffer[j + 1];
-                buffer[j + 1] = tmp;
-            }
+
+    ppu.indexGeneration = ppu.oamGeneration;
+    ppu.indexSize = (spriteHeight == 16) ? 0x04 : 0x00;
+    ppu.indexValid = 1;
+    ppu.indexRebuilds++;
+}
+
+int spriteSearchOAM(uint8_t ly, Sprite* buffer) { //pass in sprite array of size 10
+    int count = 0; //track number of sprites in buffer currently
+    uint8_t size = *memory.memoryMap[0xFF40] & 0x04; //sprite height from 2nd bit of lcdc, can't change during the scan
+
+    if (!ppu.indexValid || ppu.indexGeneration != ppu.oamGeneration || ppu.indexSize != size) {
+        buildSpriteIndex(size ? 16 : 8);
+    }
+    if (ly >= 144) return 0;
+
+    for (int k = 0; k < ppu.lineSpriteCount[ly]; k++) { //only the sprites already known to be on this line
+        const uint8_t *attr = &memory.oam[ppu.lineSprites[ly][k] * 4];
+        Sprite spr = { attr[0], attr[1], attr[2], attr[3] };
+
+        //insertion sort by X, stable so equal X keeps OAM order (lower index wins)
+        int j = count++;
+        while (j > 0 && buffer[j - 1].xPos > spr.xPos) {
+            buffer[j] = buffer[j - 1];
+            j--;
         }
+        buffer[j] = spr;
     }
-    
 
     return count; //returns how many sprites in the sprite buffer
 }
 
+//Resolve the buffered sprites into one pixel per screen x so mode 3 only does a lookup
+void rasterizeSpriteLine(PPUState *s, uint8_t ly, uint8_t lcdc) {
+    memset(s->spriteLine, 0, sizeof(s->spriteLine));
+    s->spriteLineSize = lcdc & 0x04;
+    int spriteHeight = (lcdc & 0x04) ? 16 : 8;
+
+    //buffer is in priority order, first opaque pixel at an x wins just like the per pixel search did
+    for (int i = 0; i < s->spriteCount; i++) {
+        Sprite *spr = &s->spriteBuffer[i];
+        if (spr->xPos == 0 || spr->xPos >= 168) continue;
+
+        int spriteX = spr->xPos - 8;
+        int spriteY = spr->yPos - 16;
+        if (ly < spriteY || ly >= spriteY + spriteHeight) continue;
+
+        int tileLine = ly - spriteY;
+        if (spr->flags & 0x40) tileLine = spriteHeight - 1 - tileLine; // Y flip
+
+        uint16_t tileNum = spr->tileNum;
+        if (spriteHeight == 16) tileNum &= 0xFE;
+
+        uint16_t tileAddr = tileNum * 16 + tileLine * 2;
+        uint8_t byte1 = memory.vram[tileAddr];
+        uint8_t byte2 = memory.vram[tileAddr + 1];
+
+        for (int px = 0; px < 8; px++) {
+            int x = spriteX + px;
+            if (x < 0 || x >= 160 || s->spriteLine[x].colour != 0) continue;
+
+            int bit = (spr->flags & 0x20) ? px : (7 - px); // X flip
+            uint8_t colorId = ((byte2 >> bit) & 1) << 1 | ((byte1 >> bit) & 1);
+            if (colorId == 0) continue; //transparent, a lower priority sprite can still show here
+
+            s->spriteLine[x].colour = colorId;
+            s->spriteLine[x].palette = (spr->flags & 0x10) ? 1 : 0;
+            s->spriteLine[x].priority = (spr->flags & 0x80) ? 1 : 0;
+        }
+    }
+}
+
 //Mode 3
-void pixelPushBG(Queue* fifo, uint8_t xPos, FetchStage* stage, int fetchWindow) { //retrieve pixels tiles and push current tile row to FIFO Queue 
-    //printf("pixelPushBG called, queue count=%d\n", fifo->count);
+void pixelPushBG(PPUState *s, const LineRegs *r, int fetchWindow, int render) { //retrieve pixels tiles and push current tile row to FIFO Queue 
+    Queue *fifo = &s->BGFifo;
     if (isEmpty(fifo)) { //Queue must be empty before allowing more pixels to be pushed
-        //printf("pixelPushBG: queue is empty, filling...\n");
-        uint8_t lcdc = *memory.memoryMap[0xFF40]; // LCD Control
-        uint8_t ly   = *memory.memoryMap[0xFF44]; // Current scanline
-        uint8_t wx   = *memory.memoryMap[0xFF4B]; // Window X
-        uint8_t wy   = *memory.memoryMap[0xFF4A]; // Window Y
-        uint8_t bgp  = *memory.memoryMap[0xFF47]; // BG Palette
+        if (!render) { //timing only, contents never reach the screen so skip the VRAM reads
+            fifo->count = 8;
+            s->fetchStage.BGFetchStage = 0;
+            return;
+        }
+        uint8_t lcdc = r->lcdc; // LCD Control
+        uint8_t xPos = s->xPos;
 
         uint16_t tileMapBase;
         uint16_t mapX, mapY;
@@ -178,19 +258,15 @@ void pixelPushBG(Queue* fifo, uint8_t xPos, FetchStage* stage, int fetchWindow)
             tileMapBase = (lcdc & 0x40) ? 0x9C00 : 0x9800;
 
             // Window coordinates relative to window start, NO scrolling applied
-            mapX = xPos - (wx - 7);
-            mapY = ppu.windowLine; //ly - wy;
-          //  printf("Window line: %d, LY: %d\n", windowLine, ly);
+            mapX = xPos - (r->wx - 7);
+            mapY = s->windowLine; //ly - wy;
         } else { //if fetching background tile
             // Background tile map base depends on LCDC bit 3
             tileMapBase = (lcdc & 0x08) ? 0x9C00 : 0x9800;
 
             // Background coordinates - NO x scrolling applied here, scroll handled by xPos logic later
-            uint8_t scy = *memory.memoryMap[0xFF42];
-            mapY = (ly + scy) & 0xFF; //y scroll added with wrap 0-255
-
-            uint8_t scx = *memory.memoryMap[0xFF43];
-            mapX = (xPos + scx) & 0xFF; //coarse scroll
+            mapY = (r->ly + r->scy) & 0xFF; //y scroll added with wrap 0-255
+            mapX = (xPos + r->scx) & 0xFF; //coarse scroll
         }
 
         // Make sure mapX and mapY are valid (0-255)
@@ -200,7 +276,7 @@ void pixelPushBG(Queue* fifo, uint8_t xPos, FetchStage* stage, int fetchWindow)
         uint16_t tileRow = mapY / 8;
         uint16_t tileCol = mapX / 8;
         uint16_t tileIndexAddr = tileMapBase + tileRow * 32 + tileCol;
-        int8_t tileNum = *memory.memoryMap[tileIndexAddr];
+        int8_t tileNum = memory.vram[tileIndexAddr - 0x8000];
 
         uint16_t tileAddr;
         if (useUnsignedTiles) {
@@ -210,15 +286,15 @@ void pixelPushBG(Queue* fifo, uint8_t xPos, FetchStage* stage, int fetchWindow)
         }
 
         uint8_t line = mapY % 8;
-        uint8_t byte1 = *memory.memoryMap[tileAddr + line * 2];
-        uint8_t byte2 = *memory.memoryMap[tileAddr + line * 2 + 1];
+        uint8_t byte1 = memory.vram[tileAddr - 0x8000 + line * 2];
+        uint8_t byte2 = memory.vram[tileAddr - 0x8000 + line * 2 + 1];
 
         // Push 8 pixels (MSB to LSB)
         for (int i = 7; i >= 0; i--) {
             uint8_t lo = (byte1 >> i) & 1;
             uint8_t hi = (byte2 >> i) & 1;
             uint8_t colourId = (hi << 1) | lo;
-            uint8_t colour = (bgp >> (colourId * 2)) & 0x03;
+            uint8_t colour = (r->bgp >> (colourId * 2)) & 0x03;
 
             Pixel p = {
                 .colour = colour,
@@ -229,32 +305,294 @@ void pixelPushBG(Queue* fifo, uint8_t xPos, FetchStage* stage, int fetchWindow)
             };
             enqueue(fifo, p);
         }
-        stage->BGFetchStage = 0; // Reset fetch stage after pushing
-       //printf("TileNum: %d, Addr: 0x%04X, line=%d, byte1=0x%02X, byte2=0x%02X, TileIndexAddr: 0x%04X, TileRow=%d, TileCol=%d, tileMapBase=%04X, LCDC: 0x%02X, xPos: %d, scx: %d, scy: %d,fetchWindow: %d, wx: %d, windowline: %d, PC: %04X, wy: %d, windowFetchMode: %d, IE: 0x%02X, IF: 0x%02X, IME: %d\n", tileNum, tileAddr, *memory.memoryMap[0xFF44], byte1, byte2, tileIndexAddr, tileRow, tileCol, tileMapBase, lcdc, xPos, *memory.memoryMap[0xFF43], *memory.memoryMap[0xFF42],fetchWindow, *memory.memoryMap[0xFF4B], ppu.windowLine, CPUreg.PC, *memory.memoryMap[0xFF4A], ppu.fetchStage.windowFetchMode, *memory.memoryMap[0xFFFF], *memory.memoryMap[0xFF0F], CPUreg.IME);
+        s->fetchStage.BGFetchStage = 0; // Reset fetch stage after pushing
     }
     
 }
 
-//SDL display buffer
-
-void drawDisplay(SDL_Renderer *renderer){
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); //black pixels
-    SDL_RenderClear(renderer); //turn screen to black
-
-    for (int y = 0; y < 144; y++) {
-        for (int x = 0; x < 160; x++) {
-            int c = display[x][y];
-            switch (c) {
-                case 0: SDL_SetRenderDrawColor(renderer, 224, 248, 208, 255); break; // lightest
-                case 1: SDL_SetRenderDrawColor(renderer, 136, 192, 112, 255); break; // light
-                case 2: SDL_SetRenderDrawColor(renderer, 52, 104, 86, 255); break;   // dark
-                case 3: SDL_SetRenderDrawColor(renderer, 8, 24, 32, 255); break;     // darkest
-                default: continue; // skip if not a valid colour
+//One mode 3 dot for the line in s. out is the row to draw into, NULL only keeps the timing.
+//Returns whether the window is visible at this dot, the caller needs it at the end of the line.
+int mode3Step(PPUState *s, const LineRegs *r, uint8_t *out) {
+    int windowEnabled = (r->lcdc & 0x20) != 0;
+    int windowStartX  = (int)r->wx - 7;
+
+    // Window is *actually* visible at this pixel?
+    int windowVisibleNow =
+        windowEnabled &&
+        (r->ly >= r->wy) &&          // window starts at WY and continues downward
+        (s->xPos >= windowStartX);     // and only after WX-7 horizontally
+
+    // One-time switch from BG -> Window when it first becomes visible this scanline
+    if (!s->fetchStage.windowFetchMode && windowVisibleNow) {
+        s->BGFifo.count = 0; // flush any queued BG pixels so the window starts cleanly
+        s->fetchStage.BGFetchStage    = 0;
+        s->fetchStage.windowFetchMode = 1;
+        s->mode3Timer = 2;
+    }
+
+    // Advance the correct pipeline when ready
+    if (s->fetchStage.windowFetchMode) {
+        // If window got disabled mid-line, drop back to BG cleanly
+        if (!windowEnabled) {
+            s->BGFifo.count = 0;
+            s->fetchStage.BGFetchStage    = 0;
+            s->fetchStage.windowFetchMode = 0;
+            s->mode3Timer = 2;
+        } else if (s->mode3Timer == 0) {
+            // Window pipeline stages
+            if      (s->fetchStage.BGFetchStage == 0) { s->fetchStage.BGFetchStage = 1; s->mode3Timer = 2; }
+            else if (s->fetchStage.BGFetchStage == 1) { s->fetchStage.BGFetchStage = 2; s->mode3Timer = 2; }
+            else if (s->fetchStage.BGFetchStage == 2) { s->fetchStage.BGFetchStage = 3; s->mode3Timer = 2; }
+            else /* BGFetchStage == 3 */ {
+                // xPos - (wx-7) handled inside pixelPush for window mode
+                pixelPushBG(s, r, /*windowMode=*/1, out != NULL);
+                s->mode3Timer = 2;
+            }
+        }
+    } else {
+        // Background pipeline (runs even if windowEnabled=1 but not yet visible)
+        if (s->mode3Timer == 0) {
+            if      (s->fetchStage.BGFetchStage == 0) { s->fetchStage.BGFetchStage = 1; s->mode3Timer = 2; }
+            else if (s->fetchStage.BGFetchStage == 1) { s->fetchStage.BGFetchStage = 2; s->mode3Timer = 2; }
+            else if (s->fetchStage.BGFetchStage == 2) { s->fetchStage.BGFetchStage = 3; s->mode3Timer = 2; }
+            else /* BGFetchStage == 3 */ {
+                // BG push (SCX handled by discarding below)
+                pixelPushBG(s, r, /*windowMode=*/0, out != NULL);
+                s->mode3Timer = 2;
+            }
+        }
+    }
+
+    // Set discard count once per new scanline
+    //Need to add 8 pixel discard
+    if (s->xPos == 0 && s->newScanLine) {
+        s->scxCounter = r->scx & 7; //lower 3 bits of scx for fine scroll, and with 0b0111
+        s->newScanLine = 0;
+    }
+
+    // FIFO -> screen (sprite mixing preserved)
+    if (s->BGFifo.count > 0) {
+        if (!out) { //timing only
+            s->BGFifo.count--;
+            if (s->scxCounter > 0) s->scxCounter--;
+            else s->xPos++;
+        } else if (s->scxCounter > 0) {
+            Pixel discard;
+            dequeue(&s->BGFifo, &discard);
+            s->scxCounter--;
+        } else {
+            Pixel pixelToPush;
+            dequeue(&s->BGFifo, &pixelToPush);
+
+            uint8_t finalColour = 0;  
+            if (r->lcdc & 0x01) { //if BG/Window enable bit is 0 then send pixel of colour 0
+                finalColour = pixelToPush.colour;
+            }
+
+            // --- sprite mixing, line buffer built once in mode 2 ---
+            if (r->lcdc & 0x02) { //if sprite bit is enabled
+                if ((r->lcdc & 0x04) != s->spriteLineSize) { //sprite size flipped mid line, rebuild from the same buffer
+                    rasterizeSpriteLine(s, r->ly, r->lcdc);
+                }
+                SpritePixel *sp = &s->spriteLine[s->xPos];
+                if (sp->colour != 0) {
+                    uint8_t palette = sp->palette ? r->obp1 : r->obp0;
+                    if (pixelToPush.colour == 0 || !sp->priority) {
+                        finalColour = (palette >> (sp->colour * 2)) & 0x03;
+                    }
+                }
             }
-            SDL_Rect rect = { x * 5, y * 5, 5, 5 };
-            SDL_RenderFillRect(renderer, &rect);
+
+            if (r->ly < 144) out[s->xPos] = finalColour;
+            s->xPos++;
         }
     }
+
+    return windowVisibleNow;
+}
+
+//Deferred rendering
+
+void readLineRegs(LineRegs *r) {
+    r->ly   = *memory.memoryMap[0xFF44];
+    r->lcdc = *memory.memoryMap[0xFF40];
+    r->scy  = *memory.memoryMap[0xFF42];
+    r->scx  = *memory.memoryMap[0xFF43];
+    r->wy   = *memory.memoryMap[0xFF4A];
+    r->wx   = *memory.memoryMap[0xFF4B];
+    r->bgp  = *memory.memoryMap[0xFF47];
+    r->obp0 = *memory.memoryMap[0xFF48];
+    r->obp1 = *memory.memoryMap[0xFF49];
+}
+
+//Replays a recorded line from its start for the given number of dots (-1 = whole line) into out
+void replayLine(PPUState *s, const LineSnapshot *snap, uint8_t *out, int dots) {
+    s->xPos = 0;
+    s->scxCounter = 0;
+    s->newScanLine = 1;
+    s->windowLine = snap->windowLine;
+    s->mode3Timer = 0;
+    s->fetchStage.BGFetchStage = 0;
+    s->fetchStage.objectFetchStage = 0;
+    s->fetchStage.windowFetchMode = 0;
+    s->BGFifo.count = 0;
+    s->spriteCount = snap->spriteCount;
+    memcpy(s->spriteBuffer, snap->sprites, sizeof(snap->sprites));
+    rasterizeSpriteLine(s, snap->regs.ly, snap->regs.lcdc);
+
+    for (int dot = 0; (dots < 0 || dot < dots) && s->xPos < 160; dot++) {
+        mode3Step(s, &snap->regs, out);
+        s->mode3Timer--; //same per dot countdown stepPPU does after every step
+        if (s->mode3Timer <= 0) s->mode3Timer = 0;
+    }
+}
+
+static void renderPendingLine(int line) {
+    PPUState scratch; //workers each replay on their own copy, only VRAM/OAM and the snapshot are shared
+    replayLine(&scratch, &ppu.lines[line], ppu.drawBuffer[line], -1);
+}
+
+static SDL_Thread *workerThreads[8];
+static int workerCount = 0;
+static SDL_sem *workStart = NULL;
+static SDL_sem *workDone = NULL;
+static SDL_atomic_t nextJob;
+static int jobLines[144];
+static int jobCount = 0;
+static int workersQuit = 0;
+
+static void runJobs() {
+    int job;
+    while ((job = SDL_AtomicAdd(&nextJob, 1)) < jobCount) {
+        renderPendingLine(jobLines[job]);
+    }
+}
+
+static int renderWorker(void *data) {
+    (void)data;
+    while (1) {
+        SDL_SemWait(workStart);
+        if (workersQuit) break;
+        runJobs();
+        SDL_SemPost(workDone);
+    }
+    return 0;
+}
+
+//Draw every recorded line, parallel is only allowed when nothing has changed VRAM/OAM since they were recorded
+void flushPendingLines(int parallel) {
+    if (ppu.pendingCount == 0) return;
+
+    jobCount = 0;
+    for (int line = 0; line < 144; line++) {
+        if (ppu.linePending[line]) {
+            const LineSnapshot *snap = &ppu.lines[line];
+            if (snap->vramVersion != ppu.vramGeneration || snap->oamVersion != ppu.oamGeneration) {
+                ppu.staleLines++; //some write skipped trackWrite, line is drawn from newer data. Counted here, before any worker starts
+            }
+            jobLines[jobCount++] = line;
+            ppu.linePending[line] = 0;
+        }
+    }
+    ppu.pendingCount = 0;
+
+    SDL_AtomicSet(&nextJob, 0);
+    if (parallel && workerCount > 0 && jobCount > 1) {
+        for (int i = 0; i < workerCount; i++) SDL_SemPost(workStart);
+        runJobs(); //emulation thread takes lines too instead of idling
+        for (int i = 0; i < workerCount; i++) SDL_SemWait(workDone);
+        ppu.parallelFlushes++;
+    } else {
+        runJobs();
+        ppu.serialFlushes++;
+    }
+}
+
+//Current line was only being timed, catch its pixels and FIFO up so stepPPU can carry on drawing it for real
+void materializeCurrentLine() {
+    if (!ppu.lineDeferred) return;
+    uint8_t ly = ppu.lines[ppu.currentLine].regs.ly;
+    PPUState scratch;
+    replayLine(&scratch, &ppu.lines[ppu.currentLine], ly < 144 ? ppu.drawBuffer[ly] : NULL, ppu.mode3Dots);
+
+    ppu.BGFifo = scratch.BGFifo; //real pixels instead of the placeholder count
+    memcpy(ppu.spriteLine, scratch.spriteLine, sizeof(ppu.spriteLine));
+    ppu.spriteLineSize = scratch.spriteLineSize;
+    ppu.xPos = scratch.xPos;
+    ppu.scxCounter = scratch.scxCounter;
+    ppu.newScanLine = scratch.newScanLine;
+    ppu.fetchStage = scratch.fetchStage;
+    ppu.mode3Timer = scratch.mode3Timer;
+    ppu.lineDeferred = 0;
+}
+
+//Called before anything lands in VRAM or OAM
+void syncDeferredLines() {
+    if (ppu.lineDeferred) materializeCurrentLine();
+    if (ppu.pendingCount > 0) flushPendingLines(0); //few lines, not worth waking the workers mid frame
+}
+
+void setDeferredRendering(int workers) {
+    if (workers > 8) workers = 8;
+    if (workers < 0) workers = 0;
+
+    //stop old pool
+    if (workerCount > 0) {
+        workersQuit = 1;
+        for (int i = 0; i < workerCount; i++) SDL_SemPost(workStart);
+        for (int i = 0; i < workerCount; i++) SDL_WaitThread(workerThreads[i], NULL);
+        workerCount = 0;
+        workersQuit = 0;
+    }
+
+    ppu.deferredWorkers = workers;
+    if (workers > 0) {
+        if (!workStart) workStart = SDL_CreateSemaphore(0);
+        if (!workDone) workDone = SDL_CreateSemaphore(0);
+        for (int i = 0; i < workers - 1; i++) { //emulation thread is the last worker
+            workerThreads[i] = SDL_CreateThread(renderWorker, "scanline", NULL);
+            if (!workerThreads[i]) break;
+            workerCount++;
+        }
+    }
+}
+
+static uint32_t frameSum = 2166136261u; //FNV-1a over every finished frame sumFrame saw
+static uint32_t summedSeq = 0, summedFrames = 0;
+
+void sumFrame() {
+    if (ppu.frameSeq == summedSeq) return;
+    for (int i = 0; i < 144 * 160; i++) frameSum = (frameSum ^ ppu.frontBuffer[0][i]) * 16777619u;
+    summedSeq = ppu.frameSeq;
+    summedFrames++;
+}
+
+void printRenderStats() {
+    if (summedFrames > 0) printf("Frame checksum: %08X over %u frames\n", frameSum, summedFrames);
+    if (ppu.deferredWorkers == 0) return;
+    printf("Deferred rendering on %d threads: %u frames, %u parallel and %u serial flushes, %u mid line fallbacks, %u stale lines\n",
+        ppu.deferredWorkers, ppu.deferredFrames, ppu.parallelFlushes, ppu.serialFlushes, ppu.midLineFallbacks, ppu.staleLines);
+}
+
+//Framebuffer access
+
+const uint8_t *getFramebuffer(uint32_t *frameSeq) {
+    if (frameSeq) *frameSeq = ppu.frameSeq;
+    return &ppu.frontBuffer[0][0];
+}
+
+const uint8_t *getFramebufferPacked(uint32_t *frameSeq) {
+    if (ppu.packedSeq != ppu.frameSeq || ppu.frameSeq == 0) { //rebuild once per frame at most
+        for (int y = 0; y < 144; y++) {
+            const uint8_t *row = ppu.frontBuffer[y];
+            for (int x = 0; x < 160; x += 4) {
+                packedFramebuffer[y][x >> 2] = (row[x] << 6) | (row[x + 1] << 4) | (row[x + 2] << 2) | row[x + 3];
+            }
+        }
+        ppu.packedSeq = ppu.frameSeq;
+    }
+    if (frameSeq) *frameSeq = ppu.frameSeq;
+    return &packedFramebuffer[0][0];
 }
 
 //Interrupt
@@ -281,8 +619,69 @@ void checkLYC() {
     ppu.wasEqual = equal;
 }
 
+//Applies cycles where the PPU would only have moved its counters, in one go
+static void catchUpPPU(uint64_t cycles) {
+    int n = cycles > 0x7FFFFFFF ? 0x7FFFFFFF : (int)cycles;
+    if (ppu.LCDdisabled == 0) {
+        switch(*memory.memoryMap[0xFF41] & 0x03){
+            case(0): ppu.mode0Timer = 456 - (ppu.scanlineTimer + n - 1); break; //as the last skipped cycle left it
+            case(1): ppu.mode1Timer -= n; break;
+            case(2): ppu.mode2Timer += n; break;
+        }
+        ppu.scanlineTimer += n;
+        ppu.mode3Timer = ppu.mode3Timer > n ? ppu.mode3Timer - n : 0;
+    }
+    else {
+        ppu.mode0Timer = 456 - ppu.scanlineTimer;
+    }
+    if (ppu.LCDdelayflag >= 0) { //only ever compared against 0, once negative the exact value doesn't matter
+        ppu.LCDdelayflag = ppu.LCDdelayflag - n < -1 ? -1 : ppu.LCDdelayflag - n;
+    }
+    if (ppu.DMACycles > 0) {
+        ppu.DMACycles = ppu.DMACycles > n ? ppu.DMACycles - n : 0;
+    }
+}
+
+//How many cycles after this one can be skipped, every counter check in stepPPU turned into a distance
+static uint64_t quietCycles() {
+    uint64_t quiet = UINT64_MAX; //LCD off and not about to turn on, only a register write wakes it
+    if (ppu.LCDdisabled == 1) {
+        if (ppu.LCDdelayflag >= 0) quiet = ppu.LCDdelayflag;
+    }
+    else {
+        uint8_t ly = *memory.memoryMap[0xFF44];
+        int left = 0; //mode 3 runs every dot
+        switch(*memory.memoryMap[0xFF41] & 0x03){
+            case(0): left = 456 - ppu.scanlineTimer; break; //end of line
+            case(1):
+                if (ly != 153 && ly != 0) left = ppu.mode1Timer; //next LY
+                else if (ppu.mode1Timer > 448) left = ppu.mode1Timer - 448; //line 153 LY = 0 quirk
+                else if (ppu.mode1Timer < 448) left = ppu.mode1Timer; //back to mode 2
+                break;
+            case(2): left = 80 - ppu.mode2Timer; break; //OAM search done
+        }
+        quiet = left > 0 ? left : 0;
+    }
+    if (ppu.DMAFlag == 1 && (uint64_t)ppu.DMACycles < quiet) quiet = ppu.DMACycles; //OAM unblocks
+    return quiet;
+}
+
+//Brings the sleeping PPU up to the current cycle, call before anything it depends on changes
+void syncPPU() {
+    if (systemCycles > ppu.lastStepCycle + 1) {
+        catchUpPPU(systemCycles - 1 - ppu.lastStepCycle);
+        ppu.lastStepCycle = systemCycles - 1;
+    }
+    ppu.nextEventCycle = 0; //recheck on this cycle, the write may have moved the next event
+}
+
 //Main PPU loop
-void stepPPU(SDL_Renderer *renderer){
+void stepPPU(){
+    if (systemCycles < ppu.nextEventCycle) return; //nothing but counters would change until then
+    syncPPU();
+    ppu.lastStepCycle = systemCycles;
+    ppu.activeCycles++;
+
     if (ppu.LCDdelayflag == 0 && ppu.LCDdisabled == 1) { 
         *memory.memoryMap[0xFF41] = (*memory.memoryMap[0xFF41] & ~0x03) | 0x02; // Set mode to 2 (OAM)
         ppu.LCDdisabled = 0; // Reset LCD disabled flag
@@ -296,8 +695,22 @@ void stepPPU(SDL_Renderer *renderer){
                 if (*memory.memoryMap[0xFF44] == 143) { //Start VBlank 
                     (*memory.memoryMap[0xFF44])++; //ly++
                     checkLYC();
-                    drawDisplay(renderer); //draw display to window 
-                    SDL_RenderPresent(renderer); //update window with everything drawn
+                    flushPendingLines(1); //lines recorded this frame are drawn on the worker threads now
+                    if (ppu.serialFrames > 0) ppu.serialFrames--;
+
+                    if (ppu.skipFrame) {
+                        ppu.skippedFrames++; //nothing was drawn, last finished frame stays up
+                    }
+                    else {
+                        uint8_t (*finished)[160] = ppu.drawBuffer; //swap so readers always see a whole frame
+                        ppu.drawBuffer = ppu.frontBuffer;
+                        ppu.frontBuffer = finished;
+                        ppu.frameSeq++;
+                        publishFrame(&ppu.frontBuffer[0][0]); //hand finished frame to the present thread, doesn't wait for the screen
+                    }
+                    ppu.skipFrame = ppu.skipNext;
+                    ppu.deferredActive = ppu.deferredWorkers > 0 && ppu.serialFrames == 0 && !ppu.skipFrame;
+                    if (ppu.deferredActive) ppu.deferredFrames++;
 
                     *memory.memoryMap[0xFF0F] |= 0x01; // Set VBlank flag in IF register
 
@@ -367,6 +780,21 @@ void stepPPU(SDL_Renderer *renderer){
             else if(ppu.mode2Timer == 80){
                 ppu.spriteCount = spriteSearchOAM(*memory.memoryMap[0xFF44], ppu.spriteBuffer); //store sprites in sprite buffer and no. of sprites
                 ppu.mode2Timer = 0; //reset timer for next mode 2 check
+                ppu.mode3Dots = 0;
+                if (ppu.deferredActive && *memory.memoryMap[0xFF44] < 144) {
+                    //only record what the line needs, pixels get drawn at VBlank
+                    LineSnapshot *snap = &ppu.lines[*memory.memoryMap[0xFF44]];
+                    readLineRegs(&snap->regs);
+                    snap->windowLine = ppu.windowLine;
+                    snap->spriteCount = ppu.spriteCount;
+                    memcpy(snap->sprites, ppu.spriteBuffer, sizeof(snap->sprites));
+                    snap->vramVersion = ppu.vramGeneration;
+                    snap->oamVersion = ppu.oamGeneration;
+                    ppu.currentLine = *memory.memoryMap[0xFF44];
+                    ppu.lineDeferred = 1;
+                } else if (!ppu.skipFrame) {
+                    rasterizeSpriteLine(&ppu, *memory.memoryMap[0xFF44], *memory.memoryMap[0xFF40]);
+                }
                 //*memoryMap[0xFF41] = (*memoryMap[0xFF41] & 0xFC) | (3 & 0x03); //set to mode 3
                 *memory.memoryMap[0xFF41] = (*memory.memoryMap[0xFF41] & ~0x03) | 0x03;
             }
@@ -374,134 +802,20 @@ void stepPPU(SDL_Renderer *renderer){
 
         //Mode 3 fetching and pushing queues, change to HBlank after scanline done, Vblank when all scanlines done
 
-        case(3):  // BG/Window fetcher (with sprite mix)
-            uint8_t lcdc = *memory.memoryMap[0xFF40];
-            uint8_t wx   = *memory.memoryMap[0xFF4B];
-            uint8_t wy   = *memory.memoryMap[0xFF4A];
-            uint8_t scx  = *memory.memoryMap[0xFF43];
-
-            int windowEnabled = (lcdc & 0x20) != 0;
-            int windowStartX  = (int)wx - 7;
-
-            // Window is *actually* visible at this pixel?
-            int windowVisibleNow =
-                windowEnabled &&
-                (*memory.memoryMap[0xFF44] >= wy) &&          // window starts at WY and continues downward
-                (ppu.xPos >= windowStartX);     // and only after WX-7 horizontally
-
-            // One-time switch from BG -> Window when it first becomes visible this scanline
-            if (!ppu.fetchStage.windowFetchMode && windowVisibleNow) {
-                // flush any queued BG pixels so the window starts cleanly
-                for (int i = 0; i < 8; i++) {
-                    Pixel tmp;
-                    dequeue(&ppu.BGFifo, &tmp);
-                }
-                ppu.fetchStage.BGFetchStage    = 0;
-                ppu.fetchStage.windowFetchMode = 1;
-                ppu.mode3Timer = 2;
-            }
-
-            // Advance the correct pipeline when ready
-            if (ppu.fetchStage.windowFetchMode) {
-                // If window got disabled mid-line, drop back to BG cleanly
-                if (!windowEnabled) {
-                    for (int i = 0; i < 8; i++) {
-                        Pixel tmp;
-                        dequeue(&ppu.BGFifo, &tmp);
-                    }
-                    ppu.fetchStage.BGFetchStage    = 0;
-                    ppu.fetchStage.windowFetchMode = 0;
-                    ppu.mode3Timer = 2;
-                } else if (ppu.mode3Timer == 0) {
-                    // Window pipeline stages
-                    if      (ppu.fetchStage.BGFetchStage == 0) { ppu.fetchStage.BGFetchStage = 1; ppu.mode3Timer = 2; }
-                    else if (ppu.fetchStage.BGFetchStage == 1) { ppu.fetchStage.BGFetchStage = 2; ppu.mode3Timer = 2; }
-                    else if (ppu.fetchStage.BGFetchStage == 2) { ppu.fetchStage.BGFetchStage = 3; ppu.mode3Timer = 2; }
-                    else /* BGFetchStage == 3 */ {
-                        // xPos - (wx-7) handled inside pixelPush for window mode
-                        pixelPushBG(&ppu.BGFifo, ppu.xPos, &ppu.fetchStage, /*windowMode=*/1);
-                        ppu.mode3Timer = 2;
-                    }
-                }
-            } else {
-                // Background pipeline (runs even if windowEnabled=1 but not yet visible)
-                if (ppu.mode3Timer == 0) {
-                    if      (ppu.fetchStage.BGFetchStage == 0) { ppu.fetchStage.BGFetchStage = 1; ppu.mode3Timer = 2; }
-                    else if (ppu.fetchStage.BGFetchStage == 1) { ppu.fetchStage.BGFetchStage = 2; ppu.mode3Timer = 2; }
-                    else if (ppu.fetchStage.BGFetchStage == 2) { ppu.fetchStage.BGFetchStage = 3; ppu.mode3Timer = 2; }
-                    else /* BGFetchStage == 3 */ {
-                        // BG push (SCX handled by discarding below)
-                        pixelPushBG(&ppu.BGFifo, ppu.xPos, &ppu.fetchStage, /*windowMode=*/0);
-                        ppu.mode3Timer = 2;
-                    }
-                }
-            }
+        case(3): { // BG/Window fetcher (with sprite mix)
+            LineRegs regs;
+            readLineRegs(&regs);
 
-            // Set discard count once per new scanline
-            //Need to add 8 pixel discard
-            if (ppu.xPos == 0 && ppu.newScanLine) {
-                ppu.scxCounter = scx & 7; //lower 3 bits of scx for fine scroll, and with 0b0111
-                ppu.newScanLine = 0;
+            if (ppu.lineDeferred && memcmp(&regs, &ppu.lines[ppu.currentLine].regs, sizeof(regs)) != 0) {
+                //register written mid line, snapshot no longer describes it, draw the rest for real
+                materializeCurrentLine();
+                ppu.deferredActive = 0; //rest of this frame is drawn inline
+                ppu.midLineFallbacks++;
+                ppu.serialFrames = 60; //raster effects usually repeat, stay serial for a while
             }
 
-            // FIFO -> screen (sprite mixing preserved)
-            if (ppu.BGFifo.count > 0) {
-                if (ppu.scxCounter > 0) {
-                    Pixel discard;
-                    dequeue(&ppu.BGFifo, &discard);
-                    ppu.scxCounter--;
-                } else {
-                    Pixel pixelToPush;
-                    dequeue(&ppu.BGFifo, &pixelToPush);
-
-                    int y = *memory.memoryMap[0xFF44]; //ly
-
-                    uint8_t finalColour = 0;  
-                    if (lcdc & 0x01) { //if BG/Window enable bit is 0 then send pixel of colour 0
-                        finalColour = pixelToPush.colour;
-                    }
-
-                    // --- sprite mixing (unchanged logic) ---
-                    if (lcdc & 0x02) { //if sprite bit is enabled
-                        for (int i = 0; i < ppu.spriteCount; i++) {
-                            Sprite *spr = &ppu.spriteBuffer[i];
-                            if (spr->xPos == 0 || spr->xPos >= 168) continue;
-
-                            int spriteX = spr->xPos - 8;
-                            int spriteY = spr->yPos - 16;
-                            int spriteHeight = (*memory.memoryMap[0xFF40] & 0x04) ? 16 : 8;
-
-                            if (ppu.xPos >= spriteX && ppu.xPos < spriteX + 8 &&
-                                y   >= spriteY && y   < spriteY + spriteHeight) {
-
-                                int tileLine = y - spriteY;
-                                if (spr->flags & 0x40) tileLine = spriteHeight - 1 - tileLine; // Y flip
-
-                                uint16_t tileNum = spr->tileNum;
-                                if (spriteHeight == 16) tileNum &= 0xFE;
-
-                                uint16_t tileAddr = 0x8000 + tileNum * 16 + tileLine * 2;
-                                uint8_t byte1 = *memory.memoryMap[tileAddr];
-                                uint8_t byte2 = *memory.memoryMap[tileAddr + 1];
-
-                                int bit = (spr->flags & 0x20) ? (ppu.xPos - spriteX) : (7 - (ppu.xPos - spriteX)); // X flip
-                                int colorId = ((byte2 >> bit) & 1) << 1 | ((byte1 >> bit) & 1);
-                                if (colorId != 0) {
-                                    uint8_t palette = (spr->flags & 0x10) ? *memory.memoryMap[0xFF49] : *memory.memoryMap[0xFF48];
-                                    uint8_t spriteColour = (palette >> (colorId * 2)) & 0x03;
-                                    if (pixelToPush.colour == 0 || !(spr->flags & 0x80)) {
-                                        finalColour = spriteColour;
-                                    }
-                                    break;
-                                }
-                            }
-                        }
-                    }
-
-                    if (y < 144) display[ppu.xPos][y] = finalColour;
-                    ppu.xPos++;
-                }
-            }
+            int windowVisibleNow = mode3Step(&ppu, &regs, ppu.lineDeferred || ppu.skipFrame || regs.ly >= 144 ? NULL : ppu.drawBuffer[regs.ly]);
+            ppu.mode3Dots++;
 
             // End of visible scanline -> HBlank
             if (ppu.xPos >= 160) {
@@ -516,6 +830,11 @@ void stepPPU(SDL_Renderer *renderer){
                 ppu.fetchStage.BGFetchStage = 0;
                 ppu.newScanLine = 1;
                 ppu.fetchStage.windowFetchMode = 0; //reset window fetch mode for next scanline
+                if (ppu.lineDeferred) {
+                    ppu.linePending[ppu.currentLine] = 1;
+                    ppu.pendingCount++;
+                    ppu.lineDeferred = 0;
+                }
                 // LY advance handled in HBlank
                 if (windowVisibleNow && ppu.windowOnLine == 0) { //make sure windowLine only increments once per scanline if window is on it
                     ppu.windowLine++;
@@ -523,10 +842,10 @@ void stepPPU(SDL_Renderer *renderer){
                 }
             } 
 
-            
             break;
         }
-                
+        }
+
 
     //SDL_Delay(1000/63); //fps
     if (ppu.LCDdisabled == 0) { //if LCD is enabled, then continue with PPU
@@ -546,5 +865,8 @@ void stepPPU(SDL_Renderer *renderer){
         ppu.DMACycles--;
     }
 
+    uint64_t quiet = quietCycles();
+    ppu.nextEventCycle = quiet == UINT64_MAX ? UINT64_MAX : systemCycles + 1 + quiet;
+
 
 }
\ No newline at end of file
@@ -36,6 +36,25 @@ typedef struct {
     uint8_t flags; //4th byte
 } Sprite; //Structure to hold sprite attributes for each sprite
 
+typedef struct {
+    uint8_t colour; //colour id 0-3 straight from the tile, 0 = no sprite pixel here
+    uint8_t palette; //0 = OBP0, 1 = OBP1
+    uint8_t priority; //1 = only shows over BG colour 0
+} SpritePixel; //one entry per screen x in the sprite line buffer
+
+typedef struct {
+    uint8_t ly, lcdc, scy, scx, wy, wx, bgp, obp0, obp1;
+} LineRegs; //every register mode 3 reads, in one place
+
+typedef struct {
+    LineRegs regs; //as they were when mode 3 started
+    uint8_t windowLine; //internal window line counter at the start of the line
+    uint8_t spriteCount;
+    Sprite sprites[10]; //mode 2 result, already in priority order
+    uint32_t vramVersion; //generations at record time, the line is only valid against these
+    uint32_t oamVersion;
+} LineSnapshot; //everything needed to draw one scanline later, away from the CPU
+
 typedef struct {
     int DMAFlag;
     int DMACycles;
@@ -60,13 +79,65 @@ typedef struct {
     Queue SpriteFifo;
     Sprite spriteBuffer[10]; 
     int spriteCount;
+    SpritePixel spriteLine[160]; //sprites for the current line already resolved to one pixel per x
+    uint8_t spriteLineSize; //LCDC bit 2 the line buffer was built with
+
+    uint32_t oamGeneration; //bumped on every CPU write into FE00-FE9F and every DMA
+    uint32_t indexGeneration; //oamGeneration the line index below was built from
+    uint8_t indexSize; //LCDC bit 2 the line index was built with
+    int indexValid;
+    uint8_t lineSprites[144][10]; //OAM indices of the sprites each visible line would select, in OAM order
+    uint8_t lineSpriteCount[144];
+    uint32_t indexRebuilds; //how often the index actually had to be rebuilt
+
+    //Deferred rendering, mode 3 only keeps time and lines get drawn from snapshots at VBlank
+    int deferredWorkers; //0 = draw inline like before, otherwise threads used at VBlank
+    int deferredActive; //current frame is being recorded instead of drawn
+    int serialFrames; //frames left to draw inline after a mid line register write
+    int lineDeferred; //current line's mode 3 is timing only
+    int currentLine;
+    int mode3Dots; //dots spent in mode 3 on the current line
+    uint32_t vramGeneration; //bumped on every write into 8000-9FFF
+    LineSnapshot lines[144];
+    uint8_t linePending[144]; //recorded but not drawn yet
+    int pendingCount;
+    uint32_t deferredFrames;
+    uint32_t midLineFallbacks;
+    uint32_t parallelFlushes;
+    uint32_t serialFlushes; //flushes forced early by a VRAM/OAM write
+    uint32_t staleLines; //lines drawn after their VRAM/OAM changed, should stay 0
+
+    //Frame skipping, a skipped frame keeps exact timing and interrupts but draws no pixels and publishes nothing
+    int skipFrame; //current frame is timing only
+    int skipNext; //set by the pacing, picked up at the start of the next VBlank
+    uint32_t skippedFrames;
+
+    uint8_t (*drawBuffer)[160]; //frame being drawn this frame, row major colour indices 0-3
+    uint8_t (*frontBuffer)[160]; //last completed frame, what getFramebuffer hands out
+    uint32_t frameSeq; //bumped every VBlank, 0 until the first frame completes
+    uint32_t packedSeq; //frameSeq the packed copy was last built for
+
+    //Event timing, stepPPU only runs on cycles where something other than a counter changes
+    uint64_t lastStepCycle; //systemCycles of the last cycle the PPU accounted for
+    uint64_t nextEventCycle; //PPU sleeps until systemCycles reaches this, 0 = run the next cycle
+    uint64_t activeCycles; //cycles stepPPU actually ran
 
 } PPUState;
 
 extern PPUState ppu;
 
 void initPPU();
-void stepPPU(SDL_Renderer *renderer);
+void stepPPU();
+void syncPPU();
 void LCDUpdate(int enable);
+void setDeferredRendering(int workers); //0 turns it off
+void syncDeferredLines(); //draws anything recorded but not drawn, call before VRAM/OAM change
+void sumFrame(); //folds the last finished frame into a checksum if it's a new one, a threaded run has to match an inline one
+void printRenderStats(); //that checksum, and how the deferred frames went when it's on
+
+//Read only access to the last completed frame, valid until the frame after next starts drawing.
+//frameSeq (optional) receives the sequence number of the returned frame.
+const uint8_t *getFramebuffer(uint32_t *frameSeq); //160x144 bytes, row major, one colour index per byte
+const uint8_t *getFramebufferPacked(uint32_t *frameSeq); //40x144 bytes, 2bpp, leftmost pixel in the top 2 bits
 
 #endif
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "present.h"
+#include "hud.h"
+#include "heatmap.h"
+
+PresentState present;
+
+//DMG greens, same shades the old per pixel drawDisplay used
+static const uint32_t shades[4] = {
+    0xFFE0F8D0, // lightest
+    0xFF88C070, // light
+    0xFF346856, // dark
+    0xFF081820  // darkest
+};
+
+void initPresent() {
+    memset(present.frames, 0, sizeof(present.frames));
+    SDL_AtomicSet(&present.middle, 1); //slot 0 = back, 1 = middle, 2 = front
+    present.back = 0;
+    present.front = 2;
+
+    SDL_AtomicSet(&present.running, 0);
+    SDL_AtomicSet(&present.publishedFrames, 0);
+    SDL_AtomicSet(&present.presentedFrames, 0);
+    SDL_AtomicSet(&present.droppedFrames, 0);
+    SDL_AtomicSet(&present.duplicatedFrames, 0);
+    SDL_AtomicSet(&present.renderNs, 0);
+
+    present.window = NULL;
+    present.thread = NULL;
+    present.frameReady = NULL;
+}
+
+//Called by the PPU at the start of VBlank, never blocks on the render thread
+void publishFrame(const uint8_t *frame) {
+    memcpy(present.frames[present.back], frame, sizeof(present.frames[0])); //same row major layout as the PPU
+
+    //hand the finished slot over and take whatever was in the middle as the new back buffer
+    int prev = SDL_AtomicSet(&present.middle, present.back | FRAME_FRESH);
+    if (prev & FRAME_FRESH) { //render thread never saw the previous frame
+        SDL_AtomicAdd(&present.droppedFrames, 1);
+    }
+    present.back = prev & FRAME_INDEX;
+    SDL_AtomicAdd(&present.publishedFrames, 1);
+
+    if (present.frameReady) SDL_SemPost(present.frameReady);
+}
+
+static void uploadFrame(SDL_Texture *texture, uint8_t frame[144][160]) {
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0) return;
+    for (int y = 0; y < 144; y++) {
+        uint32_t *row = (uint32_t *)((uint8_t *)pixels + y * pitch);
+        for (int x = 0; x < 160; x++) {
+            row[x] = shades[frame[y][x]];
+        }
+    }
+    SDL_UnlockTexture(texture);
+}
+
+//Render thread owns the renderer, every SDL_Render call happens here
+static int presentThread(void *data) {
+    (void)data;
+    SDL_Renderer *renderer = SDL_CreateRenderer(present.window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) {
+        printf("Failed to create renderer: %s\n", SDL_GetError());
+        return 1;
+    }
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 160, 144);
+    if (!texture) {
+        printf("Failed to create frame texture: %s\n", SDL_GetError());
+        SDL_DestroyRenderer(renderer);
+        return 1;
+    }
+    uploadFrame(texture, present.frames[present.front]);
+
+    while (SDL_AtomicGet(&present.running)) {
+        //wait about one 60Hz refresh for a new frame, otherwise show the old one again
+        if (SDL_SemWaitTimeout(present.frameReady, 17) == 0) {
+            while (SDL_SemTryWait(present.frameReady) == 0); //several frames may have been posted, only newest matters
+        }
+
+        uint64_t start = hudClock();
+        if (SDL_AtomicGet(&present.middle) & FRAME_FRESH) {
+            int prev = SDL_AtomicSet(&present.middle, present.front);
+            present.front = prev & FRAME_INDEX;
+            uploadFrame(texture, present.frames[present.front]);
+            SDL_AtomicAdd(&present.presentedFrames, 1);
+        } else {
+            SDL_AtomicAdd(&present.duplicatedFrames, 1);
+        }
+
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL); //scaled up to the 800x720 window
+        drawHud(renderer); //cached texture, only redrawn when the numbers change
+        SDL_AtomicAdd(&present.renderNs, (int)(hudClock() - start));
+        SDL_RenderPresent(renderer); //may block on vsync, emulation carries on regardless
+        drawHeatmap(); //second window, only when a new frame's counts came in
+    }
+
+    closeHudRenderer();
+    closeHeatmapRenderer();
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    return 0;
+}
+
+void startPresentThread(SDL_Window *window) {
+    present.window = window;
+    present.frameReady = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&present.running, 1);
+    present.thread = SDL_CreateThread(presentThread, "present", NULL);
+    if (!present.thread) {
+        printf("Failed to start present thread: %s\n", SDL_GetError());
+        SDL_AtomicSet(&present.running, 0);
+    }
+}
+
+void stopPresentThread() {
+    if (!present.thread) return;
+    SDL_AtomicSet(&present.running, 0);
+    SDL_SemPost(present.frameReady); //wake it up so it sees running == 0
+    SDL_WaitThread(present.thread, NULL);
+    present.thread = NULL;
+    SDL_DestroySemaphore(present.frameReady);
+    present.frameReady = NULL;
+}
+
+void printPresentStats() {
+    printf("Frames published: %d, presented: %d, dropped: %d, duplicated: %d\n",
+        SDL_AtomicGet(&present.publishedFrames), SDL_AtomicGet(&present.presentedFrames),
+        SDL_AtomicGet(&present.droppedFrames), SDL_AtomicGet(&present.duplicatedFrames));
+}
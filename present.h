@@ -0,0 +1,39 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //renderer, its thread and the frame handoff
+
+#define FRAME_INDEX 0x03 //slot index stored in the low bits of the shared slot
+#define FRAME_FRESH 0x04 //set when the shared slot holds a frame the render thread hasn't taken yet
+
+typedef struct {
+    uint8_t frames[3][144][160]; //triple buffer of colour indices, row major
+    SDL_atomic_t middle; //shared slot, swapped atomically between emulation and render thread
+    int back; //slot only the emulation thread writes into
+    int front; //slot only the render thread reads from
+
+    SDL_atomic_t running;
+    SDL_atomic_t publishedFrames; //frames completed by the PPU
+    SDL_atomic_t presentedFrames; //frames that reached the screen
+    SDL_atomic_t droppedFrames; //frames overwritten before the render thread picked them up
+    SDL_atomic_t duplicatedFrames; //presents that had to reuse the previous frame
+    SDL_atomic_t renderNs; //host ns spent uploading and drawing, vsync wait left out, wraps so only differences mean anything
+
+    SDL_Window *window;
+    SDL_Thread *thread;
+    SDL_sem *frameReady;
+} PresentState;
+
+extern PresentState present;
+
+void initPresent();
+void startPresentThread(SDL_Window *window);
+void stopPresentThread();
+void publishFrame(const uint8_t *frame);
+void printPresentStats();
+
+#endif
@@ -0,0 +1,112 @@
+#include "rtc.h"
+#include "cpu.h"
+#include "memory.h"
+#include "sram.h"
+
+RTCState rtc;
+
+static const uint8_t rtcMask[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1}; //bits that exist in each register
+
+void initRTC() {
+    memset(&rtc, 0, sizeof(rtc));
+    uint8_t type = memory.cartridge[0x147];
+    rtc.present = memory.mbcType == 3 && (type == 0x0F || type == 0x10);
+    rtc.lastCycle = systemCycles;
+}
+
+//Each counter only wraps at its real limit when it's in range, a game can write 60-63 seconds and
+//those count up to 63 and wrap to 0 without carrying into the minutes.
+static void tickSecond() {
+    uint8_t *r = rtc.regs;
+    r[RTC_SECONDS] = (r[RTC_SECONDS] + 1) & 0x3F;
+    if (r[RTC_SECONDS] != 60) return;
+    r[RTC_SECONDS] = 0;
+    r[RTC_MINUTES] = (r[RTC_MINUTES] + 1) & 0x3F;
+    if (r[RTC_MINUTES] != 60) return;
+    r[RTC_MINUTES] = 0;
+    r[RTC_HOURS] = (r[RTC_HOURS] + 1) & 0x1F;
+    if (r[RTC_HOURS] != 24) return;
+    r[RTC_HOURS] = 0;
+    if (++r[RTC_DAY_LOW] != 0) return;
+    if (r[RTC_DAY_HIGH] & 0x01) r[RTC_DAY_HIGH] = (r[RTC_DAY_HIGH] & ~0x01) | 0x80; //day 511 -> 0 sets the carry, it stays until written
+    else r[RTC_DAY_HIGH] |= 0x01;
+}
+
+static void advanceSeconds(uint64_t seconds) {
+    uint8_t *r = rtc.regs;
+    //out of range values have to go the slow way until they've wrapped
+    while (seconds > 0 && (r[RTC_SECONDS] >= 60 || r[RTC_MINUTES] >= 60 || r[RTC_HOURS] >= 24)) {
+        tickSecond();
+        seconds--;
+    }
+    if (seconds == 0) return;
+
+    uint64_t total = r[RTC_SECONDS] + seconds;
+    r[RTC_SECONDS] = total % 60;
+    total = r[RTC_MINUTES] + total / 60;
+    r[RTC_MINUTES] = total % 60;
+    total = r[RTC_HOURS] + total / 60;
+    r[RTC_HOURS] = total % 24;
+    uint64_t days = (((r[RTC_DAY_HIGH] & 0x01) << 8) | r[RTC_DAY_LOW]) + total / 24;
+    if (days >= 512) r[RTC_DAY_HIGH] |= 0x80;
+    days &= 0x1FF;
+    r[RTC_DAY_LOW] = days & 0xFF;
+    r[RTC_DAY_HIGH] = (r[RTC_DAY_HIGH] & ~0x01) | (days >> 8);
+}
+
+void syncRTC() {
+    uint64_t elapsed = systemCycles - rtc.lastCycle;
+    rtc.lastCycle = systemCycles;
+    if (rtc.regs[RTC_DAY_HIGH] & 0x40) return; //halted
+    uint64_t total = rtc.subsecond + elapsed;
+    rtc.subsecond = total % RTC_SECOND_CYCLES;
+    advanceSeconds(total / RTC_SECOND_CYCLES);
+}
+
+void latchRTC() {
+    syncRTC();
+    memcpy(memory.mbc3_rtc_regs, rtc.regs, sizeof(rtc.regs));
+}
+
+void writeRTC(int reg, uint8_t value) {
+    syncRTC(); //everything up to now counts at the old values, halt included
+    rtc.regs[reg] = value & rtcMask[reg];
+    if (reg == RTC_SECONDS) rtc.subsecond = 0; //writing seconds restarts the divider
+    markSRAMClock(); //a clock the game set has to survive a crash like its save does
+}
+
+static void putLE(uint8_t *p, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (value >> (i * 8)) & 0xFF;
+}
+
+static uint64_t getLE(const uint8_t *p, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) value |= (uint64_t)p[i] << (i * 8);
+    return value;
+}
+
+//5 live and 5 latched registers as 32 bit words, then the host time it was written, all little endian
+void buildRTCFooter(uint8_t footer[RTC_FOOTER_SIZE]) {
+    syncRTC();
+    for (int i = 0; i < 5; i++) {
+        putLE(&footer[i * 4], rtc.regs[i], 4);
+        putLE(&footer[20 + i * 4], memory.mbc3_rtc_regs[i], 4);
+    }
+    putLE(&footer[40], (uint64_t)time(NULL), 8);
+}
+
+void loadRTCFooter(FILE *f) {
+    if (!rtc.present) return;
+    uint8_t footer[RTC_FOOTER_SIZE];
+    size_t got = fread(footer, 1, sizeof(footer), f);
+    if (got != 44 && got != 48) return; //no clock saved yet, or a 32 bit timestamp from an older emulator
+    for (int i = 0; i < 5; i++) {
+        rtc.regs[i] = getLE(&footer[i * 4], 4) & rtcMask[i];
+        memory.mbc3_rtc_regs[i] = getLE(&footer[20 + i * 4], 4) & rtcMask[i];
+    }
+    int64_t saved = (int64_t)getLE(&footer[40], got - 40);
+    int64_t now = (int64_t)time(NULL); //only time the host clock is used, the console was off all this time
+    rtc.subsecond = 0;
+    rtc.lastCycle = systemCycles;
+    if (now > saved && !(rtc.regs[RTC_DAY_HIGH] & 0x40)) advanceSeconds((uint64_t)(now - saved));
+}
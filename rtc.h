@@ -0,0 +1,32 @@
+#ifndef RTC_H
+#define RTC_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+#define RTC_SECOND_CYCLES 4194304 //the cartridge's 32768Hz crystal, counted in T-cycles
+#define RTC_FOOTER_SIZE 48 //live regs, latched regs and a unix time after the RAM in .sav, the layout other emulators use
+
+enum { RTC_SECONDS, RTC_MINUTES, RTC_HOURS, RTC_DAY_LOW, RTC_DAY_HIGH }; //register order, same as banks 08-0C
+
+//MBC3 clock, runs off emulated cycles so it's deterministic and keeps up with fast forward.
+//Like the timer it's only worked out when something looks at it.
+typedef struct {
+    int present; //cartridge type has the timer, only then does it go in the .sav
+    uint8_t regs[5]; //live counters, DH bit 0 = day bit 8, bit 6 = halt, bit 7 = day carry
+    uint32_t subsecond; //cycles into the current second
+    uint64_t lastCycle; //counters are correct as of this cycle
+} RTCState;
+
+extern RTCState rtc;
+
+void initRTC(); //after loadROM
+void syncRTC();
+void latchRTC(); //0 then 1 written to 6000-7FFF, live counters copied into memory.mbc3_rtc_regs
+void writeRTC(int reg, uint8_t value);
+void buildRTCFooter(uint8_t footer[RTC_FOOTER_SIZE]);
+void loadRTCFooter(FILE *f); //also moves the clock on by however long the .sav sat there
+
+#endif
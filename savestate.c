@@ -0,0 +1,429 @@
+#include "savestate.h"
+#include "memory.h"
+#include "serial.h"
+#include "present.h"
+#include "sram.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+extern uint8_t framebuffers[2][144][160];
+
+StateWriter stateWriter;
+
+uint16_t romChecksum() {
+    return (memory.cartridge[0x14E] << 8) | memory.cartridge[0x14F];
+}
+
+void captureState(SaveState *state) {
+    syncDeferredLines(); //recorded scanlines have to be in the framebuffer before it gets copied
+
+    memset(state, 0, sizeof(*state));
+    state->magic = SAVESTATE_MAGIC;
+    state->version = SAVESTATE_VERSION;
+    state->size = sizeof(SaveState);
+    state->romChecksum = romChecksum();
+
+    state->cpu = CPUreg;
+    state->systemCycles = systemCycles;
+
+    memcpy(state->vram, memory.vram, sizeof(memory.vram));
+    memcpy(state->eram, memory.eram, sizeof(memory.eram));
+    memcpy(state->wram, memory.wram, sizeof(memory.wram));
+    memcpy(state->oam, memory.oam, sizeof(memory.oam));
+    memcpy(state->hram, memory.hram, sizeof(memory.hram));
+    memcpy(state->io, memory.io, sizeof(memory.io));
+    memcpy(state->unusable, memory.unusable, sizeof(memory.unusable));
+    state->ie_reg = memory.ie_reg;
+    state->mbc_rom_bank = memory.mbc_rom_bank;
+    state->mbc_ram_bank = memory.mbc_ram_bank;
+    state->mbc_ram_enable = memory.mbc_ram_enable;
+    state->mbc1_mode = memory.mbc1_mode;
+    memcpy(state->mbc3_rtc_regs, memory.mbc3_rtc_regs, sizeof(memory.mbc3_rtc_regs));
+    state->mbc3_rtc_latch = memory.mbc3_rtc_latch;
+    state->rtc = rtc;
+
+    state->ppu = ppu;
+    state->drawIndex = ppu.drawBuffer == framebuffers[0] ? 0 : 1;
+    memcpy(state->framebuffers, framebuffers, sizeof(framebuffers));
+
+    state->timer = timer;
+    state->input = input;
+    state->apu = apu;
+
+    state->serialActive = serial.active;
+    state->serialDoneCycle = serial.doneCycle;
+    state->serialOutByte = serial.outByte;
+}
+
+int restoreState(const SaveState *state) {
+    if (state->magic != SAVESTATE_MAGIC || state->version != SAVESTATE_VERSION || state->size != sizeof(SaveState)) {
+        printf("Savestate is from a different version of the emulator\n");
+        return -1;
+    }
+    if (state->romChecksum != romChecksum()) {
+        printf("Savestate is for a different ROM\n");
+        return -1;
+    }
+
+    syncDeferredLines(); //nothing may still be drawing into the framebuffers
+
+    CPUreg = state->cpu;
+    systemCycles = state->systemCycles;
+
+    memcpy(memory.vram, state->vram, sizeof(memory.vram));
+    memcpy(memory.eram, state->eram, sizeof(memory.eram));
+    markSRAMDirty(memory.eram, sizeof(memory.eram)); //battery RAM is whatever the state had now, the .sav follows
+    memcpy(memory.wram, state->wram, sizeof(memory.wram));
+    memcpy(memory.oam, state->oam, sizeof(memory.oam));
+    memcpy(memory.hram, state->hram, sizeof(memory.hram));
+    memcpy(memory.io, state->io, sizeof(memory.io));
+    memcpy(memory.unusable, state->unusable, sizeof(memory.unusable));
+    memory.ie_reg = state->ie_reg;
+    memory.mbc_rom_bank = state->mbc_rom_bank;
+    memory.mbc_ram_bank = state->mbc_ram_bank;
+    memory.mbc_ram_enable = state->mbc_ram_enable;
+    memory.mbc1_mode = state->mbc1_mode;
+    memcpy(memory.mbc3_rtc_regs, state->mbc3_rtc_regs, sizeof(memory.mbc3_rtc_regs));
+    memory.mbc3_rtc_latch = state->mbc3_rtc_latch;
+    rtc = state->rtc;
+    if (memory.mbcType != 0) updateBanks(); //ROM only carts never remap
+
+    int workers = ppu.deferredWorkers; //the render pool belongs to this process, not the state
+    ppu = state->ppu;
+    ppu.deferredWorkers = workers;
+    ppu.drawBuffer = framebuffers[state->drawIndex];
+    ppu.frontBuffer = framebuffers[!state->drawIndex];
+    ppu.packedSeq = 0; //packed copy is of a frame that isn't there anymore
+    memcpy(framebuffers, state->framebuffers, sizeof(framebuffers));
+
+    timer = state->timer;
+    input = state->input;
+    apu = state->apu;
+    resyncAudio(); //samples already made are from another timeline
+
+    serial.active = state->serialActive;
+    serial.doneCycle = state->serialDoneCycle;
+    serial.outByte = state->serialOutByte;
+    serial.nextEventCycle = 0; //reschedules itself next cycle
+
+    publishFrame(&ppu.frontBuffer[0][0]); //show where we are now, even when paused
+    return 0;
+}
+
+//Pack format, a byte stream of runs:
+//  0xxxxxxx  x+1 literal bytes follow
+//  10xxxxxx  x+3 zero bytes
+//  11xxxxxx  x+4 bytes copied from 'offset' back, then a 2 byte little endian offset
+//a 6 bit length of 63 carries on in extra bytes, each added on, 255 meaning another follows.
+//Zero runs get their own code since VRAM, WRAM and unused ERAM banks are mostly that.
+#define PACK_HASH_BITS 13
+
+static uint32_t packHash(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - PACK_HASH_BITS);
+}
+
+static uint8_t *packLiterals(uint8_t *out, const uint8_t *src, size_t n) {
+    while (n) {
+        size_t chunk = n > 128 ? 128 : n;
+        *out++ = (uint8_t)(chunk - 1);
+        memcpy(out, src, chunk);
+        out += chunk;
+        src += chunk;
+        n -= chunk;
+    }
+    return out;
+}
+
+static uint8_t *packRun(uint8_t *out, uint8_t code, size_t n) {
+    if (n < 63) {
+        *out++ = code | (uint8_t)n;
+        return out;
+    }
+    *out++ = code | 63;
+    n -= 63;
+    while (n >= 255) {
+        *out++ = 255;
+        n -= 255;
+    }
+    *out++ = (uint8_t)n;
+    return out;
+}
+
+size_t packState(const uint8_t *src, size_t len, uint8_t *dst) {
+    uint32_t table[1 << PACK_HASH_BITS]; //last position each hash was seen at, on the stack since movie snapshots pack on the emulation thread
+    memset(table, 0, sizeof(table));
+    uint8_t *out = dst;
+    size_t i = 0, literals = 0;
+
+    while (i + 4 <= len) {
+        if (src[i] == 0 && src[i + 1] == 0 && src[i + 2] == 0) {
+            size_t run = 3;
+            while (i + run < len && src[i + run] == 0) run++;
+            out = packLiterals(out, src + literals, i - literals);
+            out = packRun(out, 0x80, run - 3);
+            i += run;
+            literals = i;
+            continue;
+        }
+
+        uint32_t h = packHash(src + i);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)i;
+        if (candidate < i && i - candidate <= 0xFFFF && memcmp(src + candidate, src + i, 4) == 0) {
+            size_t match = 4;
+            while (i + match < len && src[candidate + match] == src[i + match]) match++;
+            out = packLiterals(out, src + literals, i - literals);
+            out = packRun(out, 0xC0, match - 4);
+            size_t offset = i - candidate;
+            *out++ = offset & 0xFF;
+            *out++ = offset >> 8;
+            i += match;
+            literals = i;
+            continue;
+        }
+        i++;
+    }
+    out = packLiterals(out, src + literals, len - literals);
+    return (size_t)(out - dst);
+}
+
+int unpackState(const uint8_t *src, size_t len, uint8_t *dst, size_t dstLen) {
+    const uint8_t *end = src + len;
+    size_t at = 0;
+    while (src < end) {
+        uint8_t code = *src++;
+        if (code < 0x80) {
+            size_t n = (size_t)code + 1;
+            if (n > (size_t)(end - src) || n > dstLen - at) return -1;
+            memcpy(dst + at, src, n);
+            src += n;
+            at += n;
+            continue;
+        }
+
+        size_t n = code & 63;
+        if (n == 63) {
+            uint8_t more;
+            do {
+                if (src >= end) return -1;
+                more = *src++;
+                n += more;
+            } while (more == 255);
+        }
+        if (code < 0xC0) {
+            n += 3;
+            if (n > dstLen - at) return -1;
+            memset(dst + at, 0, n);
+        } else {
+            n += 4;
+            if (end - src < 2) return -1;
+            size_t offset = src[0] | (src[1] << 8);
+            src += 2;
+            if (offset == 0 || offset > at || n > dstLen - at) return -1;
+            const uint8_t *from = dst + at - offset;
+            if (offset >= n) memcpy(dst + at, from, n);
+            else for (size_t k = 0; k < n; k++) dst[at + k] = from[k]; //overlapping, repeats the pattern
+        }
+        at += n;
+    }
+    return at == dstLen ? 0 : -1;
+}
+
+//Writer thread, packs the captured state and writes it next to the target, then renames it over,
+//so a crash halfway leaves the old state file as it was
+static int stateWriterThread(void *data) {
+    (void)data;
+    while (1) {
+        SDL_SemWait(stateWriter.wake);
+        if (!SDL_AtomicGet(&stateWriter.busy)) {
+            if (SDL_AtomicGet(&stateWriter.quit)) break;
+            continue;
+        }
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        PackedStateHeader *header = (PackedStateHeader *)stateWriter.packed;
+        header->magic = PACKED_STATE_MAGIC;
+        header->rawSize = sizeof(SaveState);
+        header->reserved = 0;
+        size_t packedSize = packState((const uint8_t *)stateWriter.state, sizeof(SaveState), stateWriter.packed + sizeof(*header));
+        header->packedSize = (uint32_t)packedSize;
+
+        char tmpPath[272];
+        snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", stateWriter.path);
+        FILE *f = fopen(tmpPath, "wb");
+        int ok = 0;
+        if (!f) {
+            perror("Failed to write savestate");
+        } else {
+            ok = fwrite(stateWriter.packed, 1, sizeof(*header) + packedSize, f) == sizeof(*header) + packedSize;
+            ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+            if (ok) remove(stateWriter.path); //rename won't replace a file there
+#endif
+            ok = ok && rename(tmpPath, stateWriter.path) == 0;
+            if (!ok) {
+                printf("Failed to write savestate %s\n", stateWriter.path);
+                remove(tmpPath);
+            }
+        }
+
+        if (ok) {
+            uint64_t took = SDL_GetPerformanceCounter() - start;
+            stateWriter.saves++;
+            stateWriter.rawBytes += sizeof(SaveState);
+            stateWriter.packedBytes += packedSize;
+            stateWriter.writeTicks += took;
+            printf("Saved state to %s (%u KB packed to %u KB, %.2f ms)\n", stateWriter.path,
+                (unsigned)(sizeof(SaveState) / 1024), (unsigned)((packedSize + 1023) / 1024),
+                took * 1000.0 / SDL_GetPerformanceFrequency());
+        }
+        SDL_AtomicSet(&stateWriter.busy, 0);
+    }
+    return 0;
+}
+
+static void waitForStateWriter() {
+    while (SDL_AtomicGet(&stateWriter.busy)) SDL_Delay(1);
+}
+
+int saveStateFile(const char *path) {
+    if (!stateWriter.thread) {
+        stateWriter.state = malloc(sizeof(SaveState));
+        stateWriter.packed = malloc(sizeof(PackedStateHeader) + PACK_BOUND(sizeof(SaveState)));
+        if (!stateWriter.state || !stateWriter.packed) return -1;
+        stateWriter.wake = SDL_CreateSemaphore(0);
+        SDL_AtomicSet(&stateWriter.busy, 0);
+        SDL_AtomicSet(&stateWriter.quit, 0);
+        stateWriter.thread = SDL_CreateThread(stateWriterThread, "savestate", NULL);
+        if (!stateWriter.thread) {
+            printf("Failed to start savestate writer: %s\n", SDL_GetError());
+            return -1;
+        }
+    }
+    waitForStateWriter(); //F5 twice in a row, the first one has to land before its buffers get reused
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    captureState(stateWriter.state);
+    stateWriter.captureTicks += SDL_GetPerformanceCounter() - start;
+    snprintf(stateWriter.path, sizeof(stateWriter.path), "%s", path);
+    SDL_AtomicSet(&stateWriter.busy, 1);
+    SDL_SemPost(stateWriter.wake);
+    return 0;
+}
+
+void finishStateWrites() {
+    if (!stateWriter.thread) return;
+    waitForStateWriter();
+    SDL_AtomicSet(&stateWriter.quit, 1);
+    SDL_SemPost(stateWriter.wake);
+    SDL_WaitThread(stateWriter.thread, NULL);
+    SDL_DestroySemaphore(stateWriter.wake);
+    free(stateWriter.state);
+    free(stateWriter.packed);
+    stateWriter.thread = NULL;
+    stateWriter.state = NULL;
+    stateWriter.packed = NULL;
+}
+
+//Whole file read only, mapped where there's mmap so the unpacker reads straight from the page cache
+static const uint8_t *mapStateFile(const char *path, size_t *size) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping keeps the file
+    if (data == MAP_FAILED) return NULL;
+    *size = (size_t)st.st_size;
+    return data;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = length > 0 ? malloc((size_t)length) : NULL;
+    if (data && fread(data, 1, (size_t)length, f) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = (size_t)length;
+    return data;
+#endif
+}
+
+static void unmapStateFile(const uint8_t *data, size_t size) {
+#ifndef _WIN32
+    munmap((void *)data, size);
+#else
+    (void)size;
+    free((void *)data);
+#endif
+}
+
+int loadStateFile(const char *path) {
+    waitForStateWriter(); //F5 then F8 loads what was just saved
+    uint64_t start = SDL_GetPerformanceCounter();
+    size_t size = 0;
+    const uint8_t *data = mapStateFile(path, &size);
+    if (!data) {
+        perror("Failed to open savestate");
+        return -1;
+    }
+
+    int result = -1;
+    uint32_t magic = 0;
+    if (size >= sizeof(magic)) memcpy(&magic, data, sizeof(magic));
+    if (magic == SAVESTATE_MAGIC) { //uncompressed, as older builds wrote them
+        if (size == sizeof(SaveState)) result = restoreState((const SaveState *)data);
+        else printf("Savestate %s is truncated\n", path);
+    } else if (magic == PACKED_STATE_MAGIC && size >= sizeof(PackedStateHeader)) {
+        const PackedStateHeader *header = (const PackedStateHeader *)data;
+        SaveState *state = malloc(sizeof(SaveState));
+        if (header->rawSize != sizeof(SaveState)) {
+            printf("Savestate is from a different version of the emulator\n");
+        } else if (header->packedSize > size - sizeof(*header) || !state
+            || unpackState(data + sizeof(*header), header->packedSize, (uint8_t *)state, sizeof(SaveState)) != 0) {
+            printf("Savestate %s is damaged\n", path);
+        } else {
+            result = restoreState(state);
+        }
+        free(state);
+    } else {
+        printf("%s isn't a savestate\n", path);
+    }
+    unmapStateFile(data, size);
+
+    if (result == 0) {
+        uint64_t took = SDL_GetPerformanceCounter() - start;
+        stateWriter.loads++;
+        stateWriter.loadTicks += took;
+        printf("Loaded state from %s in %.2f ms\n", path, took * 1000.0 / SDL_GetPerformanceFrequency());
+    }
+    return result;
+}
+
+void printStateStats() {
+    if (stateWriter.saves == 0 && stateWriter.loads == 0) return;
+    double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+    if (stateWriter.saves) {
+        printf("Savestates: %u saved, packed to %.1f%%, capture avg %.3f ms, pack and write avg %.2f ms\n",
+            stateWriter.saves, 100.0 * stateWriter.packedBytes / stateWriter.rawBytes,
+            stateWriter.captureTicks * msPerTick / stateWriter.saves, stateWriter.writeTicks * msPerTick / stateWriter.saves);
+    }
+    if (stateWriter.loads) {
+        printf("Savestates: %u loaded, avg %.2f ms\n", stateWriter.loads, stateWriter.loadTicks * msPerTick / stateWriter.loads);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //F5's writer thread and its semaphore
+
+#include "cpu.h"
+#include "ppu.h"
+#include "timer.h"
+#include "input.h"
+#include "apu.h"
+#include "rtc.h"
+
+#define SAVESTATE_MAGIC 0x54534247 //"GBST"
+#define SAVESTATE_VERSION 3
+#define PACKED_STATE_MAGIC 0x5A534247 //"GBSZ", a state file holding a compressed SaveState
+#define PACK_BOUND(n) ((n) + (n) / 128 + 16) //worst case packState output, all literals
+
+//Everything the emulated machine needs to carry on from a cycle, in one block.
+//The ROM and the memory map aren't in here, the map gets rebuilt from the MBC registers on restore.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; //sizeof(SaveState), a build with different struct layouts can't load it
+    uint16_t romChecksum; //global checksum from the cartridge header, 0x14E-0x14F
+
+    CPUState cpu;
+    uint64_t systemCycles;
+
+    uint8_t vram[0x2000];
+    uint8_t eram[0x2000 * 16];
+    uint8_t wram[0x2000];
+    uint8_t oam[0xA0];
+    uint8_t hram[0x7F];
+    uint8_t io[0x80];
+    uint8_t unusable[0x60];
+    uint8_t ie_reg;
+    uint8_t mbc_rom_bank;
+    uint8_t mbc_ram_bank;
+    uint8_t mbc_ram_enable;
+    uint8_t mbc1_mode;
+    uint8_t mbc3_rtc_regs[5];
+    uint8_t mbc3_rtc_latch;
+    RTCState rtc;
+
+    PPUState ppu; //buffer pointers are fixed up on restore
+    int drawIndex; //which of the two framebuffers ppu.drawBuffer was
+    uint8_t framebuffers[2][144][160];
+
+    TimerState timer;
+    InputState input;
+    APUState apu;
+
+    //serial transfer this side clocks, link cable state isn't saved
+    int serialActive;
+    uint64_t serialDoneCycle;
+    uint8_t serialOutByte;
+} SaveState;
+
+//State files are this header and then the packState stream. Plain SaveState files from before still load.
+typedef struct {
+    uint32_t magic;
+    uint32_t rawSize; //sizeof(SaveState) it unpacks to
+    uint32_t packedSize;
+    uint32_t reserved;
+} PackedStateHeader;
+
+//F5 only does the capture on the emulation thread, packing and file IO happen on a writer thread
+typedef struct {
+    SDL_Thread *thread;
+    SDL_sem *wake;
+    SDL_atomic_t busy; //writer owns state, packed and path while set
+    SDL_atomic_t quit;
+    SaveState *state;
+    uint8_t *packed;
+    char path[264];
+
+    //stats
+    uint32_t saves;
+    uint32_t loads;
+    uint64_t rawBytes;
+    uint64_t packedBytes;
+    uint64_t captureTicks; //emulation thread
+    uint64_t writeTicks; //writer thread, pack and write
+    uint64_t loadTicks;
+} StateWriter;
+
+extern StateWriter stateWriter;
+
+uint16_t romChecksum();
+void captureState(SaveState *state);
+int restoreState(const SaveState *state); //0 on success
+size_t packState(const uint8_t *src, size_t len, uint8_t *dst); //dst holds PACK_BOUND(len), returns bytes used
+int unpackState(const uint8_t *src, size_t len, uint8_t *dst, size_t dstLen); //0 when it fills dst exactly
+int saveStateFile(const char *path); //returns once captured, the file shows up a little later
+int loadStateFile(const char *path);
+void finishStateWrites(); //waits for the writer and stops it
+void printStateStats();
+
+#endif
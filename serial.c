@@ -0,0 +1,528 @@
+#include "serial.h"
+#include "cpu.h"
+#include "memory.h"
+#include "testrom.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+SerialState serial;
+
+void initSerial() {
+    memset(&serial, 0, sizeof(serial));
+    serial.transport = LINK_NONE;
+    serial.fd = -1;
+    serial.nextEventCycle = UINT64_MAX; //nothing to do until SC is written
+    serial.sink.echo = 1;
+}
+
+//Output sink, replaces the printf + fflush per byte
+void flushSerialEcho() {
+    SerialSink *sink = &serial.sink;
+    if (sink->echo && sink->echoed < sink->length) {
+        fwrite(sink->text + sink->echoed, 1, sink->length - sink->echoed, stdout);
+        fflush(stdout);
+    }
+    sink->echoed = sink->length;
+}
+
+static void sinkByte(uint8_t byte) {
+    SerialSink *sink = &serial.sink;
+    if (sink->length == SERIAL_SINK_SIZE) { //keep the newer half, results are always at the end
+        flushSerialEcho();
+        int keep = SERIAL_SINK_SIZE / 2;
+        memmove(sink->text, sink->text + sink->length - keep, keep);
+        sink->length = keep;
+        sink->echoed = keep;
+    }
+    sink->text[sink->length++] = (char)byte;
+    sink->text[sink->length] = 0;
+    sink->total++;
+    if (byte == '\n') flushSerialEcho();
+    checkSerialResult();
+}
+
+const char *serialOutput() {
+    return serial.sink.text;
+}
+
+int serialOutputContains(const char *pattern) {
+    return strstr(serial.sink.text, pattern) != NULL;
+}
+
+int serialOutputEndsWith(const char *pattern) {
+    int n = (int)strlen(pattern);
+    return n <= serial.sink.length && memcmp(serial.sink.text + serial.sink.length - n, pattern, n) == 0;
+}
+
+void clearSerialOutput() {
+    flushSerialEcho();
+    serial.sink.length = 0;
+    serial.sink.echoed = 0;
+    serial.sink.total = 0;
+    serial.sink.text[0] = 0;
+}
+
+void setSerialEcho(int echo) {
+    flushSerialEcho();
+    serial.sink.echo = echo;
+}
+
+static uint64_t linkTime() {
+    return systemCycles - serial.epoch;
+}
+
+//Other side went away, behaves like the cable got pulled out
+static void dropLink() {
+    if (!serial.connected) return;
+    serial.connected = 0;
+    printf("Link partner disconnected\n");
+}
+
+//Transports, both only ever move whole LinkMessages
+#ifndef _WIN32
+
+static LinkRing *txRing() { return &serial.shared->rings[serial.isHost ? 0 : 1]; }
+static LinkRing *rxRing() { return &serial.shared->rings[serial.isHost ? 1 : 0]; }
+static int peerClosed() { return SDL_AtomicGet(&serial.shared->closed[serial.isHost ? 1 : 0]); }
+
+static int sendMessage(uint8_t type, uint8_t data, uint64_t stamp) {
+    if (!serial.connected) return 0;
+    LinkMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    msg.data = data;
+    msg.cycle = linkTime();
+    msg.stamp = stamp;
+
+    if (serial.transport == LINK_SOCKET) {
+        const uint8_t *p = (const uint8_t *)&msg;
+        size_t left = sizeof(msg);
+        while (left > 0) {
+            ssize_t n = send(serial.fd, p, left, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                struct pollfd pfd = { serial.fd, POLLOUT, 0 };
+                poll(&pfd, 1, 1);
+                continue;
+            }
+            if (n <= 0) {
+                dropLink();
+                return 0;
+            }
+            p += n;
+            left -= n;
+        }
+    }
+    else {
+        LinkRing *ring = txRing();
+        unsigned head = (unsigned)SDL_AtomicGet(&ring->head);
+        while (head - (unsigned)SDL_AtomicGet(&ring->tail) >= LINK_RING_SIZE) { //full, other side hasn't caught up on reading
+            if (peerClosed()) {
+                dropLink();
+                return 0;
+            }
+            sched_yield();
+        }
+        ring->slots[head & (LINK_RING_SIZE - 1)] = msg;
+        SDL_AtomicSet(&ring->head, (int)(head + 1)); //publish only once the slot is written
+    }
+    serial.messagesSent++;
+    return 1;
+}
+
+//Never blocks, 1 if a whole message came in
+static int receiveMessage(LinkMessage *msg) {
+    if (!serial.connected) return 0;
+    if (serial.transport == LINK_SOCKET) {
+        while (serial.rxCount < (int)sizeof(LinkMessage)) { //stream socket, a message can arrive in pieces
+            ssize_t n = recv(serial.fd, serial.rxBuffer + serial.rxCount, sizeof(LinkMessage) - serial.rxCount, MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+            if (n <= 0) {
+                dropLink();
+                return 0;
+            }
+            serial.rxCount += n;
+        }
+        memcpy(msg, serial.rxBuffer, sizeof(*msg));
+        serial.rxCount = 0;
+    }
+    else {
+        LinkRing *ring = rxRing();
+        unsigned tail = (unsigned)SDL_AtomicGet(&ring->tail);
+        if (tail == (unsigned)SDL_AtomicGet(&ring->head)) {
+            if (peerClosed()) dropLink();
+            return 0;
+        }
+        *msg = ring->slots[tail & (LINK_RING_SIZE - 1)];
+        SDL_AtomicSet(&ring->tail, (int)(tail + 1));
+    }
+    serial.messagesReceived++;
+    return 1;
+}
+
+//Gives the other side a moment while this one has to wait for it
+static void waitForMessage() {
+    if (serial.transport == LINK_SOCKET) {
+        struct pollfd pfd = { serial.fd, POLLIN, 0 };
+        poll(&pfd, 1, 1);
+    }
+    else {
+        sched_yield();
+    }
+}
+
+static int openSocket(const char *path, int host) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Link socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Failed to create link socket");
+        return 0;
+    }
+
+    if (host) {
+        unlink(path); //left over from a previous run
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+            perror("Failed to listen on link socket");
+            close(fd);
+            return 0;
+        }
+        printf("Waiting for link partner on %s...\n", path);
+        int peer = accept(fd, NULL, NULL);
+        close(fd);
+        if (peer < 0) {
+            perror("Failed to accept link partner");
+            return 0;
+        }
+        fd = peer;
+    }
+    else {
+        int tries = 0;
+        while (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            if (++tries == 50) { //host gets 5 seconds to come up
+                perror("Failed to connect link socket");
+                close(fd);
+                return 0;
+            }
+            SDL_Delay(100);
+        }
+    }
+    serial.fd = fd;
+    return 1;
+}
+
+static int openShared(const char *name, int host) {
+    int fd = -1;
+    if (host) {
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+        if (fd >= 0 && ftruncate(fd, sizeof(LinkShared)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else {
+        for (int tries = 0; tries < 50 && fd < 0; tries++) { //host gets 5 seconds to create it
+            fd = shm_open(name, O_RDWR, 0600);
+            struct stat info;
+            if (fd >= 0 && (fstat(fd, &info) < 0 || info.st_size < (off_t)sizeof(LinkShared))) { //caught it before ftruncate
+                close(fd);
+                fd = -1;
+            }
+            if (fd < 0) SDL_Delay(100);
+        }
+    }
+    if (fd < 0) {
+        perror("Failed to open link shared memory");
+        return 0;
+    }
+
+    LinkShared *shared = mmap(NULL, sizeof(LinkShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); //mapping stays valid
+    if (shared == MAP_FAILED) {
+        perror("Failed to map link shared memory");
+        return 0;
+    }
+    serial.shared = shared;
+
+    if (host) { //ftruncate zero fills, clearing it again here could wipe a joiner that already got in
+        printf("Waiting for link partner on %s...\n", name);
+        while (!SDL_AtomicGet(&shared->joined)) SDL_Delay(1);
+    }
+    else {
+        SDL_AtomicSet(&shared->joined, 1);
+    }
+    return 1;
+}
+
+static void closeTransport() {
+    if (serial.transport == LINK_SOCKET) {
+        if (serial.fd >= 0) close(serial.fd);
+        if (serial.isHost) unlink(serial.name);
+        serial.fd = -1;
+    }
+    else if (serial.shared) {
+        SDL_AtomicSet(&serial.shared->closed[serial.isHost ? 0 : 1], 1);
+        munmap(serial.shared, sizeof(LinkShared));
+        if (serial.isHost) shm_unlink(serial.name);
+        serial.shared = NULL;
+    }
+}
+
+#else //no Unix sockets or POSIX shared memory, link cable stays unplugged
+
+static int sendMessage(uint8_t type, uint8_t data, uint64_t stamp) { (void)type; (void)data; (void)stamp; return 0; }
+static int receiveMessage(LinkMessage *msg) { (void)msg; return 0; }
+static void waitForMessage() {}
+static int openSocket(const char *path, int host) { (void)path; (void)host; printf("Link cable isn't supported on this platform\n"); return 0; }
+static int openShared(const char *name, int host) { (void)name; (void)host; printf("Link cable isn't supported on this platform\n"); return 0; }
+static void closeTransport() {}
+
+#endif
+
+static void handleMessage(const LinkMessage *msg) {
+    if (msg->cycle > serial.peerTime) serial.peerTime = msg->cycle; //every message carries the sender's clock
+    switch (msg->type) {
+        case LINK_XFER: { //other side is clocking a byte into us
+            if (serial.incomingCount == LINK_INCOMING_SIZE) break;
+            LinkIncoming *in = &serial.incoming[(serial.incomingHead + serial.incomingCount++) & (LINK_INCOMING_SIZE - 1)];
+            in->start = msg->cycle;
+            in->byte = msg->data;
+            in->stamp = msg->stamp;
+            in->armed = 0;
+            in->replied = 0;
+            break;
+        }
+        case LINK_REPLY: {
+            serial.replyReady = 1;
+            serial.replyByte = msg->data;
+            uint64_t rtt = SDL_GetPerformanceCounter() - msg->stamp;
+            serial.rttTicks += rtt;
+            if (rtt > serial.rttMaxTicks) serial.rttMaxTicks = rtt;
+            serial.rttSamples++;
+            break;
+        }
+        case LINK_BYE:
+            dropLink();
+            break;
+    }
+}
+
+static void pumpLink() {
+    LinkMessage msg;
+    while (receiveMessage(&msg)) handleMessage(&msg);
+}
+
+static void sendSync() {
+    sendMessage(LINK_SYNC, 0, 0);
+    serial.lastSyncCycle = systemCycles;
+}
+
+//Both sides exchange HELLO so they agree on when link time 0 was
+static int handshake() {
+    serial.connected = 1;
+    serial.epoch = systemCycles;
+    serial.peerTime = 0;
+    if (!sendMessage(LINK_HELLO, 0, 0)) return 0;
+
+    LinkMessage msg;
+    while (serial.connected) {
+        if (receiveMessage(&msg)) {
+            if (msg.type == LINK_HELLO) break;
+            handleMessage(&msg);
+        }
+        else waitForMessage();
+    }
+    if (!serial.connected) return 0;
+
+    serial.epoch = systemCycles; //neither side has run since sending HELLO
+    serial.historyCount = 0; //link times from before this mean nothing now
+    serial.lastSyncCycle = systemCycles;
+    serial.startTicks = SDL_GetPerformanceCounter();
+    serial.startCycles = systemCycles;
+    serial.nextEventCycle = 0;
+    printf("Link cable connected\n");
+    return 1;
+}
+
+static int openLink(LinkTransport transport, const char *name, int host) {
+    closeLink();
+    serial.transport = transport;
+    serial.isHost = host;
+    if (transport == LINK_SHM && name[0] != '/') snprintf(serial.name, sizeof(serial.name), "/%s", name); //shm names need the slash
+    else snprintf(serial.name, sizeof(serial.name), "%s", name);
+
+    int ok = transport == LINK_SOCKET ? openSocket(serial.name, host) : openShared(serial.name, host);
+    if (ok) ok = handshake();
+    if (!ok) {
+        closeTransport();
+        serial.connected = 0;
+        serial.transport = LINK_NONE;
+    }
+    return ok;
+}
+
+int hostLink(LinkTransport transport, const char *name) {
+    return openLink(transport, name, 1);
+}
+
+int joinLink(LinkTransport transport, const char *name) {
+    return openLink(transport, name, 0);
+}
+
+void closeLink() {
+    if (serial.transport == LINK_NONE) return;
+    sendMessage(LINK_BYE, 0, 0);
+    serial.connected = 0;
+    closeTransport();
+    serial.transport = LINK_NONE;
+}
+
+static void scheduleSerial() {
+    uint64_t next = UINT64_MAX;
+    if (serial.active && serial.doneCycle < next) next = serial.doneCycle;
+    if (serial.incomingCount) {
+        const LinkIncoming *in = &serial.incoming[serial.incomingHead];
+        uint64_t at = serial.epoch + in->start + (in->replied ? SERIAL_TRANSFER_CYCLES : 0);
+        if (at < next) next = at;
+    }
+    if (serial.connected) {
+        uint64_t sync = serial.lastSyncCycle + LINK_SYNC_INTERVAL;
+        uint64_t limit = serial.epoch + serial.peerTime + LINK_WINDOW; //a transfer started at peerTime finishes here, need a newer clock to run it
+        if (sync < next) next = sync;
+        if (limit < next) next = limit;
+    }
+    serial.nextEventCycle = next;
+}
+
+//Called before SB or SC change, the other side's clock may start a transfer at a link time we've already run past
+static void rememberRegisters() {
+    if (!serial.connected) return;
+    LinkRegisterChange *change = &serial.history[serial.historyCount++ & (LINK_HISTORY_SIZE - 1)];
+    change->cycle = linkTime();
+    change->sb = *memory.memoryMap[0xFF01];
+    change->sc = *memory.memoryMap[0xFF02];
+}
+
+//SB and SC as they were at link time `at`, undoes the newer changes
+static void registersAt(uint64_t at, uint8_t *sb, uint8_t *sc) {
+    *sb = *memory.memoryMap[0xFF01];
+    *sc = *memory.memoryMap[0xFF02];
+    unsigned kept = serial.historyCount < LINK_HISTORY_SIZE ? serial.historyCount : LINK_HISTORY_SIZE;
+    for (unsigned i = 1; i <= kept; i++) {
+        const LinkRegisterChange *change = &serial.history[(serial.historyCount - i) & (LINK_HISTORY_SIZE - 1)];
+        if (change->cycle <= at) break;
+        *sb = change->sb;
+        *sc = change->sc;
+    }
+}
+
+static void finishTransfer(uint8_t received) {
+    rememberRegisters();
+    *memory.memoryMap[0xFF01] = received;
+    *memory.memoryMap[0xFF02] &= ~0x80; // clear SC
+    *memory.memoryMap[0xFF0F] |= 0x08; // request serial interrupt
+    serial.transfers++;
+}
+
+void stepSerial() {
+    if (systemCycles < serial.nextEventCycle) return;
+
+    if (serial.connected) {
+        pumpLink();
+        if (systemCycles - serial.lastSyncCycle >= LINK_SYNC_INTERVAL) sendSync();
+
+        //a byte the other side clocks has to land on the same link cycle here, so never get more than a transfer ahead of it
+        if (linkTime() >= serial.peerTime + LINK_WINDOW) {
+            uint64_t start = SDL_GetPerformanceCounter();
+            sendSync(); //it may be waiting on us too
+            while (serial.connected && linkTime() >= serial.peerTime + LINK_WINDOW) {
+                waitForMessage();
+                pumpLink();
+            }
+            serial.stalls++;
+            serial.stallTicks += SDL_GetPerformanceCounter() - start;
+        }
+    }
+
+    while (serial.incomingCount) {
+        LinkIncoming *in = &serial.incoming[serial.incomingHead];
+        if (!in->replied) {
+            if (linkTime() < in->start) break;
+            //shift register holds SB when the clock starts, that's what goes back
+            //we can be up to LINK_WINDOW past that already when the message comes in, so look both up as of then
+            uint8_t sb, sc;
+            registersAt(in->start, &sb, &sc);
+            in->armed = (sc & 0x81) == 0x80;
+            sendMessage(LINK_REPLY, in->armed ? sb : 0xFF, in->stamp);
+            in->replied = 1;
+        }
+        if (linkTime() < in->start + SERIAL_TRANSFER_CYCLES) break;
+        if (in->armed && (*memory.memoryMap[0xFF02] & 0x81) == 0x80) finishTransfer(in->byte);
+        serial.incomingHead = (serial.incomingHead + 1) & (LINK_INCOMING_SIZE - 1);
+        serial.incomingCount--;
+    }
+
+    if (serial.active && systemCycles >= serial.doneCycle) {
+        if (serial.connected && !serial.replyReady) { //other side hasn't answered yet, only happens on a slow link
+            uint64_t start = SDL_GetPerformanceCounter();
+            while (serial.connected && !serial.replyReady) {
+                pumpLink();
+                if (!serial.replyReady) waitForMessage();
+            }
+            serial.stalls++;
+            serial.stallTicks += SDL_GetPerformanceCounter() - start;
+        }
+        finishTransfer(serial.replyReady ? serial.replyByte : 0xFF); //no cable reads all 1s
+        serial.active = 0;
+        sinkByte(serial.outByte);
+    }
+
+    scheduleSerial();
+}
+
+void writeSerial(uint16_t addr, uint8_t value) {
+    rememberRegisters();
+    *memory.memoryMap[addr] = value;
+    if (addr != 0xFF02) return;
+
+    if ((value & 0x81) == 0x81 && !serial.active) { //internal clock, this side drives the transfer
+        serial.active = 1;
+        serial.doneCycle = systemCycles + SERIAL_TRANSFER_CYCLES;
+        serial.outByte = *memory.memoryMap[0xFF01];
+        serial.replyReady = 0;
+        sendMessage(LINK_XFER, serial.outByte, SDL_GetPerformanceCounter());
+    }
+    //external clock just waits for the other side's LINK_XFER
+    serial.nextEventCycle = 0;
+}
+
+void printLinkStats() {
+    if (serial.startTicks == 0) return; //never connected
+    double freq = (double)SDL_GetPerformanceFrequency();
+    double seconds = (SDL_GetPerformanceCounter() - serial.startTicks) / freq;
+    double speed = seconds > 0 ? (systemCycles - serial.startCycles) / seconds / 4194304.0 * 100.0 : 0;
+    printf("Link: %llu transfers, %llu messages sent, %llu received\n",
+        (unsigned long long)serial.transfers, (unsigned long long)serial.messagesSent, (unsigned long long)serial.messagesReceived);
+    printf("Link round trip: avg %.1f us, max %.1f us over %llu transfers\n",
+        serial.rttSamples ? serial.rttTicks / freq / serial.rttSamples * 1e6 : 0.0, serial.rttMaxTicks / freq * 1e6,
+        (unsigned long long)serial.rttSamples);
+    printf("Link stalls: %llu, %.1f ms waiting, emulation speed %.1f%%\n",
+        (unsigned long long)serial.stalls, serial.stallTicks / freq * 1e3, speed);
+}
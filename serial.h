@@ -0,0 +1,135 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //atomics for the shared memory link, and timing
+
+#define SERIAL_TRANSFER_CYCLES 4096 //8 bits clocked at 8192Hz
+#define LINK_SYNC_INTERVAL 1024 //cycles between clock reports to the other side
+#define LINK_WINDOW SERIAL_TRANSFER_CYCLES //how far one side may run ahead, a transfer can't land any sooner than this
+#define LINK_RING_SIZE 256 //messages per direction in the shared memory ring, power of 2
+#define SERIAL_SINK_SIZE 4096 //bytes of serial output kept around for matching
+#define LINK_INCOMING_SIZE 4 //transfers from the other side in flight, the window only ever allows 2, power of 2
+#define LINK_HISTORY_SIZE 512 //SB/SC changes remembered, a write takes at least 8 cycles so this covers LINK_WINDOW
+
+typedef enum {
+    LINK_NONE,
+    LINK_SOCKET, //Unix domain socket, other process
+    LINK_SHM //shared memory ring, other process on the same machine
+} LinkTransport;
+
+enum {
+    LINK_HELLO, //handshake, both sides start link time at 0
+    LINK_SYNC, //sender's clock, lets the other side run up to it + LINK_WINDOW
+    LINK_XFER, //internal clock side started a transfer
+    LINK_REPLY, //external clock side's byte for that transfer
+    LINK_BYE
+};
+
+typedef struct {
+    uint8_t type;
+    uint8_t data;
+    uint8_t pad[6];
+    uint64_t cycle; //sender's link time when it was sent
+    uint64_t stamp; //performance counter when the transfer started, echoed in the reply for round trip time
+} LinkMessage;
+
+typedef struct {
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    LinkMessage slots[LINK_RING_SIZE];
+} LinkRing;
+
+typedef struct {
+    SDL_atomic_t joined;
+    SDL_atomic_t closed[2];
+    LinkRing rings[2]; //host writes 0 and reads 1, joiner the other way round
+} LinkShared;
+
+typedef struct {
+    char text[SERIAL_SINK_SIZE + 1]; //always NUL terminated, oldest half dropped when full
+    int length;
+    uint64_t total; //bytes received since the last clear
+    int echo; //copy to stdout, a line at a time
+    int echoed; //text before this is already on stdout
+} SerialSink; //everything the game sent out over serial, test ROMs print their results here
+
+typedef struct {
+    uint64_t start; //link time the other side started it
+    uint64_t stamp;
+    uint8_t byte;
+    uint8_t armed; //SC bit 7 was set when the transfer started
+    uint8_t replied;
+} LinkIncoming;
+
+typedef struct {
+    uint64_t cycle; //link time of the change
+    uint8_t sb; //values before it
+    uint8_t sc;
+} LinkRegisterChange;
+
+typedef struct {
+    SerialSink sink;
+
+    //transfer this side clocks (SC = 0x81)
+    int active;
+    uint64_t doneCycle; //systemCycles the transfer finishes
+    uint8_t outByte;
+    int replyReady;
+    uint8_t replyByte;
+
+    //transfers the other side clocks into us (SC = 0x80), it can start the next one before we've finished this one
+    LinkIncoming incoming[LINK_INCOMING_SIZE];
+    unsigned incomingHead;
+    unsigned incomingCount;
+    LinkRegisterChange history[LINK_HISTORY_SIZE]; //so a transfer that starts in our past still sees SB/SC as they were then
+    unsigned historyCount;
+
+    uint64_t nextEventCycle; //stepSerial has nothing to do before this
+
+    //link
+    LinkTransport transport;
+    int connected;
+    int isHost;
+    uint64_t epoch; //systemCycles at link time 0
+    uint64_t peerTime; //newest link time the other side reported
+    uint64_t lastSyncCycle; //systemCycles of the last clock report sent
+    int fd;
+    uint8_t rxBuffer[sizeof(LinkMessage)];
+    int rxCount;
+    char name[108]; //socket path or shm name
+    LinkShared *shared;
+
+    //stats
+    uint64_t transfers;
+    uint64_t messagesSent;
+    uint64_t messagesReceived;
+    uint64_t stalls; //times this side had to wait for the other one
+    uint64_t stallTicks;
+    uint64_t rttTicks; //summed round trips of started transfers
+    uint64_t rttMaxTicks;
+    uint64_t rttSamples;
+    uint64_t startTicks; //performance counter and cycle count when the link came up, for speed
+    uint64_t startCycles;
+} SerialState;
+
+extern SerialState serial;
+
+void initSerial();
+int hostLink(LinkTransport transport, const char *name);
+int joinLink(LinkTransport transport, const char *name);
+void closeLink();
+void stepSerial();
+void writeSerial(uint16_t addr, uint8_t value);
+void printLinkStats();
+const char *serialOutput();
+int serialOutputContains(const char *pattern);
+int serialOutputEndsWith(const char *pattern);
+void clearSerialOutput();
+void setSerialEcho(int echo);
+void flushSerialEcho();
+
+#endif
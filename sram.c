@@ -0,0 +1,175 @@
+#include "sram.h"
+#include "memory.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+SRAMState sram;
+
+static size_t sramSize() {
+    return (size_t)memory.totalRamBanks * 0x2000;
+}
+
+static void syncFile() {
+    fflush(sram.file);
+#ifndef _WIN32
+    fsync(fileno(sram.file));
+#endif
+    sram.fsyncs++;
+}
+
+//Writer thread, only ever does file IO so a slow disk can't hold up emulation
+static int sramWriter(void *data) {
+    (void)data;
+    uint32_t lastSync = 0;
+    int unsynced = 0;
+    while (1) {
+        SDL_SemWaitTimeout(sram.wake, SRAM_FSYNC_MS);
+        int quitting = SDL_AtomicGet(&sram.quit);
+
+        if (SDL_AtomicGet(&sram.busy)) {
+            uint32_t start = SDL_GetTicks();
+            for (int i = 0; i < sram.batchCount; i++) {
+                fseek(sram.file, (long)sram.batchPages[i] * SRAM_PAGE_SIZE, SEEK_SET);
+                fwrite(sram.batchData[i], 1, SRAM_PAGE_SIZE, sram.file);
+            }
+            if (sram.batchHasFooter) {
+                fseek(sram.file, (long)sramSize(), SEEK_SET);
+                fwrite(sram.batchFooter, 1, RTC_FOOTER_SIZE, sram.file);
+            }
+            fflush(sram.file); //in the OS now, a crash of this process can't lose it
+            sram.flushes++;
+            sram.pagesWritten += sram.batchCount;
+            uint32_t took = SDL_GetTicks() - start;
+            if (took > sram.maxFlushMs) sram.maxFlushMs = took;
+            unsynced = 1;
+            SDL_AtomicSet(&sram.busy, 0); //emulation thread may fill the batch again
+        }
+
+        if (unsynced && (quitting || SDL_GetTicks() - lastSync >= SRAM_FSYNC_MS)) {
+            syncFile(); //to the disk too, survives power loss
+            lastSync = SDL_GetTicks();
+            unsynced = 0;
+        }
+        if (quitting && !SDL_AtomicGet(&sram.busy)) break;
+    }
+    return 0;
+}
+
+int openSRAM(const char *romname) {
+    memset(sram.dirty, 0, sizeof(sram.dirty));
+    sram.dirtyCount = 0;
+    if (sramSize() == 0 && !rtc.present) return 0; //no battery, nothing to keep
+
+    char savename[256];
+    snprintf(savename, sizeof(savename), "%s.sav", romname);
+    sram.file = fopen(savename, "r+b");
+    if (!sram.file) sram.file = fopen(savename, "w+b"); //first run, make it
+    if (!sram.file) {
+        perror("Failed to open save file");
+        return -1;
+    }
+
+    //whole image once so the file is the right size, pages get written into it from then on
+    fseek(sram.file, 0, SEEK_SET);
+    fwrite(memory.eram, 1, sramSize(), sram.file);
+    if (rtc.present) {
+        uint8_t footer[RTC_FOOTER_SIZE];
+        buildRTCFooter(footer);
+        fwrite(footer, 1, sizeof(footer), sram.file);
+    }
+    fflush(sram.file);
+
+    SDL_AtomicSet(&sram.busy, 0);
+    SDL_AtomicSet(&sram.quit, 0);
+    sram.seenWrites = sram.writes;
+    sram.pending = 0;
+    sram.wake = SDL_CreateSemaphore(0);
+    sram.thread = SDL_CreateThread(sramWriter, "sram", NULL);
+    if (!sram.thread) {
+        printf("Failed to start save file writer: %s\n", SDL_GetError());
+        fclose(sram.file);
+        sram.file = NULL;
+        return -1;
+    }
+    sram.active = 1;
+    return 0;
+}
+
+void markSRAMDirty(const uint8_t *ptr, size_t len) {
+    if (ptr < memory.eram || ptr >= memory.eram + sramSize() || len == 0) return;
+    size_t offset = (size_t)(ptr - memory.eram);
+    if (offset + len > sramSize()) len = sramSize() - offset;
+    size_t first = offset / SRAM_PAGE_SIZE;
+    size_t last = (offset + len - 1) / SRAM_PAGE_SIZE;
+    for (size_t page = first; page <= last; page++) {
+        uint32_t bit = 1u << (page & 31);
+        if (!(sram.dirty[page >> 5] & bit)) {
+            sram.dirty[page >> 5] |= bit;
+            sram.dirtyCount++;
+        }
+    }
+    sram.writes++;
+}
+
+void markSRAMClock() {
+    if (rtc.present) sram.writes++; //every batch carries the footer, this only makes sure one goes out
+}
+
+//Copies the dirty pages out for the writer, only ever a few KB, and the clock when there is one
+static void handOff() {
+    sram.batchCount = 0;
+    for (int word = 0; word < SRAM_PAGES / 32; word++) {
+        uint32_t bits = sram.dirty[word];
+        while (bits) {
+            int page = word * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+            sram.batchPages[sram.batchCount] = page;
+            memcpy(sram.batchData[sram.batchCount], &memory.eram[page * SRAM_PAGE_SIZE], SRAM_PAGE_SIZE);
+            sram.batchCount++;
+        }
+        sram.dirty[word] = 0;
+    }
+    sram.dirtyCount = 0;
+    sram.batchHasFooter = rtc.present;
+    if (sram.batchHasFooter) buildRTCFooter(sram.batchFooter);
+    SDL_AtomicSet(&sram.busy, 1);
+    SDL_SemPost(sram.wake);
+}
+
+void stepSRAM() {
+    if (!sram.active) return;
+    uint32_t now = SDL_GetTicks();
+    if (sram.writes != sram.seenWrites) { //written since last time, the quiet period starts over
+        if (!sram.pending) sram.firstDirtyTicks = now;
+        sram.pending = 1;
+        sram.seenWrites = sram.writes;
+        sram.lastWriteTicks = now;
+    }
+    if (!sram.pending) return;
+    if (now - sram.lastWriteTicks < SRAM_QUIET_MS && now - sram.firstDirtyTicks < SRAM_MAX_DELAY_MS) return;
+    if (SDL_AtomicGet(&sram.busy)) return; //writer still on the last batch, pages stay dirty until next frame
+    handOff();
+    sram.pending = 0;
+}
+
+void closeSRAM() {
+    if (!sram.active) return;
+    while (SDL_AtomicGet(&sram.busy)) SDL_Delay(1); //previous batch first
+    handOff(); //whatever is left, and the clock
+    SDL_AtomicSet(&sram.quit, 1);
+    SDL_SemPost(sram.wake);
+    SDL_WaitThread(sram.thread, NULL);
+    fclose(sram.file);
+    SDL_DestroySemaphore(sram.wake);
+    sram.file = NULL;
+    sram.thread = NULL;
+    sram.active = 0;
+}
+
+void printSRAMStats() {
+    if (sram.flushes == 0) return;
+    printf("Save file: %u flushes, %llu pages written, %u fsyncs, slowest flush %u ms\n", sram.flushes,
+        (unsigned long long)sram.pagesWritten, sram.fsyncs, sram.maxFlushMs);
+}
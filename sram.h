@@ -0,0 +1,59 @@
+#ifndef SRAM_H
+#define SRAM_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //.sav writer thread
+
+#include "rtc.h"
+
+#define SRAM_PAGE_SIZE 512
+#define SRAM_PAGES (0x2000 * 16 / SRAM_PAGE_SIZE) //all of memory.eram
+#define SRAM_QUIET_MS 200 //games write a save in a burst, wait for it to stop before flushing
+#define SRAM_MAX_DELAY_MS 800 //but never sit on dirty pages longer than this, keeps loss under a second
+#define SRAM_FSYNC_MS 1000 //fsync budget, at most one per this long, pages reach the OS straight away regardless
+
+//Battery RAM kept in the .sav while the game runs. Writes mark 512 byte pages dirty, once the game
+//goes quiet the emulation thread copies just those pages out and a writer thread puts them in the file.
+typedef struct {
+    int active; //file is open and the writer is running
+    uint32_t dirty[SRAM_PAGES / 32]; //emulation thread only
+    int dirtyCount;
+    uint32_t writes; //bumped on every ERAM write
+    uint32_t seenWrites; //writes as of the previous stepSRAM
+    int pending; //dirty pages noticed and not handed off yet
+    uint32_t lastWriteTicks; //host ms the newest write was noticed at
+    uint32_t firstDirtyTicks; //host ms the oldest unflushed write was noticed at
+
+    //batch handed to the writer, only touched by the emulation thread while busy is 0
+    SDL_atomic_t busy;
+    int batchCount;
+    uint16_t batchPages[SRAM_PAGES];
+    uint8_t batchData[SRAM_PAGES][SRAM_PAGE_SIZE];
+    uint8_t batchFooter[RTC_FOOTER_SIZE];
+    int batchHasFooter;
+
+    FILE *file;
+    SDL_Thread *thread;
+    SDL_sem *wake;
+    SDL_atomic_t quit;
+
+    //stats, writer thread
+    uint32_t flushes;
+    uint64_t pagesWritten;
+    uint32_t fsyncs;
+    uint32_t maxFlushMs;
+} SRAMState;
+
+extern SRAMState sram;
+
+int openSRAM(const char *romname); //after loadSRAM, 0 on success or when there's nothing to keep
+void markSRAMDirty(const uint8_t *ptr, size_t len); //call after the bytes changed, anything outside ERAM is ignored
+void markSRAMClock(); //RTC registers written, the footer goes out with the next batch even if no page changed
+void stepSRAM(); //emulation thread, once a frame and while paused
+void closeSRAM(); //flushes everything, waits for the writer
+void printSRAMStats();
+
+#endif
@@ -0,0 +1,119 @@
+#include "symbols.h"
+#include "memory.h"
+
+SymbolTable symbols;
+
+static void clearSymbols() {
+    for (int i = 0; i < SYMBOL_BANKS; i++) {
+        free(symbols.banks[i]);
+        symbols.banks[i] = NULL;
+        symbols.counts[i] = 0;
+    }
+    free(symbols.names);
+    symbols.names = NULL;
+    symbols.namesSize = 0;
+    symbols.total = 0;
+}
+
+static int compareEntries(const void *a, const void *b) {
+    const SymbolEntry *x = a, *y = b;
+    if (x->addr != y->addr) return x->addr < y->addr ? -1 : 1;
+    return x->name < y->name ? -1 : x->name > y->name; //first one in the file wins on ties
+}
+
+int loadSymbols(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    clearSymbols();
+
+    int capacity[SYMBOL_BANKS] = {0};
+    size_t namesCapacity = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned bank, addr;
+        char name[256];
+        if (line[0] == ';' || sscanf(line, "%x:%x %255s", &bank, &addr, name) != 3) continue; //comments and blank lines
+        if (bank >= SYMBOL_BANKS || addr > 0xFFFF) continue;
+
+        size_t length = strlen(name) + 1;
+        if (symbols.namesSize + length > namesCapacity) {
+            namesCapacity = namesCapacity ? namesCapacity * 2 : 4096;
+            char *grown = realloc(symbols.names, namesCapacity);
+            if (!grown) break;
+            symbols.names = grown;
+        }
+        if (symbols.counts[bank] == capacity[bank]) {
+            capacity[bank] = capacity[bank] ? capacity[bank] * 2 : 64;
+            SymbolEntry *grown = realloc(symbols.banks[bank], capacity[bank] * sizeof(SymbolEntry));
+            if (!grown) break;
+            symbols.banks[bank] = grown;
+        }
+        memcpy(symbols.names + symbols.namesSize, name, length);
+        symbols.banks[bank][symbols.counts[bank]++] = (SymbolEntry){ (uint16_t)addr, (uint32_t)symbols.namesSize };
+        symbols.namesSize += length;
+        symbols.total++;
+    }
+    fclose(f);
+
+    for (int i = 0; i < SYMBOL_BANKS; i++) {
+        if (symbols.counts[i] > 1) qsort(symbols.banks[i], symbols.counts[i], sizeof(SymbolEntry), compareEntries);
+    }
+    fprintf(stderr, "Loaded %d symbols from %s\n", symbols.total, path); //stderr, --disasm output stays clean
+    return 0;
+}
+
+int symbolBank(uint16_t addr) {
+    if (addr < 0x8000) return (int)((memory.memoryMap[addr] - memory.cartridge) >> 14);
+    if (addr >= 0xA000 && addr < 0xC000) {
+        const uint8_t *p = memory.memoryMap[addr];
+        if (p >= memory.eram && p < memory.eram + sizeof(memory.eram)) return (int)((p - memory.eram) / 0x2000);
+        return 0;
+    }
+    if (addr >= 0xD000 && addr < 0xE000) return 1; //WRAMX, always bank 1 on DMG
+    return 0;
+}
+
+//A label only covers addresses in its own area, the last one in WRAM shouldn't name HRAM
+static int memoryArea(uint16_t addr) {
+    if (addr < 0x8000) return addr >> 14;
+    if (addr >= 0xFF80) return 16;
+    return addr >> 12;
+}
+
+const char *findSymbol(int bank, uint16_t addr, uint16_t *offset) {
+    if (bank < 0 || bank >= SYMBOL_BANKS || symbols.counts[bank] == 0) return NULL;
+    const SymbolEntry *entries = symbols.banks[bank];
+    int lo = 0, hi = symbols.counts[bank]; //first entry past addr
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (entries[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+    uint16_t found = entries[lo - 1].addr;
+    while (lo > 1 && entries[lo - 2].addr == found) lo--; //same address twice, the earliest name
+    if (memoryArea(found) != memoryArea(addr)) return NULL;
+    if (offset) *offset = addr - found;
+    return symbols.names + entries[lo - 1].name;
+}
+
+int findSymbolAddress(const char *name, int *bank, uint16_t *addr) {
+    for (int b = 0; b < SYMBOL_BANKS; b++) {
+        for (int i = 0; i < symbols.counts[b]; i++) {
+            if (strcmp(symbols.names + symbols.banks[b][i].name, name) == 0) {
+                *bank = b;
+                *addr = symbols.banks[b][i].addr;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+int formatSymbol(int bank, uint16_t addr, char *out, size_t size) {
+    uint16_t offset = 0;
+    const char *name = findSymbol(bank, addr, &offset);
+    if (!name) return snprintf(out, size, "%02X:%04X", bank, addr);
+    if (offset) return snprintf(out, size, "%02X:%s+%X", bank, name, offset);
+    return snprintf(out, size, "%02X:%s", bank, name);
+}
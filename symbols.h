@@ -0,0 +1,34 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+#define SYMBOL_BANKS 512 //ROM banks of an 8MB cartridge, RAM symbols use the bank number their .sym line gives
+
+typedef struct {
+    uint16_t addr;
+    uint32_t name; //offset into SymbolTable.names
+} SymbolEntry;
+
+//Labels from an RGBDS or no$gmb .sym file, "BB:AAAA Name" a line. Each bank's are sorted by
+//address so a lookup is a binary search over that bank only.
+typedef struct {
+    int total;
+    char *names; //all of them back to back, NUL terminated
+    size_t namesSize;
+    SymbolEntry *banks[SYMBOL_BANKS];
+    int counts[SYMBOL_BANKS];
+} SymbolTable;
+
+extern SymbolTable symbols;
+
+int loadSymbols(const char *path); //0 on success, replaces anything loaded before
+int symbolBank(uint16_t addr); //which bank a .sym would file this address under, as currently mapped
+const char *findSymbol(int bank, uint16_t addr, uint16_t *offset); //closest label at or before addr in the same memory area
+int findSymbolAddress(const char *name, int *bank, uint16_t *addr); //0 when the label exists
+int formatSymbol(int bank, uint16_t addr, char *out, size_t size); //"bank:label+offset", or "bank:addr" without a label
+
+#endif
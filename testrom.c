@@ -0,0 +1,34 @@
+#include "testrom.h"
+#include "cpu.h"
+#include "serial.h"
+
+TestState test;
+
+void initTestDetection() {
+    test.status = TEST_RUNNING;
+    test.endCycle = 0;
+    test.source = NULL;
+}
+
+static void finishTest(TestStatus status, const char *source) {
+    if (test.status != TEST_RUNNING) return; //first result wins
+    test.status = status;
+    test.endCycle = systemCycles;
+    test.source = source;
+}
+
+//Blargg ROMs print their verdict over serial, called for every byte so the runner can stop right away
+void checkSerialResult() {
+    if (serialOutputEndsWith("Passed")) finishTest(TEST_PASSED, "serial output");
+    else if (serialOutputEndsWith("Failed")) finishTest(TEST_FAILED, "serial output");
+}
+
+//Mooneye ROMs execute LD B,B when done, Fibonacci numbers in the registers mean pass and all 0x42 means fail
+void checkMooneyeBreakpoint() {
+    if (CPUreg.bc.B == 3 && CPUreg.bc.C == 5 && CPUreg.de.D == 8 && CPUreg.de.E == 13 && CPUreg.hl.H == 21 && CPUreg.hl.L == 34) {
+        finishTest(TEST_PASSED, "LD B,B signature");
+    }
+    else if (CPUreg.bc.B == 0x42 && CPUreg.bc.C == 0x42 && CPUreg.de.D == 0x42 && CPUreg.de.E == 0x42 && CPUreg.hl.H == 0x42 && CPUreg.hl.L == 0x42) {
+        finishTest(TEST_FAILED, "LD B,B signature");
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef TESTROM_H
+#define TESTROM_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+typedef enum {
+    TEST_RUNNING,
+    TEST_PASSED,
+    TEST_FAILED
+} TestStatus;
+
+typedef struct {
+    TestStatus status;
+    uint64_t endCycle; //systemCycles when the result showed up
+    const char *source; //what gave the result away
+} TestState; //result of a blargg or mooneye test ROM, as soon as the ROM reports it
+
+extern TestState test;
+
+void initTestDetection();
+void checkSerialResult();
+void checkMooneyeBreakpoint();
+
+#endif
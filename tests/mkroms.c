@@ -0,0 +1,546 @@
+//Writes the hand-built test and benchmark ROMs, tests/run.sh builds and runs it.
+//No assembler needed, every ROM is a few bytes of SM83 machine code with the mnemonic next to it.
+//Check ROMs print a checksum of everything they read, then "Passed" if it's the one the old
+//per-cycle model gave (or, for behaviour it never had, the one worked out by hand), so --headless
+//stops on the result and its exit code is the verdict.
+//Benchmark ROMs print "Passed" after a fixed number of frames so every run covers the same emulated time.
+//usage: mkroms OUTDIR
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+static uint8_t rom[0x8000];
+static uint16_t at; //where the next byte goes
+
+#define EMIT(...) do { const uint8_t bytes_[] = {__VA_ARGS__}; memcpy(&rom[at], bytes_, sizeof(bytes_)); at += sizeof(bytes_); } while (0)
+#define LO(x) (uint8_t)((x) & 0xFF)
+#define HI(x) (uint8_t)((x) >> 8)
+
+//Shared routines and data, at the same place in every ROM
+#define EXPECTED 0x0150 //little endian checksum a check ROM should come up with
+#define MAIN 0x0200
+#define PUTC 0x1000 //A out over serial, waits for the transfer
+#define DIGIT 0x1010 //low nibble of A as a hex digit
+#define PUTHEX 0x1020 //A as two hex digits
+#define PUTS 0x1030 //zero terminated string at HL
+#define SUM 0x1040 //A into the Fletcher checksum in DE, nothing else touched
+#define FINISH 0x1050 //prints DE, then Passed if it matches EXPECTED and Failed otherwise
+#define DONE 0x1080 //benchmarks, prints Passed
+#define PASSED_TEXT 0x10A0
+#define FAILED_TEXT 0x10A8
+#define FRAME_HANDLER 0x0F00 //benchmark VBlank handler
+#define DATA 0x2000 //tables the setup code copies into RAM
+#define FRAMES 0xFF90 //HRAM frame countdown for benchmarks, low byte then high byte, clear of the DMA routine and the stack
+
+static void jr(uint8_t opcode, uint16_t target) { //JR/JR cc backwards to a label
+    EMIT(opcode, (uint8_t)(target - (at + 2)));
+}
+
+static uint16_t jrForward(uint8_t opcode) { //JR/JR cc to a label that doesn't exist yet, land() fills it in
+    EMIT(opcode, 0);
+    return at - 1;
+}
+
+static void land(uint16_t patch) {
+    rom[patch] = (uint8_t)(at - (patch + 1));
+}
+
+static void call(uint16_t addr) {
+    EMIT(0xCD, LO(addr), HI(addr));
+}
+
+static void jp(uint16_t addr) {
+    EMIT(0xC3, LO(addr), HI(addr));
+}
+
+static void library() {
+    at = PUTC;
+    EMIT(0xE0, 0x01, 0x3E, 0x81, 0xE0, 0x02); //ldh (SB),a / ld a,81 / ldh (SC),a
+    uint16_t wait = at;
+    EMIT(0xF0, 0x02, 0x87); //ldh a,(SC) / add a,a
+    jr(0x38, wait); //jr c, bit 7 still set
+    EMIT(0xC9); //ret
+
+    at = DIGIT;
+    EMIT(0xE6, 0x0F, 0xC6, '0', 0xFE, '9' + 1); //and 0F / add '0' / cp '9'+1
+    uint16_t decimal = jrForward(0x38); //jr c
+    EMIT(0xC6, 7); //add 7, on to 'A'
+    land(decimal);
+    jp(PUTC);
+
+    at = PUTHEX;
+    EMIT(0xF5, 0xCB, 0x37); //push af / swap a
+    call(DIGIT);
+    EMIT(0xF1); //pop af
+    jp(DIGIT);
+
+    at = PUTS;
+    uint16_t next = at;
+    EMIT(0x2A, 0xB7, 0xC8); //ld a,(hl+) / or a / ret z
+    call(PUTC);
+    jr(0x18, next);
+
+    at = SUM;
+    EMIT(0x83, 0x5F, 0x82, 0x57, 0xC9); //add a,e / ld e,a / add a,d / ld d,a / ret
+
+    at = FINISH;
+    EMIT(0xF3, 0x7A); //di / ld a,d
+    call(PUTHEX);
+    EMIT(0x7B); //ld a,e
+    call(PUTHEX);
+    EMIT(0x3E, '\n'); //ld a,'\n'
+    call(PUTC);
+    EMIT(0x21, LO(FAILED_TEXT), HI(FAILED_TEXT)); //ld hl,FAILED_TEXT
+    EMIT(0xFA, LO(EXPECTED), HI(EXPECTED), 0xBB); //ld a,(EXPECTED) / cp e
+    uint16_t lowDiffers = jrForward(0x20); //jr nz
+    EMIT(0xFA, LO(EXPECTED + 1), HI(EXPECTED + 1), 0xBA); //ld a,(EXPECTED+1) / cp d
+    uint16_t highDiffers = jrForward(0x20); //jr nz
+    EMIT(0x2E, LO(PASSED_TEXT)); //ld l,PASSED_TEXT
+    land(lowDiffers);
+    land(highDiffers);
+    call(PUTS);
+    uint16_t stop = at;
+    jr(0x18, stop); //jr $, the runner stops on the text
+
+    at = DONE;
+    EMIT(0xF3, 0x21, LO(PASSED_TEXT), HI(PASSED_TEXT)); //di / ld hl,PASSED_TEXT
+    call(PUTS);
+    stop = at;
+    jr(0x18, stop); //jr $
+
+    memcpy(&rom[PASSED_TEXT], "Passed\n", 7);
+    memcpy(&rom[FAILED_TEXT], "Failed\n", 7);
+}
+
+//Header, library, vectors that only return, then the start of main: interrupts off, stack, checksum 0
+static void startROM(const char *title, uint16_t expected) {
+    memset(rom, 0, sizeof(rom));
+    for (int v = 0; v < 5; v++) rom[0x40 + v * 8] = 0xD9; //reti
+    at = 0x100;
+    EMIT(0x00); //nop
+    jp(MAIN);
+    memcpy(&rom[0x134], title, strlen(title) < 15 ? strlen(title) : 15);
+    rom[EXPECTED] = LO(expected);
+    rom[EXPECTED + 1] = HI(expected);
+    library();
+    at = MAIN;
+    EMIT(0xF3, 0x31, 0xFE, 0xFF, 0x11, 0x00, 0x00); //di / ld sp,FFFE / ld de,0
+}
+
+static int writeROM(const char *dir, const char *name) {
+    uint8_t check = 0;
+    for (int i = 0x134; i <= 0x14C; i++) check = check - rom[i] - 1;
+    rom[0x14D] = check;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(rom, 1, sizeof(rom), f) != sizeof(rom)) {
+        perror(path);
+        if (f) fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+//Copies len (1-256) bytes from src to dst, uses A, C, DE and HL
+static void copy(uint16_t src, uint16_t dst, int len) {
+    EMIT(0x21, LO(src), HI(src), 0x11, LO(dst), HI(dst), 0x0E, (uint8_t)len); //ld hl,src / ld de,dst / ld c,len
+    uint16_t loop = at;
+    EMIT(0x2A, 0x12, 0x13, 0x0D); //ld a,(hl+) / ld (de),a / inc de / dec c
+    jr(0x20, loop); //jr nz
+}
+
+//Waits for VBlank by polling LY, then turns the LCD off so VRAM can be filled in one go
+static void lcdOff() {
+    uint16_t wait = at;
+    EMIT(0xF0, 0x44, 0xFE, 144); //ldh a,(LY) / cp 144
+    jr(0x38, wait); //jr c
+    EMIT(0xAF, 0xE0, 0x40); //xor a / ldh (LCDC),a
+}
+
+//Benchmarks end after `frames` VBlanks. The VBlank handler calls `work` if it's set, then counts
+//FRAMES down and goes to DONE at 0. Emits the countdown setup at the current spot
+static void frameCountdown(uint16_t frames, uint16_t work) {
+    uint8_t low = LO(frames), high = HI(frames) + (LO(frames) != 0); //a nonzero low byte is a partial run of the high byte
+    EMIT(0x3E, low, 0xE0, LO(FRAMES), 0x3E, high, 0xE0, LO(FRAMES + 1)); //ld a,low / ldh (FRAMES),a / ld a,high / ldh (FRAMES+1),a
+    uint16_t back = at;
+
+    at = 0x40;
+    jp(FRAME_HANDLER);
+    at = FRAME_HANDLER;
+    EMIT(0xF5); //push af
+    if (work) call(work);
+    EMIT(0xF0, LO(FRAMES), 0x3D, 0xE0, LO(FRAMES)); //ldh a,(FRAMES) / dec a / ldh (FRAMES),a
+    uint16_t out = jrForward(0x20); //jr nz
+    EMIT(0xF0, LO(FRAMES + 1), 0x3D, 0xE0, LO(FRAMES + 1)); //ldh a,(FRAMES+1) / dec a / ldh (FRAMES+1),a
+    EMIT(0xCA, LO(DONE), HI(DONE)); //jp z,DONE
+    land(out);
+    EMIT(0xF1, 0xD9); //pop af / reti
+    at = back;
+}
+
+//Reads FF00+reg into the checksum, through LDH or through (HL) so both read paths get covered. HL goes with the second
+static void sample(uint8_t reg, int viaHL) {
+    if (viaHL) EMIT(0x26, 0xFF, 0x2E, reg, 0x7E); //ld h,FF / ld l,reg / ld a,(hl)
+    else EMIT(0xF0, reg); //ldh a,(reg)
+    call(SUM);
+}
+
+//LY, STAT and DIV through LDH
+static void sampleLCD() {
+    sample(0x44, 0);
+    sample(0x41, 0);
+    sample(0x04, 0);
+}
+
+//(C & mask) + 1 rounds of 16 cycles, so the next sample lands somewhere else in the line. Uses A and B
+static void delayByC(uint8_t mask) {
+    EMIT(0x79, 0xE6, mask, 0x3C, 0x47); //ld a,c / and mask / inc a / ld b,a
+    uint16_t loop = at;
+    EMIT(0x05); //dec b
+    jr(0x20, loop); //jr nz
+}
+
+//Interrupt handler on `vector` that samples LY/STAT/DIV and returns
+static void sampleHandler(uint16_t vector, uint16_t handler) {
+    uint16_t back = at;
+    at = vector;
+    jp(handler);
+    at = handler;
+    EMIT(0xF5); //push af
+    sampleLCD();
+    EMIT(0xF1, 0xD9); //pop af / reti
+    at = back;
+}
+
+//Tile data with a different pattern per byte, and a map that counts through the tiles, so no two columns look alike
+static void patternBG() {
+    EMIT(0x21, 0x00, 0x80); //ld hl,8000
+    uint16_t tiles = at;
+    EMIT(0x7D, 0xAC, 0x22, 0x7C, 0xFE, 0x90); //ld a,l / xor h / ld (hl+),a / ld a,h / cp 90
+    jr(0x20, tiles); //jr nz
+    EMIT(0x21, 0x00, 0x98); //ld hl,9800
+    uint16_t map = at;
+    EMIT(0x7D, 0x22, 0x7C, 0xFE, 0x9C); //ld a,l / ld (hl+),a / ld a,h / cp 9C
+    jr(0x20, map); //jr nz
+}
+
+//Sprite-heavy benchmark
+//All 40 sprites 8x16 and moving, packed in overlapping columns so lines carry up to 10 of them,
+//with every palette, flip and BG priority combination. OAM goes in by DMA each VBlank like a game's would.
+static void spritesROM(uint16_t frames) {
+    startROM("SPRITES", 0);
+    uint16_t oamTable = DATA, dmaRoutine = DATA + 0x100, update = 0x0E00;
+    for (int i = 0; i < 40; i++) {
+        uint8_t *s = &rom[oamTable + i * 4];
+        s[0] = (uint8_t)(16 + (i / 10) * 36 + (i % 5) * 3); //y, four bands
+        s[1] = (uint8_t)(8 + (i % 10) * 6 + (i / 10) * 20); //x, 6 apart so neighbours overlap
+        s[2] = (uint8_t)(i * 2); //tile
+        s[3] = (uint8_t)((i << 4) & 0xF0); //palette, X flip, Y flip, behind BG
+    }
+    const uint8_t dma[] = {0x3E, 0xC0, 0xE0, 0x46, 0x3E, 0x28, 0x3D, 0x20, 0xFD, 0xC9}; //ld a,C0 / ldh (DMA),a / ld a,40 / dec a / jr nz / ret
+    memcpy(&rom[dmaRoutine], dma, sizeof(dma));
+
+    lcdOff();
+    patternBG();
+    copy(oamTable, 0xC000, 160);
+    copy(dmaRoutine, 0xFF80, sizeof(dma));
+    EMIT(0x3E, 0xE4, 0xE0, 0x47, 0xE0, 0x48, 0x3E, 0x1B, 0xE0, 0x49); //BGP and OBP0 E4, OBP1 1B
+    EMIT(0x3E, 0x97, 0xE0, 0x40); //ld a,97 / ldh (LCDC),a, on, 8x16 sprites, tiles at 8000
+    EMIT(0x3E, 0x01, 0xE0, 0xFF); //ld a,01 / ldh (IE),a
+    frameCountdown(frames, update);
+    EMIT(0xFB); //ei
+    uint16_t idle = at;
+    EMIT(0x76, 0x00); //halt / nop, the sprites move from the VBlank handler
+    jr(0x18, idle);
+
+    //Per frame: DMA the shadow OAM in, then move every sprite down one line and right 1-4 pixels, and scroll the BG
+    at = update;
+    EMIT(0xC5, 0xD5, 0xE5); //push bc / push de / push hl
+    call(0xFF80);
+    EMIT(0x21, 0x00, 0xC0, 0x0E, 40); //ld hl,C000 / ld c,40
+    uint16_t move = at;
+    EMIT(0x34, 0x23, 0x79, 0xE6, 0x03, 0x3C, 0x86, 0x22, 0x23, 0x23, 0x0D); //inc (hl) / inc hl / ld a,c / and 3 / inc a / add a,(hl) / ld (hl+),a / inc hl / inc hl / dec c
+    jr(0x20, move); //jr nz
+    EMIT(0xF0, 0x43, 0x3C, 0xE0, 0x43); //ldh a,(SCX) / inc a / ldh (SCX),a
+    EMIT(0xE1, 0xD1, 0xC1, 0xC9); //pop hl / pop de / pop bc / ret
+}
+
+//LY, STAT and DIV have to read exactly what the per-cycle model gave. The expected checksums come from
+//running these against the last tree that still stored all three every cycle (PPU stepped every cycle, DIV in main.c).
+
+//Free running LCD, every register read through LDH and (HL) at a spread of points in the line and frame
+static void lcdPhaseROM() {
+    startROM("LCD PHASE", 0x66CD);
+    EMIT(0x3E, 8, 0xE0, 0x80); //ld a,8 / ldh (FF80),a, passes
+    uint16_t pass = at;
+    EMIT(0x0E, 0x00); //ld c,0
+    uint16_t loop = at;
+    sampleLCD();
+    sample(0x44, 1);
+    sample(0x41, 1);
+    sample(0x04, 1);
+    delayByC(0x1F);
+    EMIT(0x0C); //inc c
+    jr(0x20, loop); //jr nz, 256 samples
+    EMIT(0xF0, 0x80, 0x3D, 0xE0, 0x80); //ldh a,(FF80) / dec a / ldh (FF80),a
+    jr(0x20, pass); //jr nz
+    jp(FINISH);
+}
+
+//LCD switched off in VBlank and back on after a varying wait, with LYC and the STAT enable bits changing,
+//then read for a few lines. Covers the LY/STAT reset on enable and the coincidence flag
+static void lcdToggleROM() {
+    startROM("LCD TOGGLE", 0x8436);
+    EMIT(0x0E, 0x00); //ld c,0
+    uint16_t loop = at;
+    uint16_t vblank = at;
+    EMIT(0xF0, 0x44, 0xFE, 144); //ldh a,(LY) / cp 144
+    jr(0x38, vblank); //jr c
+    EMIT(0x3E, 0x11, 0xE0, 0x40); //ld a,11 / ldh (LCDC),a, off
+    sampleLCD();
+    delayByC(0x0F);
+    EMIT(0x79, 0xE0, 0x45); //ld a,c / ldh (LYC),a
+    EMIT(0x79, 0x07, 0x07, 0xE6, 0x78, 0xE0, 0x41); //ld a,c / rlca / rlca / and 78 / ldh (STAT),a
+    EMIT(0x3E, 0x91, 0xE0, 0x40); //ld a,91 / ldh (LCDC),a, on
+    sampleLCD();
+    EMIT(0x2E, 40); //ld l,40
+    uint16_t lines = at;
+    sampleLCD();
+    delayByC(0x07);
+    EMIT(0x2D); //dec l
+    jr(0x20, lines); //jr nz
+    EMIT(0x79, 0xC6, 3, 0x4F); //ld a,c / add 3 / ld c,a
+    jr(0x30, loop); //jr nc, 86 rounds
+    jp(FINISH);
+}
+
+//Woken from HALT by STAT (LYC plus every mix of the HBlank/VBlank/OAM sources) and then by VBlank,
+//sampled in the handler and again after it returns
+static void lcdHaltROM() {
+    startROM("LCD HALT", 0x93B0);
+    sampleHandler(0x40, 0x0E00);
+    sampleHandler(0x48, 0x0E40);
+    EMIT(0x3E, 0x02, 0xE0, 0xFF); //ld a,02 / ldh (IE),a, STAT
+    EMIT(0x0E, 0x00); //ld c,0
+    uint16_t stat = at;
+    EMIT(0x79, 0xE0, 0x45); //ld a,c / ldh (LYC),a
+    EMIT(0x79, 0x07, 0x07, 0x07, 0xE6, 0x38, 0xF6, 0x40, 0xE0, 0x41); //ld a,c / rlca x3 / and 38 / or 40 / ldh (STAT),a
+    EMIT(0xAF, 0xE0, 0x0F, 0xFB, 0x76, 0x00, 0xF3); //xor a / ldh (IF),a / ei / halt / nop / di
+    sampleLCD();
+    EMIT(0x0C, 0x79, 0xFE, 154); //inc c / ld a,c / cp 154
+    jr(0x20, stat); //jr nz, every line
+    EMIT(0x3E, 0x01, 0xE0, 0xFF); //ld a,01 / ldh (IE),a, VBlank
+    EMIT(0x0E, 60); //ld c,60
+    uint16_t vblank = at;
+    EMIT(0xAF, 0xE0, 0x0F, 0xFB, 0x76, 0x00, 0xF3); //xor a / ldh (IF),a / ei / halt / nop / di
+    delayByC(0x3F);
+    sampleLCD();
+    EMIT(0x0D); //dec c
+    jr(0x20, vblank); //jr nz
+    jp(FINISH);
+}
+
+//Raster effect, SCX rewritten nonstop over the bottom half so it changes in the middle of lines. Checks nothing
+//itself: tests/run.sh compares its frames drawn inline and on render threads, where the top half gets
+//recorded and replayed and the first write below it makes the rest of the frame fall back to drawing for real
+static void lcdRasterROM(uint16_t frames) {
+    startROM("LCD RASTER", 0);
+    lcdOff();
+    patternBG();
+    EMIT(0x3E, 0xE4, 0xE0, 0x47); //ld a,E4 / ldh (BGP),a
+    EMIT(0x3E, 0x91, 0xE0, 0x40); //ld a,91 / ldh (LCDC),a, on, BG tiles at 8000
+    EMIT(0x3E, 0x01, 0xE0, 0xFF); //ld a,01 / ldh (IE),a
+    frameCountdown(frames, 0);
+    EMIT(0xFB); //ei
+    uint16_t top = at;
+    EMIT(0xF0, 0x44, 0xFE, 72); //ldh a,(LY) / cp 72
+    jr(0x38, top); //jr c
+    uint16_t scroll = at;
+    EMIT(0xF0, 0x43, 0x3C, 0xE0, 0x43); //ldh a,(SCX) / inc a / ldh (SCX),a
+    EMIT(0xF0, 0x44, 0xFE, 144); //ldh a,(LY) / cp 144
+    jr(0x38, scroll); //jr c
+    uint16_t vblank = at;
+    EMIT(0xF0, 0x44, 0xFE, 144); //ldh a,(LY) / cp 144
+    jr(0x30, vblank); //jr nc
+    jr(0x18, top);
+}
+
+//Timer-heavy benchmark
+//TIMA on the fastest clock overflowing every 256 cycles, each interrupt reads TIMA and DIV,
+//and the main loop reads them nonstop, so the timer gets settled thousands of times a frame
+static void timerROM(uint16_t frames) {
+    startROM("TIMER", 0);
+    uint16_t overflow = 0x0E00, back = at;
+    at = 0x50;
+    jp(overflow);
+    at = overflow;
+    EMIT(0xF5, 0xF0, 0x05, 0x47, 0xF0, 0x04, 0x80, 0xE0, 0x81, 0xF1, 0xD9); //push af / ldh a,(TIMA) / ld b,a / ldh a,(DIV) / add a,b / ldh (FF81),a / pop af / reti
+    at = back;
+    EMIT(0x3E, 0xF0, 0xE0, 0x06, 0xE0, 0x05); //ld a,F0 / ldh (TMA),a / ldh (TIMA),a
+    EMIT(0x3E, 0x05, 0xE0, 0x07); //ld a,05 / ldh (TAC),a, 262144Hz
+    EMIT(0x3E, 0x91, 0xE0, 0x40); //ld a,91 / ldh (LCDC),a
+    EMIT(0x3E, 0x05, 0xE0, 0xFF); //ld a,05 / ldh (IE),a, VBlank and timer
+    frameCountdown(frames, 0);
+    EMIT(0xFB); //ei
+    uint16_t poll = at;
+    EMIT(0xF0, 0x05, 0x4F, 0xF0, 0x04, 0x81, 0xE0, 0x82); //ldh a,(TIMA) / ld c,a / ldh a,(DIV) / add a,c / ldh (FF82),a
+    jr(0x18, poll);
+}
+
+//Sound-heavy benchmark
+//All four channels retriggered every frame at high pitches, square 1 with sweep, wave on full volume and
+//noise on a short divisor, so every channel's output keeps flipping and the step synthesis always has work
+static void soundROM(uint16_t frames) {
+    startROM("SOUND", 0);
+    uint16_t update = 0x0E00;
+    EMIT(0x3E, 0x80, 0xE0, 0x26, 0x3E, 0x77, 0xE0, 0x24, 0x3E, 0xFF, 0xE0, 0x25); //NR52 80 on, NR50 77, NR51 FF
+    EMIT(0xAF, 0xE0, 0x1A, 0x21, 0x30, 0xFF); //xor a / ldh (NR30),a, wave off to write its RAM / ld hl,FF30
+    uint16_t wave = at;
+    EMIT(0x7D, 0x07, 0x07, 0x07, 0xAD, 0x22, 0x7D, 0xFE, 0x40); //ld a,l / rlca x3 / xor l / ld (hl+),a / ld a,l / cp 40
+    jr(0x20, wave); //jr nz
+    EMIT(0x3E, 0x01, 0xE0, 0xFF); //ld a,01 / ldh (IE),a
+    frameCountdown(frames, update);
+    EMIT(0xFB); //ei
+    uint16_t idle = at;
+    EMIT(0x76, 0x00); //halt / nop
+    jr(0x18, idle);
+
+    //Per frame, the pitches move with a counter in FF83
+    at = update;
+    EMIT(0xC5, 0xF0, 0x83, 0x3C, 0xE0, 0x83, 0x47); //push bc / ldh a,(FF83) / inc a / ldh (FF83),a / ld b,a
+    EMIT(0x3E, 0x15, 0xE0, 0x10, 0x3E, 0x80, 0xE0, 0x11, 0x3E, 0xF3, 0xE0, 0x12); //NR10 15, NR11 80, NR12 F3
+    EMIT(0x78, 0xE0, 0x13, 0x3E, 0x87, 0xE0, 0x14); //ld a,b / ldh (NR13),a / ld a,87 / ldh (NR14),a, trigger
+    EMIT(0x3E, 0x40, 0xE0, 0x16, 0x3E, 0xF4, 0xE0, 0x17); //NR21 40, NR22 F4
+    EMIT(0x78, 0x2F, 0xE0, 0x18, 0x3E, 0x86, 0xE0, 0x19); //ld a,b / cpl / ldh (NR23),a / ld a,86 / ldh (NR24),a, trigger
+    EMIT(0x3E, 0x80, 0xE0, 0x1A, 0x3E, 0x20, 0xE0, 0x1C); //NR30 80, NR32 20
+    EMIT(0x78, 0xE0, 0x1D, 0x3E, 0x87, 0xE0, 0x1E); //ld a,b / ldh (NR33),a / ld a,87 / ldh (NR34),a, trigger
+    EMIT(0x3E, 0xF1, 0xE0, 0x21); //NR42 F1
+    EMIT(0x78, 0xE6, 0x17, 0xE0, 0x22, 0x3E, 0x80, 0xE0, 0x23); //ld a,b / and 17 / ldh (NR43),a / ld a,80 / ldh (NR44),a, trigger
+    EMIT(0xC1, 0xC9); //pop bc / ret
+}
+
+//TIMA, DIV and IF have to read what the per-cycle model gave, the tree before timer.c. TAC is set once and
+//TIMA only written right after a reload: the old loop had no DIV reset or TAC glitches and wrote over TIMA
+//during the delay, so those are checked on their own in timerGlitchROM
+static void timerPhaseROM() {
+    startROM("TIMER PHASE", 0x4504);
+    EMIT(0xAF, 0xE0, 0x05, 0x3E, 0x05, 0xE0, 0x07); //xor a / ldh (TIMA),a / ld a,05 / ldh (TAC),a
+    EMIT(0x3E, 0x04, 0xE0, 0xFF); //ld a,04 / ldh (IE),a, timer only wakes HALT, IME stays off
+    EMIT(0x0E, 0x00); //ld c,0
+    uint16_t loop = at;
+    EMIT(0x79, 0xCB, 0x3F, 0xE0, 0x06); //ld a,c / srl a / ldh (TMA),a, 0-7F
+    sample(0x05, 0);
+    sample(0x04, 0);
+    sample(0x0F, 0);
+    sample(0x05, 1);
+    delayByC(0x1F);
+    EMIT(0x79, 0xE6, 0x03); //ld a,c / and 3
+    uint16_t skip = jrForward(0x20); //jr nz, every 4th round waits for an overflow
+    EMIT(0xAF, 0xE0, 0x0F, 0x76, 0x00); //xor a / ldh (IF),a / halt / nop
+    sample(0x05, 0);
+    sample(0x04, 0);
+    sample(0x0F, 0);
+    EMIT(0x79, 0xE6, 0x7F, 0xE0, 0x05); //ld a,c / and 7F / ldh (TIMA),a, a whole count away from overflowing
+    land(skip);
+    EMIT(0x0C); //inc c
+    jr(0x20, loop); //jr nz, 256 rounds
+    jp(FINISH);
+}
+
+//TIMA counts falling edges of (TAC enable AND the selected DIV bit), so resetting DIV or writing TAC while
+//that signal is high ticks it once more. Each case resets DIV, reads TIMA, then after a fixed number of
+//cycles does the write and reads TIMA again. The difference goes in the checksum, the expected value
+//is worked out by hand next to each case from where the internal counter is at the write.
+static uint8_t expectedLow, expectedHigh;
+
+static void expect(uint8_t value) { //same Fletcher sum as SUM
+    expectedLow += value;
+    expectedHigh += expectedLow;
+}
+
+//TIMA before in B, DIV reset 16 cycles earlier: ldh (DIV),a / ldh a,(TIMA) / ld b,a
+static void timerCaseStart() {
+    EMIT(0xE0, 0x04, 0xF0, 0x05, 0x47); //ldh (DIV),a / ldh a,(TIMA) / ld b,a
+}
+
+static void timerCaseEnd(uint8_t ticks) {
+    EMIT(0xF0, 0x05, 0x90); //ldh a,(TIMA) / sub b
+    call(SUM);
+    expect(ticks);
+}
+
+static void nops(int n) {
+    while (n--) EMIT(0x00);
+}
+
+//Counter values below are as of the write, +-1 either way doesn't change any of them
+static void divWrites(int gap, uint8_t ticks) { //8 DIV writes, `gap` nops apart, TAC 05 counts bit 3
+    timerCaseStart();
+    for (int i = 0; i < 8; i++) {
+        nops(gap);
+        EMIT(0xE0, 0x04); //ldh (DIV),a
+    }
+    timerCaseEnd(ticks);
+}
+
+static void tacWrite(uint8_t from, int gap, uint8_t to, uint8_t ticks) { //TAC from -> to `gap` nops after the TIMA read
+    EMIT(0x3E, from, 0xE0, 0x07); //ld a,from / ldh (TAC),a
+    timerCaseStart();
+    nops(gap);
+    EMIT(0x3E, to, 0xE0, 0x07); //ld a,to / ldh (TAC),a
+    timerCaseEnd(ticks);
+}
+
+static void timerGlitchROM() {
+    startROM("TIMER GLITCH", 0);
+    expectedLow = expectedHigh = 0;
+    EMIT(0xAF, 0xE0, 0x05, 0x3E, 0x05, 0xE0, 0x07); //xor a / ldh (TIMA),a / ld a,05 / ldh (TAC),a
+    //first write at 28: edge at 16, bit 3 still set, 2. Then at 12 each: no edge, bit 3 set, 1 each
+    divWrites(0, 2 + 7);
+    //first at 36: edges at 16 and 32, bit 3 clear, 2. Then at 20 each: edge at 16, bit 3 clear, 1 each
+    divWrites(2, 2 + 7);
+    //first at 44: edges at 16 and 32, bit 3 set, 3. Then at 28 each: edge at 16, bit 3 set, 2 each
+    divWrites(4, 3 + 7 * 2);
+    //TAC written at 36 + 4 * gap
+    tacWrite(0x07, 0, 0x00, 0); //disable at 36, bit 7 clear
+    tacWrite(0x07, 29, 0x00, 1); //disable at 152, bit 7 set
+    tacWrite(0x06, 2, 0x00, 1); //disable at 44, bit 5 set
+    tacWrite(0x06, 2, 0x07, 1); //bit 5 to bit 7 at 44, 5 set and 7 clear
+    tacWrite(0x07, 2, 0x06, 0); //bit 7 to bit 5 at 44, signal goes up, its next edge at 64 is after the read at 56
+    tacWrite(0x05, 2, 0x05, 3); //same value at 44, no glitch, just the bit 3 edges at 16, 32 and 48 between the reads
+    jp(FINISH);
+    rom[EXPECTED] = expectedLow;
+    rom[EXPECTED + 1] = expectedHigh;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s OUTDIR\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argv[1];
+    int failed = 0;
+    spritesROM(1200);
+    failed |= writeROM(dir, "sprites.gb");
+    lcdPhaseROM();
+    failed |= writeROM(dir, "lcd_phase.gb");
+    lcdToggleROM();
+    failed |= writeROM(dir, "lcd_toggle.gb");
+    lcdHaltROM();
+    failed |= writeROM(dir, "lcd_halt.gb");
+    lcdRasterROM(300);
+    failed |= writeROM(dir, "lcd_raster.gb");
+    timerROM(1200);
+    failed |= writeROM(dir, "timer.gb");
+    soundROM(1200);
+    failed |= writeROM(dir, "sound.gb");
+    timerPhaseROM();
+    failed |= writeROM(dir, "timer_phase.gb");
+    timerGlitchROM();
+    failed |= writeROM(dir, "timer_glitch.gb");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+#Builds the hand-made ROMs and runs them through the emulator headless
+#Check ROMs have to print Passed, benchmarks print how long their fixed number of frames took
+#usage: tests/run.sh path/to/emulator
+EMU=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+TESTS=$(cd "$(dirname "$0")" && pwd)
+CC=${CC:-cc}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+if [ ! -x "$EMU" ]; then
+    echo "usage: $0 path/to/emulator"
+    exit 1
+fi
+$CC -O2 -o "$OUT/mkroms" "$TESTS/mkroms.c" || exit 1
+"$OUT/mkroms" "$OUT" || exit 1
+cd "$OUT" || exit 1 #the emulator leaves its log and .sav files next to where it runs
+
+failed=0
+for rom in lcd_phase.gb lcd_toggle.gb lcd_halt.gb timer_phase.gb timer_glitch.gb; do
+    if "$EMU" "$rom" --headless --max-cycles 400000000 > "$rom.log" 2>&1; then
+        echo "pass  $rom"
+    else
+        echo "FAIL  $rom"
+        grep -a -B1 "^Failed" "$rom.log" | head -n 1 #the checksum it came up with
+        grep -a "^Test " "$rom.log"
+        failed=1
+    fi
+done
+
+#Deferred rendering records lines and draws them on other threads at VBlank, falling back to drawing
+#inline on a mid line register write. Either way every frame has to come out the same as drawn inline
+for rom in lcd_phase.gb lcd_toggle.gb lcd_halt.gb lcd_raster.gb sprites.gb; do
+    for threads in 0 2; do
+        if ! "$EMU" "$rom" --headless --max-cycles 400000000 --render-threads $threads > "$rom.$threads.log" 2>&1; then
+            echo "FAIL  $rom with $threads render threads"
+            failed=1
+        fi
+    done
+    inline=$(grep -a "^Frame checksum" "$rom.0.log")
+    threaded=$(grep -a "^Frame checksum" "$rom.2.log")
+    if [ -n "$inline" ] && [ "$inline" = "$threaded" ]; then
+        echo "pass  $rom on render threads, $(grep -a -o "[0-9]* mid line fallbacks" "$rom.2.log")"
+    else
+        echo "FAIL  $rom on render threads: $threaded, inline $inline"
+        failed=1
+    fi
+done
+
+#4 instances one after another, then the same as lanes, which have to end where those did. Prints both rates
+if "$EMU" sprites.gb --lanes 4 > lanes.log 2>&1; then
+    echo "pass  sprites.gb in 4 lanes"
+else
+    echo "FAIL  sprites.gb in 4 lanes"
+    failed=1
+fi
+grep -a "^Scalar:\|^Lanes: [0-9]" lanes.log | sed 's/^/      /'
+
+#name frames
+bench() {
+    start=$(date +%s%N)
+    if ! "$EMU" "$1" --headless --max-cycles 400000000 > "$1.log" 2>&1; then
+        echo "FAIL  $1 didn't finish"
+        failed=1
+        return
+    fi
+    ms=$(( ($(date +%s%N) - start) / 1000000 ))
+    echo "bench $1 $2 frames in $ms ms, $(( $2 * 1000 / (ms + 1) )) fps"
+    grep -a "^APU:" "$1.log" | sed 's/^/      /' #the APU's own cost, always with audio off since headless runs never make samples
+}
+bench sprites.gb 1200
+bench timer.gb 1200
+bench sound.gb 1200
+
+exit $failed
@@ -0,0 +1,138 @@
+#include "timer.h"
+#include "cpu.h"
+#include "memory.h"
+#include "apu.h"
+
+TimerState timer;
+
+static const uint8_t timerBit[4] = {9, 3, 5, 7}; //DIV bit whose falling edge clocks TIMA, by TAC & 3
+
+void initTimer() {
+    timer.divBase = systemCycles;
+    timer.lastCycle = systemCycles;
+    timer.edgeStart = systemCycles;
+    timer.reloadCycle = 0;
+    timer.nextEventCycle = 0;
+}
+
+//AND of the enable bit and the selected DIV bit, TIMA counts every time this goes from 1 to 0
+static int timerSignal(uint8_t tac, uint16_t counter) {
+    return (tac & 0x04) && (counter & (1 << timerBit[tac & 0x03]));
+}
+
+//Falling edge that didn't come from the counter ticking over, a DIV reset or TAC change
+static void glitchIncrement() {
+    if (timer.reloadCycle) return; //TIMA is held at 0 until the reload
+    if (++(*memory.memoryMap[0xFF05]) == 0) {
+        timer.reloadCycle = systemCycles + 3;
+    }
+}
+
+//First cycle after `after` where the internal counter lands on a multiple of the period
+static uint64_t firstEdgeAfter(uint64_t after, uint64_t period) {
+    return timer.divBase + ((after - timer.divBase) / period + 1) * period;
+}
+
+//Brings TIMA up to the end of cycle `through`, counting edges instead of walking every cycle
+static void catchUpTimer(uint64_t through) {
+    uint8_t *tima = memory.memoryMap[0xFF05];
+    while (timer.lastCycle < through) {
+        if (timer.reloadCycle) {
+            if (timer.reloadCycle > through) { //still in the delay, TIMA reads 0
+                timer.lastCycle = through;
+                return;
+            }
+            *tima = *memory.memoryMap[0xFF06]; // Reload TIMA from TMA
+            *memory.memoryMap[0xFF0F] |= 0x04; // Request timer interrupt
+            timer.lastCycle = timer.reloadCycle; //edges during the delay are lost
+            timer.reloadCycle = 0;
+            continue;
+        }
+
+        uint8_t tac = *memory.memoryMap[0xFF07];
+        uint64_t from = timer.lastCycle > timer.edgeStart ? timer.lastCycle : timer.edgeStart;
+        if (!(tac & 0x04) || from >= through) {
+            timer.lastCycle = through;
+            return;
+        }
+
+        //the selected bit falls whenever the counter reaches a multiple of twice its value
+        uint64_t period = 2u << timerBit[tac & 0x03];
+        uint64_t edges = (through - timer.divBase) / period - (from - timer.divBase) / period;
+        if (*tima + edges <= 0xFF) {
+            *tima += edges;
+            timer.lastCycle = through;
+            return;
+        }
+
+        uint64_t overflow = firstEdgeAfter(from, period) + (0xFF - *tima) * period;
+        *tima = 0; // kept at 0 for the reload delay
+        timer.reloadCycle = overflow + 3;
+        timer.lastCycle = overflow;
+    }
+}
+
+//Cycle of the next reload, the only thing that has to happen on time
+static uint64_t nextTimerEvent() {
+    if (timer.reloadCycle) return timer.reloadCycle;
+
+    uint8_t tac = *memory.memoryMap[0xFF07];
+    if (!(tac & 0x04)) return UINT64_MAX; //disabled, only a TAC write starts it again
+
+    uint64_t period = 2u << timerBit[tac & 0x03];
+    uint64_t from = timer.lastCycle > timer.edgeStart ? timer.lastCycle : timer.edgeStart;
+    uint64_t overflow = firstEdgeAfter(from, period) + (0xFF - *memory.memoryMap[0xFF05]) * period;
+    return overflow + 3;
+}
+
+void stepTimer() {
+    if (systemCycles < timer.nextEventCycle) return;
+    catchUpTimer(systemCycles);
+    timer.nextEventCycle = nextTimerEvent();
+}
+
+//Call before a timer register changes, counts are settled up to the previous cycle and the schedule is redone this cycle
+void syncTimer() {
+    catchUpTimer(systemCycles - 1);
+    timer.nextEventCycle = 0;
+}
+
+uint8_t readTimer(uint16_t addr) {
+    switch (addr) {
+        case 0xFF04: { // DIV, upper 8 bits of the internal counter as of the previous cycle
+            uint16_t counter = (uint16_t)(systemCycles - 1 - timer.divBase);
+            return counter >> 8;
+        }
+        case 0xFF05: // TIMA
+            catchUpTimer(systemCycles - 1);
+            return *memory.memoryMap[0xFF05];
+        default:
+            return *memory.memoryMap[addr];
+    }
+}
+
+void writeTimer(uint16_t addr, uint8_t value) {
+    syncTimer();
+    uint16_t counter = (uint16_t)(systemCycles - 1 - timer.divBase);
+    uint8_t tac = *memory.memoryMap[0xFF07];
+
+    switch (addr) {
+        case 0xFF04: // DIV, any write resets the whole internal counter
+            if (timerSignal(tac, counter)) glitchIncrement(); //selected bit drops to 0 with it
+            resetDivAPU(counter); //frame sequencer runs off DIV too
+            timer.divBase = systemCycles;
+            timer.edgeStart = systemCycles;
+            break;
+        case 0xFF05: // TIMA
+            if (timer.reloadCycle > systemCycles) timer.reloadCycle = 0; //write during the delay cancels the reload
+            *memory.memoryMap[0xFF05] = value;
+            break;
+        case 0xFF06: // TMA, a write on the reload cycle still gets used
+            *memory.memoryMap[0xFF06] = value;
+            break;
+        case 0xFF07: // TAC
+            *memory.memoryMap[0xFF07] = value;
+            if (timerSignal(tac, counter) && !timerSignal(value, counter)) glitchIncrement(); //disabling or switching bit can tick TIMA
+            break;
+    }
+}
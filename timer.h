@@ -0,0 +1,26 @@
+#ifndef TIMER_H
+#define TIMER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+
+//DIV/TIMA only get touched when something happens, the counts in between are worked out from the cycle counter
+typedef struct {
+    uint64_t divBase; //systemCycles the internal DIV counter last started from 0
+    uint64_t lastCycle; //TIMA in memory.io is correct up to the end of this cycle
+    uint64_t edgeStart; //no counter edges on or before this cycle, set when DIV is reset
+    uint64_t reloadCycle; //cycle TIMA gets TMA and the interrupt fires after an overflow, 0 = none pending
+    uint64_t nextEventCycle; //stepTimer has nothing to do before this
+} TimerState;
+
+extern TimerState timer;
+
+void initTimer();
+void stepTimer();
+void syncTimer();
+uint8_t readTimer(uint16_t addr);
+void writeTimer(uint16_t addr, uint8_t value);
+
+#endif
@@ -0,0 +1,156 @@
+#include "trace.h"
+#include "cpu.h"
+#include "memory.h"
+#include "disasm.h"
+#include "symbols.h"
+
+TraceState trace;
+
+//Writer thread, takes whatever has been published and appends it, a wrapped ring goes out in two writes
+static int traceWriter(void *data) {
+    (void)data;
+    unsigned tail = 0;
+    while (1) {
+        SDL_SemWaitTimeout(trace.wake, 50);
+        int quitting = SDL_AtomicGet(&trace.quit); //before the head, so the last publish is seen when quitting
+        unsigned head = (unsigned)SDL_AtomicGet(&trace.publishedHead);
+        while (tail != head) {
+            unsigned start = tail & (TRACE_RING_RECORDS - 1);
+            unsigned count = head - tail;
+            if (count > TRACE_RING_RECORDS - start) count = TRACE_RING_RECORDS - start; //up to the end of the ring, the rest next time round
+            fwrite(&trace.ring[start], sizeof(TraceRecord), count, trace.file);
+            trace.bytesWritten += (uint64_t)count * sizeof(TraceRecord);
+            tail += count;
+            SDL_AtomicSet(&trace.tail, (int)tail); //room for the emulation thread again
+        }
+        if (quitting) break;
+    }
+    return 0;
+}
+
+int startTrace(const char *path) {
+    memset(&trace, 0, sizeof(trace));
+    trace.ring = malloc(sizeof(TraceRecord) * TRACE_RING_RECORDS);
+    if (!trace.ring) return -1;
+
+    if (path) {
+        trace.file = fopen(path, "wb");
+        if (!trace.file) {
+            perror("Failed to open trace file");
+            return -1;
+        }
+        TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), 0 };
+        fwrite(&header, sizeof(header), 1, trace.file);
+        trace.wake = SDL_CreateSemaphore(0);
+        trace.thread = SDL_CreateThread(traceWriter, "trace", NULL);
+        if (!trace.thread) {
+            printf("Failed to start trace writer: %s\n", SDL_GetError());
+            fclose(trace.file);
+            trace.file = NULL;
+            return -1;
+        }
+    }
+    trace.active = 1;
+    return 0;
+}
+
+void traceInstruction() {
+    unsigned head = trace.head;
+    if (trace.file && head - (unsigned)SDL_AtomicGet(&trace.tail) >= TRACE_RING_RECORDS) {
+        //disk can't keep up, wait for room rather than lose records
+        SDL_AtomicSet(&trace.publishedHead, (int)head);
+        trace.stalls++;
+        while (head - (unsigned)SDL_AtomicGet(&trace.tail) >= TRACE_RING_RECORDS) {
+            SDL_SemPost(trace.wake);
+            SDL_Delay(1);
+        }
+    }
+
+    TraceRecord *r = &trace.ring[head & (TRACE_RING_RECORDS - 1)];
+    uint16_t pc = CPUreg.PC;
+    r->cycle = systemCycles;
+    r->pc = pc;
+    r->sp = CPUreg.SP;
+    r->af = CPUreg.af.AF;
+    r->bc = CPUreg.bc.BC;
+    r->de = CPUreg.de.DE;
+    r->hl = CPUreg.hl.HL;
+    for (int i = 0; i < 4; i++) r->pcmem[i] = *memory.memoryMap[(uint16_t)(pc + i)];
+    r->bank = pc < 0x8000 ? (uint16_t)((memory.memoryMap[pc] - memory.cartridge) >> 14) : (uint16_t)symbolBank(pc);
+    r->ime = CPUreg.IME;
+
+    trace.head = ++head;
+    if ((head & (TRACE_PUBLISH_RECORDS - 1)) == 0) {
+        SDL_AtomicSet(&trace.publishedHead, (int)head);
+        if (trace.file && (head & (TRACE_RING_RECORDS / 4 - 1)) == 0) SDL_SemPost(trace.wake); //a quarter of the ring is waiting
+    }
+}
+
+//gameboy-doctor's line format, nothing else on it so its compare tool takes the output as is
+static void printDoctorLine(const TraceRecord *r, FILE *out) {
+    fprintf(out, "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
+        r->af >> 8, r->af & 0xFF, r->bc >> 8, r->bc & 0xFF, r->de >> 8, r->de & 0xFF, r->hl >> 8, r->hl & 0xFF,
+        r->sp, r->pc, r->pcmem[0], r->pcmem[1], r->pcmem[2], r->pcmem[3]);
+}
+
+void dumpTraceTail(int count) {
+    if (!trace.active) return;
+    if ((unsigned)count > trace.head) count = (int)trace.head;
+    if (count > TRACE_RING_RECORDS) count = TRACE_RING_RECORDS;
+    printf("Last %d instructions:\n", count);
+    for (unsigned i = trace.head - count; i != trace.head; i++) {
+        const TraceRecord *r = &trace.ring[i & (TRACE_RING_RECORDS - 1)];
+        char where[300], text[DISASM_LINE_MAX];
+        formatSymbol(r->bank, r->pc, where, sizeof(where));
+        disassembleBytes(r->pcmem, r->pc, r->bank, text, sizeof(text));
+        printf("%10llu %-24s %-20s ", (unsigned long long)r->cycle, where, text);
+        printDoctorLine(r, stdout);
+    }
+}
+
+void stopTrace() {
+    if (!trace.active) return;
+    trace.active = 0;
+    trace.records = trace.head;
+    if (trace.thread) {
+        SDL_AtomicSet(&trace.publishedHead, (int)trace.head);
+        SDL_AtomicSet(&trace.quit, 1);
+        SDL_SemPost(trace.wake);
+        SDL_WaitThread(trace.thread, NULL);
+        SDL_DestroySemaphore(trace.wake);
+        trace.thread = NULL;
+    }
+    if (trace.file) fclose(trace.file);
+    trace.file = NULL;
+    free(trace.ring);
+    trace.ring = NULL;
+}
+
+int decodeTrace(const char *path, FILE *out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("Failed to open trace");
+        return -1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC
+        || header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        printf("%s isn't a trace from this version of the emulator\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    static TraceRecord records[4096];
+    size_t got;
+    while ((got = fread(records, sizeof(TraceRecord), 4096, f)) > 0) {
+        for (size_t i = 0; i < got; i++) printDoctorLine(&records[i], out);
+    }
+    fclose(f);
+    return 0;
+}
+
+void printTraceStats() {
+    if (trace.records == 0) return;
+    printf("Trace: %llu instructions, %.1f MB written, emulation waited on the writer %llu times\n",
+        (unsigned long long)trace.records, trace.bytesWritten / 1e6, (unsigned long long)trace.stalls);
+}
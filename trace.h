@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h> //for unsignted ints
+#include <string.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h> //thread that drains the ring to the file
+
+#define TRACE_MAGIC 0x52544247 //"GBTR"
+#define TRACE_VERSION 1
+#define TRACE_RING_RECORDS (1 << 16) //2MB, power of two
+#define TRACE_PUBLISH_RECORDS 256 //head goes out to the writer this often, not on every instruction
+#define TRACE_DUMP_RECORDS 32 //how many get printed when the CPU hits an invalid opcode
+
+//One instruction, CPU state right before it runs. Fixed size so the file is just an array of these
+typedef struct {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t af, bc, de, hl;
+    uint8_t pcmem[4]; //bytes at PC, what gameboy-doctor wants to see
+    uint16_t bank; //ROM bank PC was in, as .sym files number them
+    uint8_t ime;
+    uint8_t reserved[5];
+} TraceRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+} TraceHeader;
+
+//Records go into a ring on the emulation thread, a writer thread drains it to the file. Without a
+//file the ring just keeps the most recent ones for the invalid opcode dump.
+typedef struct {
+    int active; //stepCPU records only while this is set
+    TraceRecord *ring;
+    unsigned head; //emulation thread's own count
+    SDL_atomic_t publishedHead; //what the writer may take
+    SDL_atomic_t tail; //what the writer has taken, only matters with a file
+
+    FILE *file;
+    SDL_Thread *thread;
+    SDL_sem *wake;
+    SDL_atomic_t quit;
+
+    //stats
+    uint64_t records;
+    uint64_t stalls; //ring full, emulation waited on the disk
+    uint64_t bytesWritten;
+} TraceState;
+
+extern TraceState trace;
+
+int startTrace(const char *path); //NULL keeps the ring in memory only, 0 on success
+void traceInstruction(); //stepCPU, before each instruction while active
+void dumpTraceTail(int count); //last records to stdout, newest last
+void stopTrace(); //drains the ring to the file and stops the writer
+int decodeTrace(const char *path, FILE *out); //trace file to gameboy-doctor text
+void printTraceStats();
+
+#endif